@@ -18,6 +18,24 @@
  *           - msgserverthread.cpp,
  *           - msgthreadhandler.h
  *           - msgthreadhandler.cpp
+ *           - msgiothread.h
+ *           - msgiothread.cpp
+ *           - msgstats.h
+ *           - msgstats.cpp
+ *           - msgrules.h
+ *           - msgrules.cpp
+ *           - msghandoff.h
+ *           - msghandoff.cpp
+ *           - msgcommands.h
+ *           - msgcommands.cpp
+ *           - msgexec.h
+ *           - msgexec.cpp
+ *           - msgtail.h
+ *           - msgtail.cpp
+ *           - msgsyslog.h
+ *           - msgsyslog.cpp
+ *           - msgformat.h
+ *           - msgformat.cpp
  *
  *        Purpose: simple message/command exchange in interprocess communication (for example remoted application controll/monitoring)
  *
@@ -30,6 +48,52 @@
  *
  *        Message Center Client connections can be also local connection
  *
+ *        The senders are partitioned into shards by hash of the sender id. Each shard has its own lock and its own
+ *        routing table (sender => subscribed clients), so the messages of senders of different shards are routed
+ *        in parallel by the posting threads, and a message is routed only to its subscribers without scanning the
+ *        whole client list. The clients list is protected by the center mutex, which is never taken by postMessage.
+ *
+ *        Optionally (startDispatchers) each shard has a dispatch stage: the posting threads only append the messages
+ *        to a queue for each sender, and a dispatcher thread for each shard routes them servicing the sender queues
+ *        by deficit round robin with configurable weights. A flooding sender so delays only its own subscribers.
+ *
+ *        Every posted message is counted into a heavy hitters sketch of its shard (constant memory, see msgstats.h),
+ *        and the command 'top [N]' shows the N senders with highest message rate, refreshed at a fixed frame rate.
+ *
+ *        The messages of the senders with pattern mining enabled are clustered into templates by the routing stage
+ *        (see SCDMsgPatterns): 'patterns <sender>' shows the template counts, and 'digest <sender>' spies the sender
+ *        receiving only the first occurrence of each template and the count of the templates at each power of ten.
+ *
+ *        Every posted message is also evaluated against the alert rules (see SCDMsgRules): each shard keeps its own copy
+ *        of the compiled rules with the sliding windows of its senders, so no other lock is taken. A fired rule posts an
+ *        alert message to sender 'alerts', which the clients can spy.
+ *
+ *        State messages (postState) carry a key: the last message of each key is kept into a cache of the shard, and
+ *        sent to the new subscribers of the sender, and the client sessions conflate the pending messages with the
+ *        same key, so the output to slow clients is bounded by the number of keys instead of the update rate.
+ *
+ *        Every message routed for a sender receives the next sequence number of the sender and is kept into the sender
+ *        history (a ring of the last HistorySize messages). A client which opened a session ('session' command) receives
+ *        the sequence numbers, and after a reconnection it resumes the spied sender from the last acknowledged sequence
+ *        ('resume <token>'): the missed messages are replayed from history, and the evicted ones are reported by a gap marker.
+ *
+ *        On a restart of the application the message center can be handed off to the new process (see SCDMsgHandoff):
+ *        the client connections are passed with their state, and the sessions, sequence numbers, history, last values
+ *        and alert rules are serialized (handOff) and restored by the successor (restoreState). The sessions are
+ *        drained before their sockets are passed, so only one process at a time writes to a connection.
+ *
+ *        The console commands are kept into a registry (see SCDMsgCommands): a command line is tokenized once, resolved
+ *        by a hash lookup and its arguments are checked against their types. The application can register its own
+ *        commands (addCommand) and the commands accepted by its senders (addSenderCommand), and the help is generated.
+ *
+ *        The application can allow the admin clients to run some commands of the host (allowExec, see SCDMsgExec): the output
+ *        of the process is posted to a temporary sender spied by the client, and the process pipes are read only while
+ *        the client backlog is under a threshold.
+ *
+ *        Each client selects the output format of the spied messages ('format', see SCDMsgFormat): JSON Lines or a line
+ *        template. The formats are compiled once and shared by the clients with the same spec (until the last one
+ *        leaves it), and a message is encoded once by the routing stage for all the subscribers with the same format.
+ *
  *        Application that use message center need to implement a socket sever to allow remote inter-process communication.
  *        The socket server as been developed and is already distribuited with this file.
  *        You don't need to develop the socket sever.
@@ -38,318 +102,2370 @@
  */
 
 #include "msgcenter.h"
+#include "msgthreadhandler.h"
+#include "msghandoff.h"
+#include "msgexec.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QDateTime>
+
+/**
+ * @brief The SCDMsgDispatcher class dispatch stage thread of a shard
+ */
+class SCDMsgDispatcher : public QThread
+{
+  public:
+
+    SCDMsgDispatcher(SCDMsgCenter *mc, SCDMsgCenter::Shard *shard) : mc(mc), shard(shard) {}
+
+  protected:
+
+    void run() {mc->serveShard(shard);}
+
+  private:
+
+    SCDMsgCenter *mc;
+
+    SCDMsgCenter::Shard *shard;
+};
 
 
 /**
  * @brief SCDMsgCenter::SCDMsgCenter
  * @param parent
+ * @param shardCount number of sender partitions: use more shards when many threads post messages concurrently
  */
-SCDMsgCenter::SCDMsgCenter(QObject *parent) : QObject(parent)
+SCDMsgCenter::SCDMsgCenter(QObject *parent, int shardCount) : QObject(parent)
 {
+   for (int n=0; n<qMax(1,shardCount); n++)
+   {
+      shards.append(new Shard());
+
+      shards.last()->clock.start();
+   }
+
+   senders.append(AlertSender);
+
+   registerCommands();
+
+   topTimer = new QTimer(this);
 
+   topTimer->setInterval(1000);
+
+   connect(topTimer,SIGNAL(timeout()),this,SLOT(refreshTop()));
+
+   topClock.start();
 }
 
 /**
- * @brief SCDMsgCenter::addClient add client socket to message recipient list
- * @param socket
- * @return
+ * @brief SCDMsgCenter::~SCDMsgCenter
  */
-void SCDMsgCenter::addClient(int socketDescriptor)
+SCDMsgCenter::~SCDMsgCenter()
 {
-   QMutexLocker locker(&mutex);
+   for (int n=0; n<shards.size(); n++) // stops dispatcher threads
+   {
+      Shard *shard = shards.at(n);
+
+      if (shard->dispatcher)
+      {
+         QMutexLocker locker(&shard->mutex);
 
-   registerClient(socketDescriptor);
+         shard->running = false;
+         shard->wake.wakeAll();
 
-   locker.unlock();
+         locker.unlock();
+
+         shard->dispatcher->wait();
+
+         delete shard->dispatcher;
+      }
+   }
+
+   qDeleteAll(shards);
+
+   qDeleteAll(formats);
 }
 
 /**
- * @brief SCDMsgCenter::removeClient remove client socket from message recipent list
- * @param socket
- * @return
+ * @brief SCDMsgCenter::startDispatchers starts a dispatcher thread for each shard: from now on messages are queued by
+ *                                       sender and routed by deficit round robin, so that a flooding sender can not
+ *                                       crowd out the others. Should be called before senders start posting.
+ * @param quantum bytes routed for each sender (and unit of weight) on each round
+ * @param maxQueueBytes max size of pending messages of a sender, newer messages are dropped (and counted)
  */
-void SCDMsgCenter::removeClient(int socketDescriptor)
+void SCDMsgCenter::startDispatchers(int quantum, qint64 maxQueueBytes)
 {
    QMutexLocker locker(&mutex);
 
-   unregisterClient(socketDescriptor);
+   Quantum       = qMax(1,quantum);
+   MaxQueueBytes = maxQueueBytes;
 
-   locker.unlock();
+   for (int n=0; n<shards.size(); n++)
+   {
+      Shard *shard = shards.at(n);
+
+      QMutexLocker shardLocker(&shard->mutex);
+
+      if (!shard->dispatcher)
+      {
+         shard->running    = true;
+         shard->dispatcher = new SCDMsgDispatcher(this,shard);
+
+         shard->dispatcher->setObjectName("mc-dispatch-" + QString::number(n));
+         shard->dispatcher->start();
+      }
+   }
 }
 
 /**
- * @brief SCDMsgCenter::addSender add a new sender to sender list, before send any a message the sender must already be in the sender list
- * @param id
- * @return
+ * @brief SCDMsgCenter::setSenderWeight sets the share of dispatch bandwidth of sender (default 1)
+ * @param sender
+ * @param weight
  */
-void SCDMsgCenter::addSender(QString sender)
+void SCDMsgCenter::setSenderWeight(QString sender, int weight)
 {
-   QMutexLocker locker(&mutex);
+   Shard *shard = shardOf(sender);
 
-   registerMessageSender(sender);
+   QMutexLocker locker(&shard->mutex);
 
-   locker.unlock();
+   shard->queues[sender].weight = qMax(1,weight);
 }
 
 /**
- * @brief SCDMsgCenter::removeSender remove the sender fronm sender list
- * @param id
- * @return
+ * @brief SCDMsgCenter::setTopRefresh sets the frame interval of top senders view
+ * @param msec
  */
-void SCDMsgCenter::removeSender(QString sender)
+void SCDMsgCenter::setTopRefresh(int msec)
 {
-   QMutexLocker locker(&mutex);
-
-   unregisterMessageSender(sender);
-
-   locker.unlock();
+   topTimer->setInterval(qMax(100,msec));
 }
 
 /**
- * @brief SCDMsgCenter::clientSendCommand client send a command to message center.
- *
- * @param cmd commands recognized commands:
- *
- *     - list                   => get a list of message senders
- *     - spy <sender id>        => receive message only by sender identified by id
- *     - <cr> (carriage return) => stop realtime message receiving and show help
- *     - help                   => show help
- *     - exit                   => close client socket connection
- *     - @<command> <sender id> => sender a string to sender by message center
- *     - ping                   => message center reply pong (use for checking if application running)
- *     - <unkown command>       => return echo of command\n";
- *
- *     typing unknown commands causes echo reply from message center.
- *
- * @param client socket descriptor
- *
- * @return
+ * @brief SCDMsgCenter::setPatternMining enables or disables the clustering of sender messages into templates.
+ *                                       Mining is also enabled by the commands 'patterns' and 'digest'.
+ * @param sender
+ * @param enable
  */
-void SCDMsgCenter::sendCommand(QString cmd, int clientSocketDescriptor)
+void SCDMsgCenter::setPatternMining(QString sender, bool enable)
 {
-   QMutexLocker locker(&mutex);
+   Shard *shard = shardOf(sender);
 
-   processCommand(cmd,clientSocketDescriptor);
+   QMutexLocker locker(&shard->mutex);
 
-   locker.unlock();
+   if (!enable)
+   {
+      shard->patterns.remove(sender);
+   }
+   else
+   if (!shard->patterns.contains(sender))
+   {
+      shard->patterns.insert(sender,SCDMsgPatterns());
+   }
 }
 
 /**
- * @brief SCDMsgCenter::senderPostMessage post a message from sender to message center, the message will be forwarded
- *                                     realtime to all client who request to receive it from this sender.
- * @param mmessage message to send
+ * @brief SCDMsgCenter::setHistorySize sets the number of messages (or batches) kept for each sender to resume the
+ *                                     sessions. Should be called before senders start posting.
+ * @param records 0: no history
  */
-void SCDMsgCenter::postMessage(QString msg, QString sender, bool prependNewLine)
+void SCDMsgCenter::setHistorySize(int records)
 {
-   QMutexLocker locker(&mutex);
+   for (int n=0; n<shards.size(); n++)
+   {
+      Shard *shard = shards.at(n);
 
-   msg = sender + ": " + msg;
+      QMutexLocker locker(&shard->mutex);
 
-   if (prependNewLine)
-   {
-      msg.prepend(LF);
+      HistorySize = qMax(0,records);
+
+      shard->history.clear();
    }
+}
+
+/**
+ * @brief SCDMsgCenter::addRule adds an alert rule (replaces the rule with the same name). The rule is compiled into
+ *                              every shard.
+ * @param rule
+ */
+void SCDMsgCenter::addRule(const SCDMsgRule &rule)
+{
+   for (int n=0; n<shards.size(); n++)
+   {
+      Shard *shard = shards.at(n);
 
-   processMessage(msg,sender);
+      QMutexLocker locker(&shard->mutex);
 
-   locker.unlock();
+      shard->rules.add(rule);
+   }
 }
 
 /**
- * @brief SCDMsgCenter::getClient get the connected client identified by socket descriptor
- * @param socketDescriptor
- * @return
+ * @brief SCDMsgCenter::removeRule removes an alert rule
+ * @param name
+ * @return false if rule not found
  */
-SCDMsgCenter::Client SCDMsgCenter::getClient(int socketDescriptor)
+bool SCDMsgCenter::removeRule(QString name)
 {
-   Client client;
+   bool removed = false;
 
-   for (int n=0; n<clients.size();n++)
+   for (int n=0; n<shards.size(); n++)
    {
-      if (clients.at(n).socketDescriptor==socketDescriptor)
-      {
-         client = clients.at(n);
-         client.index  = n; // set client index
-         return client;
-      }
-   }
+      Shard *shard = shards.at(n);
 
-   client.index = -1; // client not found
+      QMutexLocker locker(&shard->mutex);
 
-   return client;
+      removed = shard->rules.remove(name);
+   }
+
+   return removed;
 }
 
 /**
- * @brief SCDMsgCenter::getSenderList get list of sender
+ * @brief SCDMsgCenter::rules returns the alert rules
  * @return
  */
-QStringList SCDMsgCenter::getSenderList()
+QVector<SCDMsgRule> SCDMsgCenter::rules()
 {
-   return senders;
+   Shard *shard = shards.first();
+
+   QMutexLocker locker(&shard->mutex);
+
+   return shard->rules.rules();
 }
 
 /**
- * @brief SCDMsgCenter::getHelpString return the menu string
- * @return
+ * @brief SCDMsgCenter::addCommand registers an application console command. The arguments are checked against the
+ *                                 argument spec before calling the handler, e.g. "<name> [<count:int>]"
+ *                                 (see SCDMsgCommands), and the command is listed by help.
+ * @param name
+ * @param args argument spec
+ * @param help
+ * @param handler called by message center thread, returns the reply to client
+ * @return false if name is a built-in command or args is not valid
  */
-QString SCDMsgCenter::getHelpString()
+bool SCDMsgCenter::addCommand(QString name, QString args, QString help, SCDMsgCommandHandler handler)
 {
-   return " Command Help:\n\n"
-          "   - list                    => get a list of message senders\n"
-          "   - spy <sender id>         => receive message only by sender identified by sender id\n"
-          "   - <cr> (carriage return)  => stop realtime message receiving and show help\n"
-          "   - help                    => show this help\n"
-          "   - exit                    => close connection to message center\n"
-          "   - @<sender id> <command>  => sends a string to sender by message center\n"
-          // "   - @<sender id> help       => elenco dei comandi riconosciuti dal sender\n"
-          // "   - @shell                  => apre un terminale shell (crea un thread speciale nell'applicazione)\n"
-          "   - ping                    => message center reply pong\n"
-          "   - <unkown command>        => return echo of command\n";
+   QMutexLocker locker(&mutex);
+
+   const SCDMsgCommands::Command *command = commands.find(name.toLower());
+
+   if ((command && command->id!=ApplicationCommand) || !handler)
+   {
+      return false;
+   }
+
+   return commands.add(name,args,help,ApplicationCommand,handler);
 }
 
 /**
- * @brief SCDMsgCenter::getPrompt return the console prompt
- * @param socketDescriptor
- * @return a null string if client not found or menu prompt
+ * @brief SCDMsgCenter::removeCommand removes an application console command
+ * @param name
+ * @return false if command not found or built-in
  */
-QString SCDMsgCenter::getPrompt(int socketDescriptor)
+bool SCDMsgCenter::removeCommand(QString name)
 {
-   Client client = getClient(socketDescriptor);
+   QMutexLocker locker(&mutex);
 
-   if (client.index > -1)
+   const SCDMsgCommands::Command *command = commands.find(name.toLower());
+
+   if (!command || command->id!=ApplicationCommand)
    {
-      return "\n" + client.name + ":> ";
+      return false;
    }
 
-   return "";
+   return commands.remove(name);
 }
 
 /**
- * @brief SCDMsgCenter::sendMessageToClient send message to destination socket thread must process this message (signal).
- * @param msg
- * @param socketDescriptor
+ * @brief SCDMsgCenter::addSenderCommand registers a command accepted by sender: it is listed by '@<sender id> help',
+ *                                       and the arguments of '@<sender id> <command>' are checked before emitting
+ *                                       commandToSender_signal. A sender which registers its commands receives only
+ *                                       the registered ones. The commands are removed with the sender.
+ * @param sender
+ * @param name
+ * @param args argument spec (see SCDMsgCommands)
+ * @param help
+ * @return false if args is not valid
  */
-void SCDMsgCenter::sendMessageToClient(QString msg, int clientSocketDescriptor)
+bool SCDMsgCenter::addSenderCommand(QString sender, QString name, QString args, QString help)
 {
-   emit messageToClient_signal(msg, clientSocketDescriptor); // serialize the messages to clients
+   QMutexLocker locker(&mutex);
+
+   return senderCommands[sender].add(name,args,help,ApplicationCommand);
 }
 
 /**
- * @brief SCDMsgCenter::message_slot receives and process a message from sender.
- *                                sends message to destination client which asked to receive it
- * @param message message
- * @param sender  from sender
+ * @brief SCDMsgCenter::allowExec allows the admin clients to run a command of the host ('exec' command, see
+ *                                SCDMsgExec). The first call enables the 'exec' command. Must be called by the message
+ *                                center thread (the thread which created it).
+ * @param name name of command for 'exec'
+ * @param program program path (searched into PATH if it has no '/'), run without shell
+ * @param args fixed arguments
+ * @param argPattern regular expression matched by each argument appended by the user (empty: no user arguments)
+ * @param options the user arguments can start with '-'
  */
-void SCDMsgCenter::processMessage(QString msg, QString sender)
+void SCDMsgCenter::allowExec(QString name, QString program, QStringList args, QString argPattern, bool options)
 {
-   Client client;
+   QMutexLocker locker(&mutex);
 
-   for (int n=0; n<clients.size();n++)
+   if (!executor)
    {
-      client = clients.at(n);
+      executor = new SCDMsgExec(this);
 
-      if (client.Sender==sender and client.mode==1)
-      {
-         sendMessageToClient(msg, client.socketDescriptor);
-      }
+      commands.add("exec","[<command>] [<args:text>]","run an allowed command and receive its output (without command: list, admin)",ExecCommand,SCDMsgCommandHandler(),true);
    }
+
+   executor->allow(name,program,args,argPattern,options);
 }
 
 /**
- * @brief SCDMsgCenter::removeClient_slot
- * @param socket
+ * @brief SCDMsgCenter::clientBacklog thread safe: bytes queued for client and not yet sent
+ * @param socketDescriptor
+ * @return -1 if client not found
  */
-void SCDMsgCenter::unregisterClient(int socketDescriptor)
+qint64 SCDMsgCenter::clientBacklog(int socketDescriptor)
 {
+   QMutexLocker locker(&mutex);
+
    Client client = getClient(socketDescriptor);
 
-   if (client.index > -1)
+   if (client.index<0)
    {
-      clients.removeAt(client.index);
+      return -1;
    }
+
+   return client.handler ? client.handler->backlog() : 0;
 }
 
 /**
- * @brief SCDMsgCenter::removeSender_slot
- * @param sender
+ * @brief SCDMsgCenter::addClient add client socket to message recipient list
+ * @param socket
+ * @param handler client session which receives the messages, if null the messages are emitted by messageToClient_signal
+ * @return
  */
-void SCDMsgCenter::unregisterMessageSender(QString sender)
+void SCDMsgCenter::addClient(int socketDescriptor, SCDMsgThreadHandler *handler)
 {
-   senders.removeOne(sender);
+   QMutexLocker locker(&mutex);
+
+   registerClient(socketDescriptor,handler);
+
+   locker.unlock();
 }
 
 /**
- * @brief SCDMsgCenter::addClient_slot
- * @param socket
+ * @brief SCDMsgCenter::setClientDispatcher sets the batch dispatcher of the I/O thread which hosts a client session.
+ *                                          While a session moves to another I/O thread the dispatcher is null: the
+ *                                          messages are posted to the session itself, and follow it.
+ * @param socketDescriptor
+ * @param dispatcher
+ * @return false if the client is not registered
  */
-void SCDMsgCenter::registerClient(int socketDescriptor)
+bool SCDMsgCenter::setClientDispatcher(int socketDescriptor, QObject *dispatcher)
 {
+   QMutexLocker locker(&mutex);
+
    Client client = getClient(socketDescriptor);
 
-   if (client.index==-1) // client not exixst
+   if (client.index<0)
    {
-      client.socketDescriptor = socketDescriptor;
+      return false;
+   }
 
-      client.name   = "Host-" + QString::number(socketDescriptor);
-      client.user   = "Anonymous";
-      client.admin  = 0;
-      client.mode   = 0; // console
+   client.dispatcher = dispatcher;
 
-      clients.append(client);
+   clients.replace(client.index,client);
 
-      QString msg = "\n\nMessage Center 1.0\n\n" + getHelpString() + getPrompt(socketDescriptor);
+   updateRoute(client);
 
-      sendMessageToClient(msg, socketDescriptor);
-   }
+   return true;
 }
 
 /**
- * @brief SCDMsgCenter::addSender_slot insert the sendet into registered sender list. if already inserted do nothing.
- * @param sender
+ * @brief SCDMsgCenter::removeClient remove client socket from message recipent list
+ * @param socket
+ * @return
  */
-void SCDMsgCenter::registerMessageSender(QString sender)
+void SCDMsgCenter::removeClient(int socketDescriptor)
 {
-   if (!senders.contains(sender))
-   {
-      senders.append(sender);
-   }
+   QMutexLocker locker(&mutex);
+
+   unregisterClient(socketDescriptor);
+
+   locker.unlock();
 }
 
 /**
- * @brief SCDMsgCenter::processCommand Process client command
- * @param cmd command emit by client
- * @param socketDescriptor client id
+ * @brief SCDMsgCenter::addSender add a new sender to sender list, before send any a message the sender must already be in the sender list
+ * @param id
+ * @return
  */
-void SCDMsgCenter::processCommand(QString cmd, int clientSocketDescriptor)
+void SCDMsgCenter::addSender(QString sender)
 {
-   QStringList list;
+   QMutexLocker locker(&mutex);
 
-   Client client = getClient(clientSocketDescriptor);
+   registerMessageSender(sender);
 
-   list = cmd.split(" ",QString::SkipEmptyParts,Qt::CaseInsensitive);
+   locker.unlock();
+}
 
-   cmd = list[0];
+/**
+ * @brief SCDMsgCenter::removeSender remove the sender fronm sender list
+ * @param id
+ * @return
+ */
+void SCDMsgCenter::removeSender(QString sender)
+{
+   QMutexLocker locker(&mutex);
 
-   cmd = cmd.toLower();
+   unregisterMessageSender(sender);
 
-   if (cmd=="\r\n" || cmd=="\n") // update client mode => console mode
-   {
-      client.mode=0;
-      clients.replace(client.index,client);
+   locker.unlock();
+}
+
+/**
+ * @brief SCDMsgCenter::clientSendCommand client send a command to message center.
+ *
+ * @param cmd commands recognized commands:
+ *
+ *     - list                   => get a list of message senders
+ *     - spy <sender id>        => receive message only by sender identified by id
+ *     - <cr> (carriage return) => stop realtime message receiving and show help
+ *     - help                   => show help
+ *     - exit                   => close client socket connection
+ *     - @<command> <sender id> => sender a string to sender by message center
+ *     - ping                   => message center reply pong (use for checking if application running)
+ *     - <unkown command>       => return echo of command\n";
+ *
+ *     typing unknown commands causes echo reply from message center.
+ *
+ * @param client socket descriptor
+ *
+ * @return
+ */
+void SCDMsgCenter::sendCommand(QString cmd, int clientSocketDescriptor)
+{
+   QMutexLocker locker(&mutex);
+
+   if (handingOff) // the routes must not change while the sessions drain
+   {
+      return;
+   }
+
+   processCommand(cmd,clientSocketDescriptor);
+
+   locker.unlock();
+}
+
+/**
+ * @brief SCDMsgCenter::senderPostMessage post a message from sender to message center, the message will be forwarded
+ *                                     realtime to all client who request to receive it from this sender.
+ * @param mmessage message to send
+ */
+void SCDMsgCenter::postMessage(QString msg, QString sender, bool prependNewLine)
+{
+   msg = sender + ": " + msg;
+
+   if (prependNewLine)
+   {
+      msg.prepend(LF);
+   }
+
+   processMessage(msg,sender); // locks only the sender shard
+}
+
+/**
+ * @brief SCDMsgCenter::postMessage post a message with a level (see Level), which is evaluated by the alert rules
+ * @param msg
+ * @param sender
+ * @param level
+ * @param prependNewLine
+ */
+void SCDMsgCenter::postMessage(QString msg, QString sender, int level, bool prependNewLine)
+{
+   msg = sender + ": " + msg;
+
+   if (prependNewLine)
+   {
+      msg.prepend(LF);
+   }
+
+   dispatch(sender,SCDMsgEvent::Text,msg,QByteArray(),1,level);
+}
+
+/**
+ * @brief SCDMsgCenter::postMessages post a batch of messages from sender to message center. The whole batch is routed
+ *                                   with a single shard lock and lands into each subscriber queue as a single block.
+ * @param sender
+ * @param msgs
+ * @param prependNewLine
+ */
+void SCDMsgCenter::postMessages(QString sender, const QStringList &msgs, bool prependNewLine)
+{
+   if (msgs.isEmpty())
+   {
+      return;
+   }
+
+   QString batch;
+
+   int size = 0;
+
+   for (int n=0; n<msgs.size(); n++)
+   {
+      size += msgs.at(n).size();
+   }
+
+   batch.reserve(size + msgs.size()*(sender.size() + 3));
+
+   for (int n=0; n<msgs.size(); n++)
+   {
+      if (prependNewLine)
+      {
+         batch += LF;
+      }
+
+      batch += sender;
+      batch += ": ";
+      batch += msgs.at(n);
+   }
+
+   dispatch(sender,SCDMsgEvent::Text,batch,QByteArray(),msgs.size());
+}
+
+/**
+ * @brief SCDMsgCenter::postData post a binary payload (audio snippet, state dump...) from sender to message center.
+ *                               The payload is written to the clients which spy the sender in chunks interleaved
+ *                               with the normal messages, see SCDMsgThreadHandler.
+ * @param data
+ * @param sender
+ */
+void SCDMsgCenter::postData(QByteArray data, QString sender)
+{
+   dispatch(sender,SCDMsgEvent::Data,sender,data);
+}
+
+/**
+ * @brief SCDMsgCenter::postState post a state message 'key=value' (bitrate, number of clients...) from sender to
+ *                                message center. Only the last value of a key matters: a slow client receives only
+ *                                the last value of each key, and a new subscriber receives at once the current value
+ *                                of every key of the sender.
+ * @param key
+ * @param value
+ * @param sender
+ */
+void SCDMsgCenter::postState(QString key, QString value, QString sender)
+{
+   QString msg = LF + sender + ": " + key + "=" + value;
+
+   dispatch(sender,SCDMsgEvent::Keyed,msg,key.toUtf8());
+}
+
+/**
+ * @brief SCDMsgCenter::addFile publishes a file which the clients can download by command 'get <name>'
+ * @param name
+ * @param path
+ */
+void SCDMsgCenter::addFile(QString name, QString path)
+{
+   QMutexLocker locker(&mutex);
+
+   files.insert(name,path);
+}
+
+/**
+ * @brief SCDMsgCenter::removeFile removes a published file
+ * @param name
+ */
+void SCDMsgCenter::removeFile(QString name)
+{
+   QMutexLocker locker(&mutex);
+
+   files.remove(name);
+}
+
+/**
+ * @brief SCDMsgCenter::setUserProfile sets the output share (weight) and the bandwidth cap of the sessions of a user.
+ *                                     The clients select their user by the command 'user <name> [<secret>]', the
+ *                                     default user is 'Anonymous'. A profile with a secret is selected only with its
+ *                                     secret; the admin commands are allowed only to an admin profile with a secret.
+ * @param user
+ * @param weight output share of each session of the user into its I/O thread (admin consoles should have high weight)
+ * @param bytesPerSecond bandwidth cap shared by all sessions of the user (0: no cap)
+ * @param admin admin user (requires a secret)
+ * @param secret required to select the profile (empty: any client can select it)
+ */
+void SCDMsgCenter::setUserProfile(QString user, int weight, qint64 bytesPerSecond, bool admin, QString secret)
+{
+   QMutexLocker locker(&mutex);
+
+   QMutexLocker profileLocker(&profileMutex);
+
+   UserProfile &profile = profiles[user];
+
+   bool rekeyed = profile.secret!=secret; // the connected sessions have not been authenticated by the new secret
+
+   profile.weight = qMax(1,weight);
+   profile.rate   = qMax<qint64>(0,bytesPerSecond);
+   profile.admin  = admin && !secret.isEmpty(); // an admin must be authenticated
+   profile.secret = secret;
+   profile.tokens = profile.rate;
+
+   profile.clock.start();
+
+   admin = profile.admin;
+
+   profileLocker.unlock();
+
+   for (int n=0; n<clients.size(); n++) // updates the connected sessions of user
+   {
+      if (clients.at(n).user==user)
+      {
+         clients[n].admin = admin && !rekeyed;
+
+         sendProfile(clients.at(n));
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::takeBandwidth takes up to bytes from the bandwidth cap of user (token bucket refilled at
+ *                                    the user rate, with one second of burst)
+ * @param user
+ * @param bytes
+ * @return granted bytes
+ */
+qint64 SCDMsgCenter::takeBandwidth(const QString &user, qint64 bytes)
+{
+   QMutexLocker locker(&profileMutex);
+
+   QHash<QString,UserProfile>::iterator found = profiles.find(user);
+
+   if (found==profiles.end() || found.value().rate<=0)
+   {
+      return bytes;
+   }
+
+   UserProfile &profile = found.value();
+
+   profile.tokens = qMin<double>(profile.rate, profile.tokens + profile.rate * profile.clock.restart() / 1000.0);
+
+   qint64 granted = qMin<qint64>(bytes, qint64(profile.tokens));
+
+   granted = qMax<qint64>(0,granted);
+
+   profile.tokens -= granted;
+
+   return granted;
+}
+
+/**
+ * @brief SCDMsgCenter::sendProfile sends the user profile to the client session. Center mutex must be locked.
+ * @param client
+ */
+void SCDMsgCenter::sendProfile(const Client &client)
+{
+   if (!client.handler)
+   {
+      return;
+   }
+
+   QMutexLocker locker(&profileMutex);
+
+   UserProfile profile = profiles.value(client.user);
+
+   locker.unlock();
+
+   client.handler->deliver(SCDMsgEvent::Profile,client.user,QByteArray::number(profile.weight) + " " + QByteArray::number(profile.rate));
+}
+
+/**
+ * @brief SCDMsgCenter::getClient get the connected client identified by socket descriptor
+ * @param socketDescriptor
+ * @return
+ */
+SCDMsgCenter::Client SCDMsgCenter::getClient(int socketDescriptor)
+{
+   Client client;
+
+   for (int n=0; n<clients.size();n++)
+   {
+      if (clients.at(n).socketDescriptor==socketDescriptor)
+      {
+         client = clients.at(n);
+         client.index  = n; // set client index
+         return client;
+      }
+   }
+
+   client.index      = -1; // client not found
+   client.mode       = 0;
+   client.top        = 0;
+   client.digest     = false;
+   client.format     = 0;
+   client.handler    = 0;
+   client.dispatcher = 0;
+
+   return client;
+}
+
+/**
+ * @brief SCDMsgCenter::shardOf returns the shard of sender
+ * @param sender
+ * @return
+ */
+SCDMsgCenter::Shard *SCDMsgCenter::shardOf(const QString &sender)
+{
+   return shards.at(shards.size()==1 ? 0 : qHash(sender) % shards.size());
+}
+
+/**
+ * @brief SCDMsgCenter::subscribe sets client in realtime messages receiving mode from sender, and adds it to the
+ *                                sender routing table. Center mutex must be locked.
+ * @param client
+ * @param sender
+ * @param digest receive only first occurrences of message templates and count milestones (enables pattern mining)
+ * @param resumeFrom replays the messages of sender history after this sequence number (-1: no replay)
+ */
+void SCDMsgCenter::subscribe(Client &client, QString sender, bool digest, qint64 resumeFrom)
+{
+   bool console = client.mode!=1;
+
+   removeRoute(client);
+
+   client.Sender = sender;
+   client.mode   = 1;
+   client.digest = digest;
+
+   Subscriber subscriber = subscriberOf(client);
+
+   Shard *shard = shardOf(sender);
+
+   QMutexLocker locker(&shard->mutex);
+
+   shard->routes[sender].append(subscriber);
+
+   if (digest && !shard->patterns.contains(sender))
+   {
+      shard->patterns.insert(sender,SCDMsgPatterns());
+   }
+
+   if (resumeFrom>=0) // missed messages are replayed before any new message
+   {
+      replay(shard,sender,subscriber,resumeFrom);
+   }
+
+   if (!client.token.isEmpty()) // resumable session
+   {
+      Session &session = sessions[client.token];
+
+      session.sender           = sender;
+      session.acked            = resumeFrom>=0 ? resumeFrom : shard->sequences.value(sender);
+      session.socketDescriptor = client.socketDescriptor;
+   }
+
+   const QHash<QString,QString> &states = shard->states.value(sender);
+
+   qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+   for (QHash<QString,QString>::const_iterator state = states.constBegin(); state!=states.constEnd(); ++state)
+   {
+      fanOut(shard,sender,QVector<Subscriber>() << subscriber,digest,SCDMsgEvent::Keyed,state.value(),state.key().toUtf8(),0,1,Info,now); // current values
+   }
+
+   locker.unlock();
+
+   if (console && client.handler) // switch socket profile
+   {
+      client.handler->deliver(SCDMsgEvent::Mode,QString(),"1");
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::unsubscribe sets client in console mode, and removes it from routing table of spied sender.
+ *                                  Center mutex must be locked.
+ * @param client
+ */
+void SCDMsgCenter::unsubscribe(Client &client)
+{
+   if (client.mode==1)
+   {
+      removeRoute(client);
+
+      if (client.handler) // switch socket profile
+      {
+         client.handler->deliver(SCDMsgEvent::Mode,QString(),"0");
+      }
+   }
+
+   client.mode = 0;
+}
+
+/**
+ * @brief SCDMsgCenter::subscriberOf
+ * @param client
+ * @return the entry of client into the routing table of the spied sender
+ */
+SCDMsgCenter::Subscriber SCDMsgCenter::subscriberOf(const Client &client)
+{
+   Subscriber subscriber;
+
+   subscriber.socketDescriptor = client.socketDescriptor;
+   subscriber.handler          = client.handler;
+   subscriber.dispatcher       = client.dispatcher;
+   subscriber.digest           = client.digest;
+   subscriber.format           = client.format;
+
+   return subscriber;
+}
+
+/**
+ * @brief SCDMsgCenter::removeRoute removes client from the routing table of the spied sender
+ * @param client
+ * @return sequence number of the last message routed to client (0: client not in spy mode)
+ */
+qint64 SCDMsgCenter::removeRoute(const Client &client)
+{
+   if (client.mode!=1)
+   {
+      return 0;
+   }
+
+   Shard *shard = shardOf(client.Sender);
+
+   QMutexLocker locker(&shard->mutex);
+
+   QHash<QString, QVector<Subscriber> >::iterator route = shard->routes.find(client.Sender);
+
+   if (route!=shard->routes.end())
+   {
+      QVector<Subscriber> &subscribers = route.value();
+
+      for (int n=0; n<subscribers.size(); n++)
+      {
+         if (subscribers.at(n).socketDescriptor==client.socketDescriptor)
+         {
+            subscribers.remove(n);
+            break;
+         }
+      }
+
+      if (subscribers.isEmpty())
+      {
+         shard->routes.erase(route);
+      }
+   }
+
+   return shard->sequences.value(client.Sender);
+}
+
+/**
+ * @brief SCDMsgCenter::compileFormat returns the compiled output format of spec, compiling it on first use. The
+ *                                    formats are shared by the clients with the same spec: each call takes a
+ *                                    reference, released by releaseFormat. Center mutex must be locked.
+ * @param spec
+ * @param error receives the error
+ * @return the format, 0 if spec is not valid
+ */
+const SCDMsgFormat *SCDMsgCenter::compileFormat(QString spec, QString *error)
+{
+   SCDMsgFormat *format = SCDMsgFormat::compile(spec,error);
+
+   if (!format)
+   {
+      return 0;
+   }
+
+   QHash<QString,SCDMsgFormat*>::const_iterator found = formats.constFind(format->spec()); // spec normalized by compile
+
+   if (found!=formats.constEnd())
+   {
+      delete format;
+
+      formatUsers[found.value()]++;
+
+      return found.value();
+   }
+
+   formats.insert(format->spec(),format);
+   formatUsers.insert(format,1);
+
+   return format;
+}
+
+/**
+ * @brief SCDMsgCenter::releaseFormat releases a reference taken by compileFormat: the format is deleted when no
+ *                                    client uses it. The client must have already left the routing tables (or its
+ *                                    entry must point to its new format). Center mutex must be locked.
+ * @param format (0: console, nothing to release)
+ */
+void SCDMsgCenter::releaseFormat(const SCDMsgFormat *format)
+{
+   QHash<const SCDMsgFormat*,int>::iterator users = formatUsers.find(format);
+
+   if (!format || users==formatUsers.end() || --users.value()>0)
+   {
+      return;
+   }
+
+   formatUsers.erase(users);
+
+   delete formats.take(format->spec());
+}
+
+/**
+ * @brief SCDMsgCenter::updateRoute applies the output format and the I/O thread dispatcher of a client to its entry
+ *                                  into the routing table of the spied sender: the next message follows the new
+ *                                  settings. Center mutex must be locked.
+ * @param client
+ */
+void SCDMsgCenter::updateRoute(const Client &client)
+{
+   if (client.mode!=1)
+   {
+      return;
+   }
+
+   Shard *shard = shardOf(client.Sender);
+
+   QMutexLocker locker(&shard->mutex);
+
+   QHash<QString, QVector<Subscriber> >::iterator route = shard->routes.find(client.Sender);
+
+   if (route!=shard->routes.end())
+   {
+      QVector<Subscriber> &subscribers = route.value();
+
+      for (int n=0; n<subscribers.size(); n++)
+      {
+         if (subscribers.at(n).socketDescriptor==client.socketDescriptor)
+         {
+            subscribers[n].format     = client.format;
+            subscribers[n].dispatcher = client.dispatcher;
+            break;
+         }
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::getSenderList get list of sender
+ * @return
+ */
+QStringList SCDMsgCenter::getSenderList()
+{
+   return senders;
+}
+
+/**
+ * @brief SCDMsgCenter::registerCommands registers the built-in console commands
+ */
+void SCDMsgCenter::registerCommands()
+{
+   commands.add("list",     "",                  "get a list of message senders",ListCommand);
+   commands.add("spy",      "<sender id>",       "receive message only by sender identified by sender id",SpyCommand);
+   commands.add("help",     "",                  "show this help",HelpCommand);
+   commands.add("exit",     "",                  "close connection to message center",ExitCommand);
+   commands.add("user",     "[<name>] [<secret>]","select the user profile of this connection",UserCommand);
+   commands.add("get",      "[<file>]",          "download a file published by application (without file: list of files)",GetCommand);
+   commands.add("top",      "[<N:int>]",         "live view of the N senders with highest message rate (<cr> to stop)",TopCommand);
+   commands.add("patterns", "<sender id>",       "message templates of sender with their counts",PatternsCommand);
+   commands.add("digest",   "<sender id>",       "spy sender receiving only new message templates and their counts",DigestCommand);
+   commands.add("rules",    "",                  "list of alert rules (alerts are posted to sender 'alerts')",RulesCommand);
+   commands.add("rule",     "<name> <sender> <level:int> <count:int> <seconds:int> [<text:text>]","add alert rule (sender can contain '*', admin)",RuleCommand,SCDMsgCommandHandler(),true);
+   commands.add("unrule",   "<name>",            "remove alert rule (admin)",UnruleCommand,SCDMsgCommandHandler(),true);
+   commands.add("conflate", "<on|off:switch>",   "receive only the last value of pending state messages (default on)",ConflateCommand);
+   commands.add("framing",  "<prefix|line>",     "messages preceded by LF (default) or terminated by LF (complete as soon as LF arrives)",FramingCommand);
+   commands.add("format",   "<console|jsonl|template:text>","output format: raw messages (default), a JSON object or a template line for each message (%T %S %L %N %M %C %R)",FormatCommand);
+   commands.add("session",  "",                  "open a resumable session: messages are preceded by their sequence number",SessionCommand);
+   commands.add("ack",      "<seq:long>",        "acknowledge the messages received up to sequence number",AckCommand);
+   commands.add("resume",   "<token> [<seq:long>]","resume a session after a reconnection (from last acknowledged sequence)",ResumeCommand);
+   commands.add("ping",     "",                  "message center reply pong",PingCommand);
+}
+
+/**
+ * @brief SCDMsgCenter::getHelpString return the menu string, generated from the commands registry
+ * @return
+ */
+QString SCDMsgCenter::getHelpString()
+{
+   return " Command Help:\n\n"
+          + commands.help()
+          + SCDMsgCommands::helpLine("<cr> (carriage return)","stop realtime message receiving and show help")
+          + SCDMsgCommands::helpLine("@<sender id> <command>","sends a string to sender by message center")
+          + SCDMsgCommands::helpLine("@<sender id> help","list of commands accepted by sender")
+          + SCDMsgCommands::helpLine("<unkown command>","return echo of command");
+}
+
+/**
+ * @brief SCDMsgCenter::getSenderHelp return the commands accepted by sender
+ * @param sender
+ * @return
+ */
+QString SCDMsgCenter::getSenderHelp(QString sender)
+{
+   QHash<QString,SCDMsgCommands>::const_iterator registry = senderCommands.constFind(sender);
+
+   if (registry==senderCommands.constEnd() || registry.value().isEmpty())
+   {
+      return "\nNo commands registered by sender " + sender + "\n";
+   }
+
+   return "\n " + sender + " commands:\n\n" + registry.value().help();
+}
+
+/**
+ * @brief SCDMsgCenter::getPrompt return the console prompt
+ * @param socketDescriptor
+ * @return a null string if client not found or menu prompt
+ */
+QString SCDMsgCenter::getPrompt(int socketDescriptor)
+{
+   Client client = getClient(socketDescriptor);
+
+   if (client.index > -1)
+   {
+      return "\n" + client.name + ":> ";
+   }
+
+   return "";
+}
+
+/**
+ * @brief SCDMsgCenter::sendMessageToClient send message to destination socket thread must process this message (signal).
+ * @param msg
+ * @param socketDescriptor
+ */
+void SCDMsgCenter::sendMessageToClient(QString msg, int clientSocketDescriptor)
+{
+   Client client = getClient(clientSocketDescriptor);
+
+   if (client.index > -1)
+   {
+      sendMessageToClient(msg,client);
+   }
+   else
+   {
+      emit messageToClient_signal(msg, clientSocketDescriptor); // serialize the messages to clients
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::sendMessageToClient posts the message directly to client session, or emits it if the client
+ *                                          has not a session handler
+ * @param msg
+ * @param client
+ */
+void SCDMsgCenter::sendMessageToClient(const QString &msg, const Client &client)
+{
+   if (client.handler)
+   {
+      client.handler->deliver(msg);
+   }
+   else
+   {
+      emit messageToClient_signal(msg, client.socketDescriptor);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::message_slot receives and process a message from sender.
+ *                                sends message to destination client which asked to receive it
+ * @param message message
+ * @param sender  from sender
+ */
+void SCDMsgCenter::processMessage(QString msg, QString sender)
+{
+   dispatch(sender,SCDMsgEvent::Text,msg,QByteArray());
+}
+
+/**
+ * @brief SCDMsgCenter::dispatch routes a text message or a binary payload to the clients which spy the sender
+ * @param sender
+ * @param kind SCDMsgEvent::Text, SCDMsgEvent::Keyed or SCDMsgEvent::Data
+ * @param msg text message, or sender id of binary payload
+ * @param data binary payload, or key of state message
+ * @param count number of messages (batch of postMessages)
+ * @param level message level
+ */
+void SCDMsgCenter::dispatch(const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level)
+{
+   Shard *shard = shardOf(sender);
+
+   QMutexLocker locker(&shard->mutex);
+
+   shard->top.add(sender,kind==SCDMsgEvent::Data ? data.size() : msg.size(),count);
+
+   QStringList alerts;
+
+   if (kind!=SCDMsgEvent::Data && !shard->rules.isEmpty() && sender!=AlertSender)
+   {
+      shard->rules.evaluate(sender,level,msg,count,shard->clock.elapsed(),&alerts);
+   }
+
+   qint64 time = QDateTime::currentMSecsSinceEpoch(); // post time, written by the output formats
+
+   QHash<QString, SenderQueue>::const_iterator queue = shard->queues.constFind(sender);
+
+   bool queued = queue!=shard->queues.constEnd() && queue.value().active; // older messages of sender still queued
+
+   if (shard->routes.contains(sender) || shard->patterns.contains(sender) || kind==SCDMsgEvent::Keyed || queued)
+   {
+      if (shard->dispatcher)
+      {
+         enqueue(shard,sender,kind,msg,data,count,level,time);
+      }
+      else
+      {
+         route(shard,sender,kind,msg,data,count,level,time);
+      }
+   }
+   else
+   if (kind!=SCDMsgEvent::Data) // nobody spies the sender: message is only kept into history
+   {
+      remember(shard,sender,kind,msg,data,count,level,time);
+   }
+
+   locker.unlock();
+
+   for (int n=0; n<alerts.size(); n++) // 'alerts' sender can belong to the same shard
+   {
+      postMessage(alerts.at(n),AlertSender,Error);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::enqueue appends a message to the sender queue of dispatch stage. Shard must be locked.
+ * @param shard
+ * @param sender
+ * @param kind
+ * @param msg
+ * @param data
+ * @param count
+ * @param level
+ * @param time post time
+ */
+void SCDMsgCenter::enqueue(Shard *shard, const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level, qint64 time)
+{
+   SenderQueue &queue = shard->queues[sender];
+
+   Pending pending;
+
+   pending.kind = kind;
+   pending.msg  = msg;
+   pending.data = data;
+   pending.cost  = kind==SCDMsgEvent::Data ? data.size() : msg.size();
+   pending.count = count;
+   pending.level = level;
+   pending.time  = time;
+   pending.dropped = 0;
+
+   if (queue.bytes>0 && queue.bytes + pending.cost > MaxQueueBytes) // flooding sender: drops its own messages only
+   {
+      if (queue.pending.last().dropped==0) // the notice takes the place of the dropped messages into the queue
+      {
+         Pending notice;
+
+         notice.kind    = SCDMsgEvent::Text;
+         notice.cost    = 0;
+         notice.count   = 1;
+         notice.level   = Warning;
+         notice.time    = time;
+         notice.dropped = 0;
+
+         queue.pending.enqueue(notice);
+      }
+
+      queue.pending.last().dropped += count;
+
+      return;
+   }
+
+   queue.pending.enqueue(pending);
+
+   queue.bytes += pending.cost;
+
+   if (!queue.active)
+   {
+      queue.active = true;
+
+      shard->active.enqueue(sender);
+
+      shard->wake.wakeOne();
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::serveShard dispatcher thread loop: services the active senders of shard by deficit round robin.
+ *                                 On each round a sender receives quantum*weight bytes of credit and routes its
+ *                                 messages while the credit is enough.
+ * @param shard
+ */
+void SCDMsgCenter::serveShard(Shard *shard)
+{
+   QMutexLocker locker(&shard->mutex);
+
+   while (true)
+   {
+      while (shard->running && shard->active.isEmpty())
+      {
+         shard->wake.wait(&shard->mutex);
+      }
+
+      if (!shard->running)
+      {
+         break;
+      }
+
+      QString sender = shard->active.dequeue();
+
+      SenderQueue &queue = shard->queues[sender];
+
+      queue.deficit += qint64(Quantum) * queue.weight;
+
+      while (!queue.pending.isEmpty() && queue.pending.head().cost <= queue.deficit)
+      {
+         Pending pending = queue.pending.dequeue();
+
+         queue.deficit -= pending.cost;
+         queue.bytes   -= pending.cost;
+
+         if (pending.dropped>0)
+         {
+            pending.msg = "\n" + sender + ": *** " + QString::number(pending.dropped) + " messages dropped ***";
+         }
+
+         route(shard,sender,pending.kind,pending.msg,pending.data,pending.count,pending.level,pending.time);
+      }
+
+      if (queue.pending.isEmpty())
+      {
+         queue.deficit = 0;
+         queue.active  = false;
+      }
+      else
+      {
+         shard->active.enqueue(sender); // next round
+      }
+
+      locker.unlock(); // lets the posting threads enqueue between two senders
+      locker.relock();
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::refreshTop renders a frame of top senders view to the clients into top mode, and restarts the
+ *                                 counting interval. Runs into message center thread, stops the timer when nobody
+ *                                 is watching.
+ */
+void SCDMsgCenter::refreshTop()
+{
+   QMutexLocker locker(&mutex);
+
+   QVector<int> viewers;
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      if (clients.at(n).mode==2)
+      {
+         viewers.append(n);
+      }
+   }
+
+   if (viewers.isEmpty())
+   {
+      topTimer->stop();
+      return;
+   }
+
+   qint64 elapsed = qMax(Q_INT64_C(1),topClock.restart());
+
+   QVector<SCDMsgTopSenders::Entry> entries;
+
+   for (int n=0; n<shards.size(); n++) // senders are partitioned: the shard sketches are simply concatenated
+   {
+      Shard *shard = shards.at(n);
+
+      QMutexLocker shardLocker(&shard->mutex);
+
+      entries += shard->top.entries();
+
+      shard->top.clear();
+   }
+
+   SCDMsgTopSenders::sort(entries);
+
+   for (int n=0; n<viewers.size(); n++)
+   {
+      const Client &client = clients.at(viewers.at(n));
+
+      sendMessageToClient(renderTop(entries,client.top,elapsed),client);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::renderTop renders a frame of top senders view
+ * @param entries senders sorted by message count
+ * @param rows max number of senders
+ * @param elapsed counting interval (milliseconds)
+ * @return
+ */
+QString SCDMsgCenter::renderTop(const QVector<SCDMsgTopSenders::Entry> &entries, int rows, qint64 elapsed)
+{
+   QString frame = "\033[2J\033[H"; // clear terminal
+
+   frame += " Top senders (" + QString::number(elapsed) + " ms) - <cr> to stop\n\n";
+
+   frame += QString("   %1 %2 %3 %4\n").arg("sender",-24).arg("msg/s",10).arg("bytes/s",12).arg("+/-",8);
+
+   for (int n=0; n<entries.size() && n<rows; n++)
+   {
+      const SCDMsgTopSenders::Entry &entry = entries.at(n);
+
+      frame += QString("   %1 %2 %3 %4\n").arg(entry.sender.left(24),-24)
+                                         .arg(entry.count*1000/elapsed,10)
+                                         .arg(entry.bytes*1000/elapsed,12)
+                                         .arg(entry.error*1000/elapsed,8);
+   }
+
+   return frame;
+}
+
+/**
+ * @brief SCDMsgCenter::route sends a message to the clients which spy the sender, after clustering it if the sender
+ *                            has pattern mining enabled. Shard must be locked.
+ * @param shard
+ * @param sender
+ * @param kind
+ * @param msg
+ * @param data
+ * @param count
+ * @param level
+ * @param time post time
+ */
+void SCDMsgCenter::route(Shard *shard, const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level, qint64 time)
+{
+   qint64 seq = kind==SCDMsgEvent::Data ? 0 : remember(shard,sender,kind,msg,data,count,level,time);
+
+   QString digest;
+
+   if (kind==SCDMsgEvent::Keyed) // last value cache
+   {
+      shard->states[sender].insert(QString::fromUtf8(data),msg);
+   }
+
+   QHash<QString, SCDMsgPatterns>::iterator miner = shard->patterns.find(sender);
+
+   if (kind==SCDMsgEvent::Text && miner!=shard->patterns.end())
+   {
+      digest = minePatterns(miner.value(),sender,msg);
+   }
+
+   QHash<QString, QVector<Subscriber> >::const_iterator found = shard->routes.constFind(sender);
+
+   if (found==shard->routes.constEnd()) // subscribers gone while the message was queued, or sender only mined
+   {
+      return;
+   }
+
+   fanOut(shard,sender,found.value(),false,kind,msg,data,seq,count,level,time);
+
+   if (kind==SCDMsgEvent::Keyed) // state messages are not clustered: digest subscribers receive them too
+   {
+      fanOut(shard,sender,found.value(),true,kind,msg,data,seq,count,level,time);
+   }
+   else
+   if (!digest.isEmpty())
+   {
+      fanOut(shard,sender,found.value(),true,SCDMsgEvent::Text,digest,QByteArray(),0,digest.count(LF),Info,time);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::fanOut sends a message to the subscribers of a sender in normal or digest mode. The message is
+ *                             encoded once for each output format of the subscribers, and the encoded bytes are
+ *                             shared by all the subscribers with the same format. Shard must be locked.
+ * @param shard
+ * @param sender
+ * @param subscribers
+ * @param digest
+ * @param kind
+ * @param msg
+ * @param data
+ * @param seq sequence number of (last) message (0: none)
+ * @param count number of messages (batch)
+ * @param level
+ * @param time post time
+ */
+void SCDMsgCenter::fanOut(Shard *shard, const QString &sender, const QVector<Subscriber> &subscribers, bool digest, int kind,
+                          const QString &msg, const QByteArray &data, qint64 seq, int count, int level, qint64 time)
+{
+   QVector<Fanout> fanout; // subscribers grouped by shared I/O thread and output format
+
+   QVector<const SCDMsgFormat*> encoders; // formats of the subscribers, each one encoded once
+   QVector<QByteArray> encoded;
+
+   QByteArray slot = kind==SCDMsgEvent::Keyed ? sender.toUtf8() + '\0' + data : data; // a session conflates the state messages by sender and key
+
+   for (int n=0; n<subscribers.size();n++)
+   {
+      const Subscriber &client = subscribers.at(n);
+
+      if (client.digest!=digest)
+      {
+         continue;
+      }
+
+      QByteArray bytes; // message encoded by client format (empty: console)
+
+      if (client.format && kind==SCDMsgEvent::Data) // a binary payload is not a record of the format: not sent
+      {
+         continue;
+      }
+
+      if (client.format && kind==SCDMsgEvent::Gap)
+      {
+         QList<QByteArray> gap = data.split(' ');
+
+         bytes = client.format->encodeGap(sender,gap.value(0).toLongLong(),gap.value(1).toLongLong());
+      }
+      else
+      if (client.format)
+      {
+         int e = encoders.indexOf(client.format);
+
+         if (e<0)
+         {
+            e = encoders.size();
+
+            encoders.append(client.format);
+            encoded.append(client.format->encode(sender,msg,count,seq,level,time,&shard->formats));
+         }
+
+         bytes = encoded.at(e);
+      }
+
+      if (!client.dispatcher) // client owns its thread
+      {
+         if (client.handler)
+         {
+            client.handler->deliver(kind,msg,slot,seq,bytes);
+         }
+         else
+         if (kind!=SCDMsgEvent::Data)
+         {
+            emit messageToClient_signal(bytes.isEmpty() ? msg : QString::fromUtf8(bytes), client.socketDescriptor);
+         }
+
+         continue;
+      }
+
+      int f = 0;
+
+      while (f<fanout.size() && (fanout.at(f).dispatcher!=client.dispatcher || fanout.at(f).format!=client.format))
+      {
+         f++;
+      }
+
+      if (f==fanout.size())
+      {
+         Fanout batch;
+
+         batch.dispatcher = client.dispatcher;
+         batch.format     = client.format;
+         batch.encoded    = bytes;
+
+         fanout.append(batch);
+      }
+
+      fanout[f].sessions.append(client.handler);
+   }
+
+   for (int f=0; f<fanout.size(); f++) // one event for each I/O thread: the threads write to their sessions in parallel
+   {
+      const Fanout &batch = fanout.at(f);
+
+      if (batch.sessions.size()==1)
+      {
+         batch.sessions.at(0)->deliver(kind,msg,slot,seq,batch.encoded);
+      }
+      else
+      {
+         SCDMsgBatchEvent *event = new SCDMsgBatchEvent(msg,kind,slot,seq,batch.encoded);
+
+         event->sessions = batch.sessions;
+
+         QCoreApplication::postEvent(batch.dispatcher,event);
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::remember assigns the next sequence numbers of sender to a message (or a batch), and keeps it
+ *                               into sender history. Shard must be locked.
+ * @param shard
+ * @param sender
+ * @param kind
+ * @param msg
+ * @param data
+ * @param count number of messages
+ * @param level
+ * @param time post time
+ * @return sequence number of the (last) message
+ */
+qint64 SCDMsgCenter::remember(Shard *shard, const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level, qint64 time)
+{
+   qint64 &last = shard->sequences[sender];
+
+   Record record;
+
+   record.first = last + 1;
+   record.last  = last + count;
+   record.kind  = kind;
+   record.msg   = msg;
+   record.data  = data;
+   record.level = level;
+   record.time  = time;
+
+   last = record.last;
+
+   if (HistorySize>0)
+   {
+      History &history = shard->history[sender];
+
+      if (history.ring.size()<HistorySize)
+      {
+         history.ring.append(record);
+      }
+      else
+      {
+         history.ring[history.next] = record; // evicts the oldest record
+
+         history.next = (history.next + 1) % history.ring.size();
+      }
+   }
+
+   return last;
+}
+
+/**
+ * @brief SCDMsgCenter::replay sends to a resumed subscriber the messages of sender history after a sequence number,
+ *                             preceded by a gap marker if some of them have already been evicted. Shard must be locked.
+ * @param shard
+ * @param sender
+ * @param subscriber
+ * @param from last sequence number received by subscriber
+ */
+void SCDMsgCenter::replay(Shard *shard, const QString &sender, const Subscriber &subscriber, qint64 from)
+{
+   QVector<Subscriber> target;
+
+   target.append(subscriber);
+
+   qint64 last = shard->sequences.value(sender);
+
+   const History &history = shard->history[sender];
+
+   int size = history.ring.size();
+
+   qint64 oldest = size>0 ? history.ring.at(history.next).first : last + 1;
+
+   if (from<last && from + 1 < oldest) // evicted (or never kept) messages
+   {
+      QByteArray gap = QByteArray::number(from + 1) + " " + QByteArray::number(qMin(oldest - 1, last));
+
+      fanOut(shard,sender,target,subscriber.digest,SCDMsgEvent::Gap,LF + "#gap " + QString::fromLatin1(gap) + " " + sender,gap,0,1,
+             Warning,QDateTime::currentMSecsSinceEpoch()); // control line: a sender can not forge it
+   }
+
+   for (int n=0; n<size; n++)
+   {
+      const Record &record = history.ring.at((history.next + n) % size);
+
+      if (record.last>from)
+      {
+         fanOut(shard,sender,target,subscriber.digest,record.kind,record.msg,record.data,record.last,
+                int(record.last - record.first + 1),record.level,record.time);
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::newSession opens a resumable session for client: from now on the client receives the sequence
+ *                                 numbers of the messages. Center mutex must be locked.
+ * @param client
+ * @return session token (empty if no random token can be generated)
+ */
+QString SCDMsgCenter::newSession(Client &client)
+{
+   QHash<QString,Session>::iterator session = sessions.begin();
+
+   while (session!=sessions.end()) // discards expired sessions of disconnected clients
+   {
+      if (session.value().socketDescriptor<0 && session.value().detached.hasExpired(SessionTimeout))
+      {
+         session = sessions.erase(session);
+      }
+      else
+      {
+         ++session;
+      }
+   }
+
+   QString token = randomToken(); // the token is the only credential of the session
+
+   if (token.isEmpty() || sessions.contains(token))
+   {
+      return QString();
+   }
+
+   client.token = token;
+
+   Session &created = sessions[client.token];
+
+   created.socketDescriptor = client.socketDescriptor;
+
+   if (client.handler)
+   {
+      client.handler->deliver(SCDMsgEvent::Sequence,QString(),"1");
+   }
+
+   return client.token;
+}
+
+/**
+ * @brief SCDMsgCenter::detachSession unbinds a session from its client: the session can be resumed until it expires.
+ *                                    Center mutex must be locked.
+ * @param token
+ * @param socketDescriptor client which leaves the session (nothing is done if the session is bound to another one)
+ */
+void SCDMsgCenter::detachSession(const QString &token, int socketDescriptor)
+{
+   QHash<QString,Session>::iterator session = sessions.find(token);
+
+   if (session!=sessions.end() && session.value().socketDescriptor==socketDescriptor)
+   {
+      session.value().socketDescriptor = -1;
+      session.value().detached.start();
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::randomToken
+ * @return 128 random bits from the system CSPRNG, hex encoded (empty on error)
+ */
+QString SCDMsgCenter::randomToken()
+{
+   QFile random("/dev/urandom");
+
+   if (!random.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+   {
+      return QString();
+   }
+
+   QByteArray bytes = random.read(16);
+
+   return bytes.size()==16 ? QString::fromLatin1(bytes.toHex()) : QString();
+}
+
+/**
+ * @brief SCDMsgCenter::minePatterns clusters the lines of a text message (or of a batch) into the sender templates.
+ *                                   Shard must be locked.
+ * @param patterns sender templates
+ * @param sender
+ * @param msg
+ * @return the digest of message: the lines which opened a new template, and the templates which reached a power of ten
+ */
+QString SCDMsgCenter::minePatterns(SCDMsgPatterns &patterns, const QString &sender, const QString &msg)
+{
+   QString digest;
+
+   QString prefix = sender + ": ";
+
+   QStringList lines = msg.split(LF,QString::SkipEmptyParts);
+
+   for (int n=0; n<lines.size(); n++)
+   {
+      QString line = lines.at(n);
+
+      if (line.startsWith(prefix))
+      {
+         line.remove(0,prefix.size());
+      }
+
+      int id;
+
+      SCDMsgPatterns::Event event = patterns.add(line,&id);
+
+      if (event==SCDMsgPatterns::New)
+      {
+         digest += LF + prefix + "[#" + QString::number(id) + "] " + line;
+      }
+      else
+      if (event==SCDMsgPatterns::Milestone)
+      {
+         digest += LF + prefix + "[#" + QString::number(id) + " x" + QString::number(patterns.count(id)) + "] " + patterns.text(id);
+      }
+   }
+
+   return digest;
+}
+
+/**
+ * @brief SCDMsgCenter::getPatterns returns the template counts of a sender, and enables mining if it was not enabled
+ * @param sender
+ * @return
+ */
+QString SCDMsgCenter::getPatterns(QString sender)
+{
+   Shard *shard = shardOf(sender);
+
+   QMutexLocker locker(&shard->mutex);
+
+   QHash<QString, SCDMsgPatterns>::const_iterator found = shard->patterns.constFind(sender);
+
+   if (found==shard->patterns.constEnd())
+   {
+      shard->patterns.insert(sender,SCDMsgPatterns());
+
+      return "\nPattern mining started for " + sender + "\n";
+   }
+
+   QVector<SCDMsgPatterns::Template> templates = found.value().templates();
+
+   qint64 messages = found.value().messages();
+   qint64 overflow = found.value().overflow();
+
+   locker.unlock();
+
+   QString msg = "\n " + QString::number(messages) + " messages, " + QString::number(templates.size()) + " templates\n\n";
+
+   for (int n=0; n<templates.size() && n<100; n++)
+   {
+      const SCDMsgPatterns::Template &pattern = templates.at(n);
+
+      msg += QString("   %1 %2 ").arg(pattern.count,10).arg("#" + QString::number(pattern.id),-6) + pattern.text() + "\n";
+   }
+
+   if (overflow>0)
+   {
+      msg += QString("   %1 ").arg(overflow,10) + "(not clustered: too many templates)\n";
+   }
+
+   return msg;
+}
+
+/**
+ * @brief SCDMsgCenter::removeClient_slot
+ * @param socket
+ */
+void SCDMsgCenter::unregisterClient(int socketDescriptor)
+{
+   Client client = getClient(socketDescriptor);
+
+   if (client.index > -1)
+   {
+      unsubscribe(client);
+
+      detachSession(client.token,socketDescriptor); // can be resumed
+
+      releaseFormat(client.format);
+
+      clients.removeAt(client.index);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::removeSender_slot
+ * @param sender
+ */
+void SCDMsgCenter::unregisterMessageSender(QString sender)
+{
+   senders.removeOne(sender);
+
+   senderCommands.remove(sender);
+}
+
+/**
+ * @brief SCDMsgCenter::addClient_slot
+ * @param socket
+ */
+void SCDMsgCenter::registerClient(int socketDescriptor, SCDMsgThreadHandler *handler)
+{
+   Client client = getClient(socketDescriptor);
+
+   if (client.index==-1) // client not exixst
+   {
+      client.socketDescriptor = socketDescriptor;
+
+      client.handler    = handler;
+      client.dispatcher = handler ? handler->dispatcher() : 0;
+
+      client.name   = "Host-" + QString::number(socketDescriptor);
+      client.user   = "Anonymous";
+      client.admin  = 0;
+      client.mode   = 0; // console
+      client.top    = 0;
+      client.digest = false;
+      client.lines  = false;
+      client.format = 0;
+
+      Adopted taken;
+
+      bool restored = adopted.contains(socketDescriptor); // connection taken over from the outgoing process
+
+      if (restored)
+      {
+         taken = adopted.take(socketDescriptor);
+
+         client.name   = taken.client.name;
+         client.user   = taken.client.user;
+         client.token  = taken.client.token;
+         client.lines  = taken.client.lines;
+         client.format = taken.client.format;
+      }
+
+      QMutexLocker locker(&profileMutex);
+
+      bool profiled = profiles.contains(client.user);
+
+      client.admin = profiled && profiles[client.user].admin;
+
+      locker.unlock();
+
+      clients.append(client);
+
+      if (profiled)
+      {
+         sendProfile(client);
+      }
+
+      if (restored) // the client continues where the outgoing process stopped
+      {
+         client.index = clients.size() - 1;
+
+         if (!client.token.isEmpty() && handler)
+         {
+            handler->deliver(SCDMsgEvent::Sequence,QString(),"1");
+         }
+
+         if (client.lines && handler)
+         {
+            handler->deliver(SCDMsgEvent::Framing,QString(),"1");
+         }
+
+         if (taken.client.mode==1)
+         {
+            subscribe(client,taken.client.Sender,taken.client.digest,taken.resumeFrom);
+
+            clients.replace(client.index,client);
+         }
+
+         return;
+      }
+
+      QString msg = "\n\nMessage Center 1.0\n\n" + getHelpString() + getPrompt(socketDescriptor);
+
+      sendMessageToClient(msg, socketDescriptor);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::addSender_slot insert the sendet into registered sender list. if already inserted do nothing.
+ * @param sender
+ */
+void SCDMsgCenter::registerMessageSender(QString sender)
+{
+   if (!senders.contains(sender))
+   {
+      senders.append(sender);
+   }
+}
+
+/**
+ * @brief SCDMsgCenter::handOff passes the client connections and the message center state to the successor process.
+ *                              The sessions are quiesced first: the clients leave the routing tables, and each
+ *                              session writes all the messages already routed to it, so the successor resumes each
+ *                              client from what actually reached its socket and the two processes never write to the
+ *                              same connection. The sessions which do not drain within drainTimeout are not handed
+ *                              off: they are closed after their output, and their clients resume the session on the
+ *                              successor. On success the handed off sessions close the sockets without
+ *                              disconnecting (the successor owns a copy).
+ * @param channel unix socket connected to successor
+ * @param listener listening socket of message server
+ * @param drainTimeout ms granted to the sessions to write their output
+ * @return false if the successor has not received the state (the clients are routed again)
+ */
+bool SCDMsgCenter::handOff(int channel, int listener, int drainTimeout)
+{
+   QMutexLocker locker(&mutex);
+
+   QHash<int,qint64> cuts; // client => sequence number of last message routed to it
+
+   drainMutex.lock();
+   drained.clear();
+   drainMutex.unlock();
+
+   int draining = 0;
+
+   handingOff = true;
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      const Client &client = clients.at(n);
+
+      cuts.insert(client.socketDescriptor,removeRoute(client)); // nothing more is routed to client
+
+      if (client.handler) // the session reports when its output has been written (after the messages already routed)
+      {
+         client.handler->deliver(SCDMsgEvent::Drain,QString(),QByteArray());
+
+         draining++;
+      }
+   }
+
+   locker.unlock(); // the sessions which disconnect meanwhile can be removed
+
+   QElapsedTimer clock;
+
+   clock.start();
+
+   drainMutex.lock();
+
+   while (drained.size()<draining && clock.elapsed()<drainTimeout)
+   {
+      drainWake.wait(&drainMutex,qMax<qint64>(1,drainTimeout - clock.elapsed()));
+   }
+
+   QSet<int> ready = drained;
+
+   drainMutex.unlock();
+
+   locker.relock();
+
+   QVector<int> handed; // indexes of the clients handed off
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      if (ready.contains(clients.at(n).socketDescriptor) && cuts.contains(clients.at(n).socketDescriptor))
+      {
+         handed.append(n);
+      }
+   }
+
+   QVector<int> fds;
+
+   fds.append(listener);
+
+   QByteArray state;
+
+   QDataStream out(&state,QIODevice::WriteOnly);
+
+   out << HandoffVersion;
+
+   out << qint32(handed.size());
+
+   for (int h=0; h<handed.size(); h++)
+   {
+      const Client &client = clients.at(handed.at(h));
+
+      qint64 last = cuts.value(client.socketDescriptor);
+
+      fds.append(client.socketDescriptor);
+
+      out << client.name << client.user << client.token << qint32(client.mode==1 ? 1 : 0) << client.Sender << client.digest << client.lines
+          << (client.format ? client.format->spec() : QString()) << last;
+   }
+
+   out << qint32(sessions.size());
+
+   for (QHash<QString,Session>::const_iterator session = sessions.constBegin(); session!=sessions.constEnd(); ++session)
+   {
+      qint32 index = -1; // index of handed off client bound to session
+
+      for (int h=0; h<handed.size() && session.value().socketDescriptor>=0; h++)
+      {
+         if (clients.at(handed.at(h)).socketDescriptor==session.value().socketDescriptor)
+         {
+            index = h;
+         }
+      }
+
+      out << session.key() << session.value().sender << session.value().acked << index;
+   }
+
+   QVector<SCDMsgRule> list = rules();
+
+   out << qint32(list.size());
+
+   for (int n=0; n<list.size(); n++)
+   {
+      const SCDMsgRule &rule = list.at(n);
+
+      out << rule.name << rule.sender << qint32(rule.level) << rule.text << qint32(rule.count) << qint32(rule.seconds);
+   }
+
+   out << qint32(shards.size());
+
+   for (int n=0; n<shards.size(); n++)
+   {
+      Shard *shard = shards.at(n);
+
+      QMutexLocker shardLocker(&shard->mutex);
+
+      out << qint32(shard->sequences.size());
+
+      for (QHash<QString,qint64>::const_iterator seq = shard->sequences.constBegin(); seq!=shard->sequences.constEnd(); ++seq)
+      {
+         const History &history = shard->history.value(seq.key());
+
+         out << seq.key() << seq.value() << qint32(history.ring.size());
+
+         for (int r=0; r<history.ring.size(); r++) // oldest first
+         {
+            const Record &record = history.ring.at((history.next + r) % history.ring.size());
+
+            out << record.first << record.last << qint32(record.kind) << record.msg << record.data << qint32(record.level) << record.time;
+         }
+      }
+
+      out << qint32(shard->states.size());
+
+      for (QHash<QString, QHash<QString,QString> >::const_iterator sender = shard->states.constBegin(); sender!=shard->states.constEnd(); ++sender)
+      {
+         out << sender.key() << qint32(sender.value().size());
+
+         for (QHash<QString,QString>::const_iterator state = sender.value().constBegin(); state!=sender.value().constEnd(); ++state)
+         {
+            out << state.key() << state.value();
+         }
+      }
+   }
+
+   if (!SCDMsgHandoff::send(channel,fds,state)) // the clients are routed again, from where they stopped
+   {
+      handingOff = false;
+
+      for (int n=0; n<clients.size(); n++)
+      {
+         const Client &client = clients.at(n);
+
+         if (client.mode!=1 || !cuts.contains(client.socketDescriptor))
+         {
+            continue;
+         }
+
+         Subscriber subscriber = subscriberOf(client);
+
+         Shard *shard = shardOf(client.Sender);
+
+         QMutexLocker shardLocker(&shard->mutex);
+
+         shard->routes[client.Sender].append(subscriber);
+
+         replay(shard,client.Sender,subscriber,cuts.value(client.socketDescriptor));
+      }
+
+      return false;
+   }
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      const Client &client = clients.at(n);
+
+      if (handed.contains(n))
+      {
+         client.handler->deliver(SCDMsgEvent::Handoff,QString(),QByteArray());
+      }
+      else // not drained: closed after its output, the client resumes its session on the successor
+      {
+         sendMessageToClient("exit",client);
+      }
+
+      releaseFormat(client.format);
+   }
+
+   clients.clear();
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgCenter::sessionDrained a session has written to its socket all the messages routed to it before
+ *                                     the handoff. Called by the thread of the session.
+ * @param socketDescriptor
+ */
+void SCDMsgCenter::sessionDrained(int socketDescriptor)
+{
+   QMutexLocker locker(&drainMutex);
+
+   drained.insert(socketDescriptor);
+
+   drainWake.wakeAll();
+}
+
+/**
+ * @brief SCDMsgCenter::restoreState restores the state passed by the outgoing process. The client connections are
+ *                                   registered again when their sessions start, without welcome message. The state
+ *                                   of an older release is read with defaults for the missing fields (line framing
+ *                                   off, console format, Info level, restore time).
+ * @param state
+ * @param fds client connections, in the order of the state
+ * @return false if the state has been written by a newer release (nothing restored)
+ */
+bool SCDMsgCenter::restoreState(const QByteArray &state, const QVector<int> &fds)
+{
+   QMutexLocker locker(&mutex);
+
+   QDataStream in(state);
+
+   quint32 version = 0;
+
+   in >> version;
+
+   if (version<1 || version>HandoffVersion) // state of a newer release: the clients can not be restored
+   {
+      return false;
+   }
+
+   qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+   qint32 count;
+
+   in >> count;
+
+   for (int n=0; n<count; n++)
+   {
+      Adopted taken;
+
+      qint32 mode;
+
+      QString format;
+
+      taken.client.lines = false;
+
+      in >> taken.client.name >> taken.client.user >> taken.client.token >> mode >> taken.client.Sender >> taken.client.digest;
+
+      if (version>=2) // line framing
+      {
+         in >> taken.client.lines;
+      }
+
+      if (version>=3) // output format
+      {
+         in >> format;
+      }
+
+      in >> taken.resumeFrom;
+
+      QString error;
+
+      taken.client.mode   = mode;
+      taken.client.format = format.isEmpty() ? 0 : compileFormat(format,&error);
+
+      if (n<fds.size())
+      {
+         adopted.insert(fds.at(n),taken);
+      }
+   }
+
+   in >> count;
+
+   for (int n=0; n<count; n++)
+   {
+      QString token;
+
+      Session session;
+
+      qint32 index;
+
+      in >> token >> session.sender >> session.acked >> index;
+
+      session.socketDescriptor = index>=0 && index<fds.size() ? fds.at(index) : -1;
+
+      session.detached.start();
+
+      sessions.insert(token,session);
+   }
+
+   in >> count;
+
+   for (int n=0; n<count; n++)
+   {
+      SCDMsgRule rule;
+
+      qint32 level, max, seconds;
+
+      in >> rule.name >> rule.sender >> level >> rule.text >> max >> seconds;
+
+      rule.level   = level;
+      rule.count   = max;
+      rule.seconds = seconds;
+
+      addRule(rule);
+   }
+
+   qint32 shardCount;
+
+   in >> shardCount;
+
+   for (int n=0; n<shardCount && in.status()==QDataStream::Ok; n++) // senders are distributed again among the shards
+   {
+      in >> count;
+
+      for (int s=0; s<count; s++)
+      {
+         QString sender;
+
+         qint64 last;
+
+         qint32 records;
+
+         in >> sender >> last >> records;
+
+         Shard *shard = shardOf(sender);
+
+         QMutexLocker shardLocker(&shard->mutex);
+
+         shard->sequences.insert(sender,last);
+
+         History &history = shard->history[sender];
+
+         for (int r=0; r<records; r++)
+         {
+            Record record;
+
+            qint32 kind, level = Info;
+
+            record.time = now;
+
+            in >> record.first >> record.last >> kind >> record.msg >> record.data;
+
+            if (version>=3) // level and post time
+            {
+               in >> level >> record.time;
+            }
+
+            record.kind  = kind;
+            record.level = level;
+
+            if (r >= records - HistorySize)
+            {
+               history.ring.append(record);
+            }
+         }
+      }
+
+      in >> count;
+
+      for (int s=0; s<count; s++)
+      {
+         QString sender;
+
+         qint32 keys;
+
+         in >> sender >> keys;
+
+         Shard *shard = shardOf(sender);
+
+         QMutexLocker shardLocker(&shard->mutex);
+
+         for (int k=0; k<keys; k++)
+         {
+            QString key, msg;
+
+            in >> key >> msg;
+
+            shard->states[sender].insert(key,msg);
+         }
+      }
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgCenter::processCommand Process client command: the command line is tokenized once, the command is
+ *                                     resolved by the commands registry and its arguments are checked against
+ *                                     their types before dispatching
+ * @param cmd command emit by client
+ * @param socketDescriptor client id
+ */
+void SCDMsgCenter::processCommand(QString cmd, int clientSocketDescriptor)
+{
+   Client client = getClient(clientSocketDescriptor);
+
+   QStringList tokens = cmd.simplified().split(' ',QString::SkipEmptyParts);
+
+   if (client.mode==2) // any command leaves top senders view
+   {
+      client.mode = 0;
+
+      clients.replace(client.index,client);
+   }
+
+   if (tokens.isEmpty()) // <cr>: update client mode => console mode
+   {
+      unsubscribe(client);
+
+      clients.replace(client.index,client);
 
       sendMessageToClient("\n" + getHelpString() + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+
+      return;
+   }
+
+   QString name = tokens.takeFirst();
+
+   if (name.at(0)=='@') // send a command to sender 'sender' and enter in 'spy' mode
+   {
+      processSenderCommand(client,name.mid(1),SCDMsgCommands::skip(cmd,1));
+
+      return;
+   }
+
+   name = name.toLower();
+
+   const SCDMsgCommands::Command *command = commands.find(name);
+
+   if (!command) // unknown command
+   {
+      if (client.index>-1)
+      {
+         sendMessageToClient(name,clientSocketDescriptor);
+      }
+
+      return;
    }
-   else
-   if (cmd.trimmed()=="spy") // spy the message sender 'sender'
+
+   SCDMsgArgs args;
+
+   QString error;
+
+   if (command->admin && !client.admin) // admin commands require an authenticated admin user ('user <name> <secret>')
+   {
+      sendMessageToClient("\nPermission denied: " + name + " requires an admin user" + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+
+      return;
+   }
+
+   if (!commands.parse(command,SCDMsgCommands::skip(cmd,1),&args,&error))
+   {
+      sendMessageToClient("\n" + error + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+
+      return;
+   }
+
+   switch (command->id)
    {
-      if (list.size()>1)
+      case SpyCommand:    // spy the message sender 'sender'
+      case DigestCommand: // spy the message sender 'sender', new templates only
       {
-         QString sender = list[1].trimmed();
+         QString sender = args.value(0);
 
          if (senders.contains(sender))
          {
-            client.Sender = sender;
-            client.mode   = 1;
+            subscribe(client,sender,command->id==DigestCommand);
 
             clients.replace(client.index,client);
          }
@@ -358,66 +2474,503 @@ void SCDMsgCenter::processCommand(QString cmd, int clientSocketDescriptor)
             sendMessageToClient("\nSender not found: " + sender + getPrompt(clientSocketDescriptor) ,clientSocketDescriptor);
          }
       }
-   }
-   else
-   if (cmd.trimmed()=="exit") // close a message server client socket
-   {
-      sendMessageToClient(cmd,clientSocketDescriptor);
-   }
-   else
-   if (cmd.trimmed()=="list")  // get the command menu prompt
-   {
-      QString msg = "\n";
+      break;
+
+      case PatternsCommand: // message templates of sender
+      {
+         QString sender = args.value(0);
+
+         if (senders.contains(sender))
+         {
+            sendMessageToClient(getPatterns(sender) + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+         }
+         else
+         {
+            sendMessageToClient("\nSender not found: " + sender + getPrompt(clientSocketDescriptor) ,clientSocketDescriptor);
+         }
+      }
+      break;
+
+      case RulesCommand: // list of alert rules
+      {
+         QString msg = "\n";
+
+         QVector<SCDMsgRule> list = rules();
+
+         for (int n=0; n<list.size();n++)
+         {
+            msg += "   - ";
+            msg += SCDMsgRules::toString(list.at(n));
+            msg += "\n";
+         }
+
+         msg += getPrompt(clientSocketDescriptor);
+
+         sendMessageToClient(msg,clientSocketDescriptor);
+      }
+      break;
+
+      case RuleCommand: // add an alert rule
+      {
+         SCDMsgRule rule;
+
+         rule.name    = args.value(0);
+         rule.sender  = args.value(1);
+         rule.level   = args.toInt(2);
+         rule.count   = args.toInt(3);
+         rule.seconds = args.toInt(4);
+         rule.text    = args.value(5);
+
+         addRule(rule);
+
+         sendMessageToClient("\nRule added: " + SCDMsgRules::toString(rule) + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case UnruleCommand: // remove an alert rule
+      {
+         QString name = args.value(0);
+
+         sendMessageToClient((removeRule(name) ? "\nRule removed: " : "\nRule not found: ") + name + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case ConflateCommand: // conflation of state messages
+      {
+         if (client.handler)
+         {
+            client.handler->deliver(SCDMsgEvent::Conflate,QString(),args.isOn(0) ? "1" : "0");
+         }
+
+         sendMessageToClient(QString("\nConflation: ") + (args.isOn(0) ? "on" : "off") + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case FramingCommand: // message framing
+      {
+         QString framing = args.value(0).toLower();
+
+         if (framing!="prefix" && framing!="line")
+         {
+            sendMessageToClient("\nInvalid framing: " + framing + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+            break;
+         }
+
+         client.lines = framing=="line";
+
+         clients.replace(client.index,client);
+
+         if (client.handler)
+         {
+            client.handler->deliver(SCDMsgEvent::Framing,QString(),client.lines ? "1" : "0");
+         }
+
+         sendMessageToClient("\nFraming: " + framing + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case FormatCommand: // output format
+      {
+         QString spec = args.value(0);
+
+         QString error;
+
+         const SCDMsgFormat *format = 0;
+
+         if (spec.toLower()!="console" && !(format = compileFormat(spec,&error)))
+         {
+            sendMessageToClient("\n" + error + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+            break;
+         }
+
+         const SCDMsgFormat *previous = client.format;
+
+         client.format = format;
+
+         clients.replace(client.index,client);
+
+         updateRoute(client);
+
+         releaseFormat(previous); // no more referenced by the routing table
+
+         sendMessageToClient("\nFormat: " + (format ? format->spec() : QString("console")) + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case SessionCommand: // open a resumable session
+      {
+         if (client.token.isEmpty())
+         {
+            if (newSession(client).isEmpty())
+            {
+               sendMessageToClient("\nUnable to open a session" + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+               break;
+            }
+
+            clients.replace(client.index,client);
+         }
+
+         sendMessageToClient("\nSession: " + client.token + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case AckCommand: // acknowledge received messages
+      {
+         if (sessions.contains(client.token))
+         {
+            sessions[client.token].acked = args.toLongLong(0);
+         }
+      }
+      break;
+
+      case ResumeCommand: // resume a session after a reconnection
+      {
+         QString token = args.value(0);
+
+         if (!sessions.contains(token))
+         {
+            sendMessageToClient("\nSession not found: " + token + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+         }
+         else
+         {
+            if (client.token!=token) // the session held by this connection can be resumed by another one
+            {
+               detachSession(client.token,clientSocketDescriptor);
+            }
+
+            Session &session = sessions[token];
+
+            qint64 from = args.toLongLong(1,session.acked);
+
+            QString sender = session.sender;
+
+            Client owner = getClient(session.socketDescriptor);
+
+            if (owner.index>-1 && owner.socketDescriptor!=clientSocketDescriptor) // the token holder takes the session over (e.g. half-open old connection)
+            {
+               unsubscribe(owner);
+
+               detachSession(owner.token,owner.socketDescriptor);
+
+               owner.token.clear();
+
+               clients.replace(owner.index,owner);
+
+               if (owner.handler)
+               {
+                  owner.handler->deliver(SCDMsgEvent::Sequence,QString(),"0");
+               }
+
+               sendMessageToClient("\nSession resumed by another connection" + getPrompt(owner.socketDescriptor),owner);
+            }
+
+            session.socketDescriptor = clientSocketDescriptor;
+
+            client.token = token;
+
+            if (client.handler)
+            {
+               client.handler->deliver(SCDMsgEvent::Sequence,QString(),"1");
+            }
+
+            if (sender.isEmpty())
+            {
+               sendMessageToClient("\nSession: " + token + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+            }
+            else
+            {
+               subscribe(client,sender,false,from);
+            }
+
+            clients.replace(client.index,client);
+         }
+      }
+      break;
+
+      case ExitCommand: // close a message server client socket
+      {
+         sendMessageToClient(name,clientSocketDescriptor);
+      }
+      break;
+
+      case ListCommand: // get the list of senders
+      {
+         QString msg = "\n";
+
+         for (int n=0; n<senders.size();n++)
+         {
+            msg += "   - ";
+            msg += senders.at(n);
+            msg += "\n";
+         }
+
+         msg += getPrompt(clientSocketDescriptor);
+
+         sendMessageToClient(msg,clientSocketDescriptor);
+      }
+      break;
+
+      case UserCommand: // select the user profile (output share and bandwidth cap)
+      {
+         if (args.has(0))
+         {
+            QMutexLocker locker(&profileMutex);
+
+            UserProfile profile = profiles.value(args.value(0));
+
+            locker.unlock();
+
+            if (profile.secret!=args.value(1)) // a protected profile requires its secret
+            {
+               sendMessageToClient("\nAccess denied: " + args.value(0) + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+               break;
+            }
+
+            client.user  = args.value(0);
+            client.admin = profile.admin;
+
+            clients.replace(client.index,client);
+
+            sendProfile(client);
+         }
+
+         sendMessageToClient("\nUser: " + client.user + (client.admin ? " (admin)" : "") + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
+
+      case GetCommand: // download a published file
+      {
+         if (args.has(0))
+         {
+            QString name = args.value(0);
+
+            if (!files.contains(name))
+            {
+               sendMessageToClient("\nFile not found: " + name + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+            }
+            else
+            if (!client.handler)
+            {
+               sendMessageToClient("\nFile download not supported" + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+            }
+            else
+            {
+               client.handler->deliver(SCDMsgEvent::File,name,QFile::encodeName(files.value(name)));
+            }
+         }
+         else
+         {
+            QString msg = "\n";
+
+            QStringList names = files.keys();
+
+            for (int n=0; n<names.size();n++)
+            {
+               msg += "   - ";
+               msg += names.at(n);
+               msg += "\n";
+            }
+
+            msg += getPrompt(clientSocketDescriptor);
+
+            sendMessageToClient(msg,clientSocketDescriptor);
+         }
+      }
+      break;
+
+      case TopCommand: // top senders view
+      {
+         int rows = args.toInt(0,10);
+
+         unsubscribe(client);
+
+         client.mode = 2;
+         client.top  = rows>0 ? qMin(rows,100) : 10;
+
+         clients.replace(client.index,client);
+
+         QMetaObject::invokeMethod(topTimer,"start",Qt::QueuedConnection); // timer lives into message center thread
+      }
+      break;
+
+      case ExecCommand: // run an allowed command: its output is streamed by a temporary sender
+      {
+         if (!args.has(0))
+         {
+            QString msg = "\n";
+
+            QStringList names = executor->allowed();
+
+            for (int n=0; n<names.size();n++)
+            {
+               msg += "   - ";
+               msg += names.at(n);
+               msg += "\n";
+            }
+
+            sendMessageToClient(msg + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
 
-      for (int n=0; n<senders.size();n++)
+            break;
+         }
+
+         QString name = args.value(0), arguments = args.value(1);
+
+         QString error = executor->check(name,arguments);
+
+         if (!error.isEmpty())
+         {
+            sendMessageToClient("\n" + error + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+
+            break;
+         }
+
+         QString sender = "exec." + QString::number(++ExecCount);
+
+         registerMessageSender(sender);
+
+         subscribe(client,sender);
+
+         clients.replace(client.index,client);
+
+         QMetaObject::invokeMethod(executor,"start",Qt::QueuedConnection,Q_ARG(QString,name),Q_ARG(QString,arguments),
+                                   Q_ARG(QString,sender),Q_ARG(int,clientSocketDescriptor));
+      }
+      break;
+
+      case PingCommand: // test the client socket connection
       {
-         msg += "   - ";
-         msg += senders.at(n);
-         msg += "\n";
+         sendMessageToClient("pong",clientSocketDescriptor);
       }
+      break;
 
-      msg += getPrompt(clientSocketDescriptor);
+      case HelpCommand:
+      {
+         sendMessageToClient("\n" + getHelpString() + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
 
-      sendMessageToClient(msg,clientSocketDescriptor);
+      default: // application command
+      {
+         sendMessageToClient("\n" + command->handler(args,clientSocketDescriptor) + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      }
+      break;
    }
-   else
-   if (cmd.trimmed()=="ping") // test the client socket connection
+}
+
+/**
+ * @brief SCDMsgCenter::processSenderCommand sends a command to sender and enters in 'spy' mode. If the sender has
+ *                                           registered its commands, the command is checked against them.
+ *                                           '@<sender id> help' is replied by message center.
+ * @param client
+ * @param sender
+ * @param line command line after sender id
+ */
+void SCDMsgCenter::processSenderCommand(Client &client, QString sender, QString line)
+{
+   int clientSocketDescriptor = client.socketDescriptor;
+
+   QStringList tokens = line.simplified().split(' ',QString::SkipEmptyParts);
+
+   if (!senders.contains(sender))
    {
-      sendMessageToClient("pong",clientSocketDescriptor);
+      sendMessageToClient("\nSender not found: " + sender + getPrompt(clientSocketDescriptor), clientSocketDescriptor);
+
+      return;
    }
-   else
-   if (cmd.trimmed()=="help")
+
+   if (!tokens.isEmpty() && tokens.first().toLower()=="help")
    {
-      sendMessageToClient("\n" + getHelpString() + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+      sendMessageToClient(getSenderHelp(sender) + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+
+      return;
    }
-   else
-   if(cmd.trimmed().at(0)=='@') // send a command to sender 'sender' and enter in 'spy' mode
-   {
-      QString sender = cmd.trimmed().remove(0,1);
 
-      list.removeFirst();
+   QHash<QString,SCDMsgCommands>::const_iterator registry = senderCommands.constFind(sender);
 
-      cmd = list.join(" ").trimmed();
+   if (registry!=senderCommands.constEnd() && !registry.value().isEmpty())
+   {
+      const SCDMsgCommands::Command *command = tokens.isEmpty() ? 0 : registry.value().find(tokens.first().toLower());
 
-      if (senders.contains(sender))
-      {
-         client.Sender = sender;
-         client.mode   = 1;
+      SCDMsgArgs args;
 
-         clients.replace(client.index,client);
+      QString error;
 
-         emit commandToSender_signal(cmd,sender);
+      if (!command)
+      {
+         error = "Unknown command of " + sender + ": " + tokens.join(" ") + " (type '@" + sender + " help')";
       }
       else
+      if (registry.value().parse(command,SCDMsgCommands::skip(line,1),&args,&error))
       {
-         sendMessageToClient("\nSender not found: " + sender + getPrompt(clientSocketDescriptor), clientSocketDescriptor);
+         tokens = args.values(); // normalized command line
+
+         tokens.prepend(command->name);
       }
-   }
-   else
-   {
-      if (client.index>-1)
+
+      if (!error.isEmpty())
       {
-         sendMessageToClient(cmd,clientSocketDescriptor);
+         sendMessageToClient("\n" + error + getPrompt(clientSocketDescriptor),clientSocketDescriptor);
+
+         return;
       }
    }
+
+   subscribe(client,sender);
+
+   clients.replace(client.index,client);
+
+   emit commandToSender_signal(tokens.join(" "),sender);
+}
+
+/**
+ * @brief SCDMsgBatcher::SCDMsgBatcher
+ * @param mc message center
+ * @param sender sender id of the batched messages
+ * @param maxMessages posts the batch when it contains maxMessages messages
+ * @param maxDelay posts the batch when the oldest message is older than maxDelay milliseconds
+ */
+SCDMsgBatcher::SCDMsgBatcher(SCDMsgCenter *mc, QString sender, int maxMessages, int maxDelay) :
+    mc(mc), Sender(sender), MaxMessages(qMax(1,maxMessages)), MaxDelay(maxDelay)
+{
+   messages.reserve(MaxMessages);
+}
+
+/**
+ * @brief SCDMsgBatcher::~SCDMsgBatcher posts the pending messages
+ */
+SCDMsgBatcher::~SCDMsgBatcher()
+{
+   flush();
+}
+
+/**
+ * @brief SCDMsgBatcher::post appends a message to batch, and posts the batch if it is full or too old
+ * @param msg
+ */
+void SCDMsgBatcher::post(QString msg)
+{
+   if (messages.isEmpty())
+   {
+      age.start();
+   }
+
+   messages.append(msg);
+
+   if (messages.size()>=MaxMessages || age.hasExpired(MaxDelay))
+   {
+      flush();
+   }
+}
+
+/**
+ * @brief SCDMsgBatcher::flush posts the pending messages to message center
+ */
+void SCDMsgBatcher::flush()
+{
+   if (!messages.isEmpty())
+   {
+      mc->postMessages(Sender,messages);
+
+      messages.clear();
+   }
 }
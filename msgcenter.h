@@ -4,11 +4,31 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QMutex>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QWaitCondition>
+#include <QSet>
+#include <QTimer>
+
+#include "msgstats.h"
+#include "msgrules.h"
+#include "msgcommands.h"
+#include "msgformat.h"
+
+class SCDMsgThreadHandler;
+class SCDMsgDispatcher;
+class SCDMsgExec;
 
 class SCDMsgCenter : public QObject
 {
     Q_OBJECT
 
+    friend class SCDMsgDispatcher;
+    friend class SCDMsgExec;
+
   private:
 
     struct Client
@@ -16,38 +36,330 @@ class SCDMsgCenter : public QObject
        QString name;         // connection name
        QString user;         // username
        QString Sender;       // sender id from which to receive the messages
-       int mode;             // operating  mode (0: command console, 1: realtime messages receiving)
-       int admin;            // admin user (can see others user info)
+       int mode;             // operating  mode (0: command console, 1: realtime messages receiving, 2: top senders view)
+       int top;              // rows of top senders view
+       QString token;        // session token (resumable session, see 'session' and 'resume' commands)
+       bool digest;          // spy in digest mode (see 'digest' command)
+       bool lines;           // line framing: messages terminated by LF (see 'framing' command)
+       const SCDMsgFormat *format; // output format (null: console, see 'format' command)
+       int admin;            // admin user, authenticated by the secret of its profile (admin commands)
        int index;            // index on clients list
        int socketDescriptor; // client socket connection descriptor
+
+       SCDMsgThreadHandler *handler; // client session which writes the messages to socket (null: use messageToClient_signal)
+       QObject *dispatcher;          // batch dispatcher of the client shared I/O thread (null: session owns its thread)
+    };
+
+    /**
+     * @brief The Subscriber struct a client in realtime messages receiving mode, as seen by the sender routing table
+     */
+    struct Subscriber
+    {
+       int socketDescriptor;
+       SCDMsgThreadHandler *handler;
+       QObject *dispatcher;
+       bool digest; // receives only first occurrences of templates and count milestones
+       const SCDMsgFormat *format; // output format (null: console)
+    };
+
+    /**
+     * @brief The Pending struct a message waiting into a sender queue of the dispatch stage
+     */
+    struct Pending
+    {
+       int kind;
+       QString msg;
+       QByteArray data;
+       int cost;    // message size
+       int count;   // number of messages (batch)
+       int level;   // message level
+       qint64 time; // post time (ms since epoch)
+       int dropped; // drop notice: messages dropped after the previous entries (0: message)
+    };
+
+    /**
+     * @brief The SenderQueue struct messages of a sender waiting for deficit round robin dispatch
+     */
+    struct SenderQueue
+    {
+       QQueue<Pending> pending;
+
+       int weight     = 1;     // share of dispatch bandwidth
+       qint64 deficit = 0;     // deficit round robin counter
+       qint64 bytes   = 0;     // size of pending messages
+       bool active    = false; // sender is into active list
+    };
+
+    /**
+     * @brief The Record struct a message (or a batch) kept into sender history
+     */
+    struct Record
+    {
+       qint64 first; // sequence number of first message
+       qint64 last;  // sequence number of last message
+       int kind;
+       QString msg;
+       QByteArray data;
+       int level;
+       qint64 time;  // post time (ms since epoch)
+    };
+
+    /**
+     * @brief The History struct ring of the last messages of a sender
+     */
+    struct History
+    {
+       QVector<Record> ring;
+       int next = 0; // oldest record, overwritten by next record (when the ring is full)
+    };
+
+    /**
+     * @brief The Session struct a resumable session: the spied sender and the last sequence acknowledged by the client
+     */
+    struct Session
+    {
+       QString sender;
+       qint64 acked = 0;
+       int socketDescriptor = -1; // client bound to session (-1: disconnected)
+       QElapsedTimer detached;    // time since client disconnection
+    };
+
+    /**
+     * @brief The Shard struct a partition of the senders with its own lock and routing table.
+     *        Messages from senders of different shards are routed in parallel.
+     */
+    struct Shard
+    {
+       QMutex mutex;
+
+       QHash<QString, QVector<Subscriber> > routes; // sender => clients which spy the sender
+
+       QHash<QString, SenderQueue> queues; // sender => pending messages (dispatch stage only)
+       QQueue<QString> active;             // senders with pending messages, in round robin order
+       QWaitCondition wake;                // wakes the dispatcher when a sender becomes active
+
+       SCDMsgDispatcher *dispatcher = 0;   // dispatcher thread (null: messages routed by posting thread)
+       bool running = false;
+
+       SCDMsgTopSenders top;               // heavy hitters of the shard senders since last top view frame
+
+       QHash<QString, SCDMsgPatterns> patterns; // sender => message templates (only senders with mining enabled)
+
+       QHash<QString, QHash<QString,QString> > states; // last value cache: sender => key => last state message
+
+       QHash<QString,qint64> sequences;    // sender => sequence number of its last message
+       QHash<QString,History> history;     // sender => last routed messages (resumable sessions)
+
+       SCDMsgRules rules;                  // copy of alert rules with the windows of the shard senders
+       QElapsedTimer clock;                // time of alert rules windows
+
+       SCDMsgFormatCache formats;          // encoding state of output formats (sender prefixes, timestamp)
+    };
+
+    /**
+     * @brief The Fanout struct one batch of a message for all the subscribers living into the same I/O thread
+     *        with the same output format
+     */
+    struct Fanout
+    {
+       QObject *dispatcher;
+       const SCDMsgFormat *format;
+       QByteArray encoded; // message encoded by format
+       QVector<SCDMsgThreadHandler*> sessions;
     };
 
     const char CR = 0x0D;
     const char LF = 0x0A;
 
-    QMutex mutex;
+    QMutex mutex; // protects clients and senders lists (lock it before any shard lock)
 
     QVector<Client> clients; // list of client socket
 
+    QVector<Shard*> shards;  // senders routing tables partitioned by hash of sender id
+
+    int Quantum = 4096;                  // deficit round robin quantum (bytes for each round and unit of weight)
+    qint64 MaxQueueBytes = 16*1024*1024; // max size of pending messages of a sender
+
     QStringList senders;       // list of message senders
 
+    QHash<QString,QString> files; // files published for download (name => path)
+
+    QHash<QString,SCDMsgFormat*> formats; // compiled output formats by spec, shared by the clients
+    QHash<const SCDMsgFormat*,int> formatUsers; // format => clients using it (deleted by the last one)
+
+    /**
+     * @brief The CommandId enum dispatch ids of built-in console commands
+     */
+    enum CommandId {ListCommand, SpyCommand, DigestCommand, PatternsCommand, TopCommand, RulesCommand, RuleCommand,
+                    UnruleCommand, ConflateCommand, FramingCommand, FormatCommand, SessionCommand, AckCommand, ResumeCommand, UserCommand, GetCommand,
+                    PingCommand, HelpCommand, ExitCommand, ExecCommand, ApplicationCommand};
+
+    SCDMsgCommands commands; // console commands: built-in and registered by application
+
+    QHash<QString,SCDMsgCommands> senderCommands; // sender => commands accepted by sender ('@<sender id> help')
+
+    SCDMsgExec *executor = 0; // runs the commands allowed by application ('exec' command, null: not enabled)
+
+    quint64 ExecCount = 0;    // commands run (temporary sender names)
+
+    QString AlertSender = "alerts"; // sender of alert rules messages
+
+    int HistorySize = 1024;         // records kept for each sender (0: no history)
+
+    QHash<QString,Session> sessions; // session token => resumable session
+
+    const qint64 SessionTimeout = 3600000; // ms after which the session of a disconnected client can be discarded
+
+    static const quint32 HandoffVersion = 3; // format of the state passed to a restarted process (older ones are read too)
+
+    /**
+     * @brief The Adopted struct a client connection taken over from the outgoing process, waiting for its session
+     */
+    struct Adopted
+    {
+       Client client;
+       qint64 resumeFrom; // last sequence of spied sender routed by the outgoing process
+    };
+
+    QHash<int,Adopted> adopted; // socket descriptor => client taken over
+
+    bool handingOff = false;    // sessions draining before the handoff: the client commands are ignored
+
+    QMutex drainMutex;          // protects drained (taken by the client sessions)
+    QWaitCondition drainWake;   // a session has written all its output
+    QSet<int> drained;          // sessions ready to be handed off (socket descriptors)
+
+    QTimer *topTimer;          // refresh of top senders view (runs while a client is into top view)
+    QElapsedTimer topClock;    // start of top senders counting interval
+
+    /**
+     * @brief The UserProfile struct output share and bandwidth cap of the sessions of a user
+     */
+    struct UserProfile
+    {
+       int weight    = 1;     // output share of each session into its I/O thread
+       qint64 rate   = 0;     // bandwidth cap shared by all sessions of the user (bytes per second, 0: no cap)
+       bool admin    = false; // admin user
+       QString secret;        // required to select the profile (empty: any client can select it)
+       double tokens = 0;     // token bucket of bandwidth cap
+       QElapsedTimer clock;   // last token bucket refill
+    };
+
+    QMutex profileMutex; // protects profiles (it is taken by the I/O threads)
+
+    QHash<QString,UserProfile> profiles;
+
+    void sendProfile(const Client &client);
+
     void notifyRemovedSender();
 
     Client getClient(int socketDescriptor);
 
     QStringList getSenderList();
 
+    void registerCommands();
+
     QString getHelpString();
 
+    QString getSenderHelp(QString sender);
+
+    qint64 clientBacklog(int socketDescriptor);
+
     QString getPrompt(int socketDescriptor);
 
     void sendMessageToClient(QString msg, int clientSocketDescriptor);
 
+    void sendMessageToClient(const QString &msg, const Client &client);
+
+    Shard *shardOf(const QString &sender);
+
+    void subscribe(Client &client, QString sender, bool digest = false, qint64 resumeFrom = -1);
+
+    void unsubscribe(Client &client);
+
+    qint64 removeRoute(const Client &client);
+
+    static Subscriber subscriberOf(const Client &client);
+
+    void dispatch(const QString &sender, int kind, const QString &msg, const QByteArray &data, int count = 1, int level = Info);
+
+    void route(Shard *shard, const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level, qint64 time);
+
+    void fanOut(Shard *shard, const QString &sender, const QVector<Subscriber> &subscribers, bool digest, int kind,
+                const QString &msg, const QByteArray &data, qint64 seq, int count, int level, qint64 time);
+
+    qint64 remember(Shard *shard, const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level, qint64 time);
+
+    void replay(Shard *shard, const QString &sender, const Subscriber &subscriber, qint64 from);
+
+    QString newSession(Client &client);
+
+    void detachSession(const QString &token, int socketDescriptor);
+
+    static QString randomToken();
+
+    QString minePatterns(SCDMsgPatterns &patterns, const QString &sender, const QString &msg);
+
+    QString getPatterns(QString sender);
+
+    void enqueue(Shard *shard, const QString &sender, int kind, const QString &msg, const QByteArray &data, int count, int level, qint64 time);
+
+    const SCDMsgFormat *compileFormat(QString spec, QString *error);
+
+    void releaseFormat(const SCDMsgFormat *format);
+
+    void updateRoute(const Client &client);
+
+    void serveShard(Shard *shard);
+
+    QString renderTop(const QVector<SCDMsgTopSenders::Entry> &entries, int rows, qint64 elapsed);
+
+  private slots:
+
+    void refreshTop();
+
   public:
 
-    explicit SCDMsgCenter(QObject *parent = nullptr);
+    enum Level {Debug, Info, Warning, Error, Critical}; // message levels
+
+    explicit SCDMsgCenter(QObject *parent = nullptr, int shardCount = 1);
+
+    ~SCDMsgCenter();
+
+    int shardCount() {return shards.size();}
 
-    void addClient(int socketDescriptor);
+    void startDispatchers(int quantum = 4096, qint64 maxQueueBytes = 16*1024*1024);
+
+    void setSenderWeight(QString sender, int weight);
+
+    void setUserProfile(QString user, int weight, qint64 bytesPerSecond = 0, bool admin = false, QString secret = QString());
+
+    qint64 takeBandwidth(const QString &user, qint64 bytes);
+
+    void setTopRefresh(int msec);
+
+    void setPatternMining(QString sender, bool enable);
+
+    void setHistorySize(int records);
+
+    void addRule(const SCDMsgRule &rule);
+
+    bool removeRule(QString name);
+
+    QVector<SCDMsgRule> rules();
+
+    bool addCommand(QString name, QString args, QString help, SCDMsgCommandHandler handler);
+
+    bool removeCommand(QString name);
+
+    bool addSenderCommand(QString sender, QString name, QString args, QString help);
+
+    void allowExec(QString name, QString program, QStringList args = QStringList(), QString argPattern = QString(),
+                   bool options = false);
+
+    void addClient(int socketDescriptor, SCDMsgThreadHandler *handler = 0);
+
+    bool setClientDispatcher(int socketDescriptor, QObject *dispatcher);
 
     void removeClient(int socketDescriptor);
 
@@ -59,6 +371,24 @@ class SCDMsgCenter : public QObject
 
     void postMessage(QString msg, QString sender, bool prependNewLine=true);
 
+    void postMessage(QString msg, QString sender, int level, bool prependNewLine=true);
+
+    void postMessages(QString sender, const QStringList &msgs, bool prependNewLine=true);
+
+    void postData(QByteArray data, QString sender);
+
+    void postState(QString key, QString value, QString sender);
+
+    bool handOff(int channel, int listener, int drainTimeout);
+
+    void sessionDrained(int socketDescriptor); // thread safe: a session has written all its output before the handoff
+
+    bool restoreState(const QByteArray &state, const QVector<int> &fds);
+
+    void addFile(QString name, QString path);
+
+    void removeFile(QString name);
+
   signals:
 
     /**
@@ -77,14 +407,47 @@ class SCDMsgCenter : public QObject
 
   protected:
 
-    void registerClient(int socketDescriptor);
+    void registerClient(int socketDescriptor, SCDMsgThreadHandler *handler = 0);
     void unregisterClient(int socketDescriptor);
 
     void registerMessageSender(QString sender);
     void unregisterMessageSender(QString sender);
 
     void processCommand(QString cmd, int clientSocketDescriptor);
+    void processSenderCommand(Client &client, QString sender, QString line);
     void processMessage(QString msg, QString sender);
 };
 
+/**
+ * @brief The SCDMsgBatcher class collects the messages of a bursty sender and posts them to message center as a single
+ *        batch (see SCDMsgCenter::postMessages). The batch is posted when it reaches maxMessages, when the oldest message
+ *        is older than maxDelay milliseconds, on flush() and on batcher destruction.
+ *        A batcher is not thread safe: declare it into the scope of the producing thread (one batcher for each thread).
+ */
+class SCDMsgBatcher
+{
+  public:
+
+    explicit SCDMsgBatcher(SCDMsgCenter *mc, QString sender, int maxMessages = 64, int maxDelay = 10);
+
+    ~SCDMsgBatcher();
+
+    void post(QString msg);
+
+    void flush();
+
+  private:
+
+    SCDMsgCenter *mc;
+
+    QString Sender;
+
+    QStringList messages; // pending messages
+
+    int MaxMessages;
+    int MaxDelay;
+
+    QElapsedTimer age; // age of the oldest pending message
+};
+
 #endif // SCDMSGCENTER_H
@@ -0,0 +1,581 @@
+/**
+ * @class  SCDMsgClient - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: native client
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         The client side of message center: a program which consumes the messages of a sender receives them decoded
+ *         in batches, without screen scraping the console prompts, and survives the disconnections without losing
+ *         or duplicating messages (as far as the server history covers the disconnection).
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgclient.h
+ *
+*/
+
+#include "msgclient.h"
+
+#include <QThread>
+
+#include <string.h>
+#include <limits.h>
+
+/**
+ * @brief SCDMsgClient::SCDMsgClient
+ * @param parent
+ */
+SCDMsgClient::SCDMsgClient(QObject *parent) : QObject(parent), Port(0), State(Disconnected), AutoReconnect(true),
+    Resumable(true), Lines(false), Closing(false), Delay(MinDelay), LastSeq(0), PendingSeq(0), PendingLines(0), Skip(0),
+    ChunkLeft(0), Head(0), Used(0), Cursor(0), Received(0)
+{
+   Socket = new QTcpSocket(this);
+
+   Retry = new QTimer(this);
+
+   Retry->setSingleShot(true);
+
+   Buffer.resize(ReadSize);
+
+   connect(Socket,SIGNAL(connected()),this,SLOT(connected()));
+   connect(Socket,SIGNAL(readyRead()),this,SLOT(readable()));
+   connect(Socket,SIGNAL(disconnected()),this,SLOT(closed()));
+   connect(Socket,SIGNAL(error(QAbstractSocket::SocketError)),this,SLOT(closed()));
+   connect(Retry,SIGNAL(timeout()),this,SLOT(reconnect()));
+}
+
+/**
+ * @brief SCDMsgClient::setHandler sets the handler which receives each decoded batch (event loop required). Without
+ *                                 handler the messages are pulled by next().
+ * @param handler
+ */
+void SCDMsgClient::setHandler(Handler handler)
+{
+   this->handler = handler;
+}
+
+/**
+ * @brief SCDMsgClient::setAutoReconnect reconnects after a disconnection (default on)
+ * @param enable
+ */
+void SCDMsgClient::setAutoReconnect(bool enable)
+{
+   AutoReconnect = enable;
+}
+
+/**
+ * @brief SCDMsgClient::setResumable opens a resumable session, so a reconnection receives the messages posted while
+ *                                   disconnected (default on)
+ * @param enable
+ */
+void SCDMsgClient::setResumable(bool enable)
+{
+   Resumable = enable;
+}
+
+/**
+ * @brief SCDMsgClient::connectToServer connects to message center server and spies sender
+ * @param host
+ * @param port
+ * @param sender
+ */
+void SCDMsgClient::connectToServer(QString host, quint16 port, QString sender)
+{
+   Host   = host;
+   Port   = port;
+   Sender = sender;
+   Prefix = sender.toUtf8() + ": ";
+
+   Token.clear();
+
+   LastSeq      = 0;
+   PendingSeq   = 0;
+   PendingLines = 0;
+   Skip         = 0;
+
+   Closing = false;
+   Delay   = MinDelay;
+
+   Retry->stop();
+
+   Socket->abort();
+   Socket->connectToHost(Host,Port);
+}
+
+/**
+ * @brief SCDMsgClient::disconnectFromServer closes the connection (no reconnection)
+ */
+void SCDMsgClient::disconnectFromServer()
+{
+   Closing = true;
+
+   Retry->stop();
+
+   Socket->disconnectFromHost();
+}
+
+/**
+ * @brief SCDMsgClient::next pulls the next message. The message points into the receive buffer, and is valid until
+ *                           the next call. Without handler the client is driven by this function: it reconnects and
+ *                           decodes without event loop.
+ * @param message
+ * @param msecs max wait for a message (-1: no timeout)
+ * @return false on timeout, or if disconnected and reconnection is disabled
+ */
+bool SCDMsgClient::next(Message *message, int msecs)
+{
+   while (Cursor>=Batch.size())
+   {
+      Batch.resize(0);
+
+      Cursor = 0;
+
+      if (State==Disconnected && Socket->state()==QAbstractSocket::ConnectedState) // reset requested by server reply
+      {
+         Socket->abort();
+      }
+
+      if (Socket->state()==QAbstractSocket::UnconnectedState)
+      {
+         if (Closing || !AutoReconnect || Host.isEmpty())
+         {
+            return false;
+         }
+
+         if (Retry->isActive()) // no event loop: the reconnection delay is waited here
+         {
+            QThread::msleep(qMax(0,Retry->remainingTime()));
+         }
+
+         reconnect();
+
+         if (!Socket->waitForConnected(msecs))
+         {
+            return false;
+         }
+      }
+
+      if (Socket->state()!=QAbstractSocket::ConnectedState || !fill())
+      {
+         if (!Socket->waitForReadyRead(msecs) && Socket->state()==QAbstractSocket::ConnectedState)
+         {
+            return false; // timeout
+         }
+
+         continue;
+      }
+
+      decode();
+   }
+
+   *message = Batch.at(Cursor++);
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgClient::connected starts the negotiation
+ */
+void SCDMsgClient::connected()
+{
+   Head      = 0;
+   Used      = 0;
+   ChunkLeft = 0;
+   Cursor    = 0;
+   Lines     = false;
+   State     = Greeting;
+
+   Batch.resize(0);
+
+   Socket->setSocketOption(QAbstractSocket::LowDelayOption,1);
+}
+
+/**
+ * @brief SCDMsgClient::readable decodes the received data and delivers the batches to handler
+ */
+void SCDMsgClient::readable()
+{
+   if (!handler) // pull mode: decoded by next()
+   {
+      return;
+   }
+
+   while (fill())
+   {
+      decode();
+
+      if (!Batch.isEmpty())
+      {
+         handler(Batch);
+
+         Batch.resize(0);
+      }
+
+      if (State==Disconnected) // reset requested by server reply
+      {
+         Socket->abort();
+
+         break;
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgClient::closed schedules the reconnection, with delay doubled at each failure
+ */
+void SCDMsgClient::closed()
+{
+   if (Retry->isActive()) // error and disconnection of the same connection
+   {
+      return;
+   }
+
+   State = Disconnected;
+
+   emit disconnected();
+
+   if (!Closing && AutoReconnect)
+   {
+      Retry->start(Delay);
+
+      Delay = qMin(Delay*2,(int)MaxDelay);
+   }
+}
+
+/**
+ * @brief SCDMsgClient::reconnect
+ */
+void SCDMsgClient::reconnect()
+{
+   Retry->stop();
+
+   if (Closing || Socket->state()!=QAbstractSocket::UnconnectedState)
+   {
+      return;
+   }
+
+   Socket->connectToHost(Host,Port);
+}
+
+/**
+ * @brief SCDMsgClient::fill reads the available data into the buffer, after the data not yet decoded
+ * @return false if no data has been read
+ */
+bool SCDMsgClient::fill()
+{
+   if (Head>0)
+   {
+      memmove(Buffer.data(), Buffer.constData() + Head, Used - Head);
+
+      Used -= Head;
+      Head  = 0;
+   }
+
+   if (Used==Buffer.size()) // a line longer than buffer
+   {
+      Buffer.resize(Buffer.size()*2);
+   }
+
+   qint64 size = Socket->read(Buffer.data() + Used, Buffer.size() - Used);
+
+   if (size<=0)
+   {
+      return false;
+   }
+
+   Used += size;
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgClient::decode decodes the complete lines of buffer into the batch. A line is complete when its LF has
+ *                             arrived; in LF prefix framing (older servers) the last message of a burst so waits for
+ *                             the next one.
+ */
+void SCDMsgClient::decode()
+{
+   const char *buffer = Buffer.constData();
+
+   while (Head<Used)
+   {
+      if (State!=Streaming)
+      {
+         handshake();
+
+         if (State!=Streaming)
+         {
+            return;
+         }
+      }
+
+      if (ChunkLeft>0) // binary payload: delivered as it arrives
+      {
+         int size = (int)qMin<qint64>(ChunkLeft, Used - Head);
+
+         Message message;
+
+         message.text = buffer + Head;
+         message.size = size;
+         message.seq  = PendingSeq;
+         message.data = true;
+
+         Batch.append(message);
+
+         ChunkLeft -= size;
+         Head      += size;
+
+         continue;
+      }
+
+      const char *line = buffer + Head;
+
+      const char *newline = (const char*)memchr(line, '\n', Used - Head);
+
+      if (!newline)
+      {
+         return;
+      }
+
+      int size = newline - line;
+
+      Head += size + 1;
+
+      if (size>0 && line[size-1]=='\r')
+      {
+         size--;
+      }
+
+      if (size==0)
+      {
+         continue;
+      }
+
+      if (size>6 && (memcmp(line,"#data ",6)==0 || memcmp(line,"#file ",6)==0)) // chunk header (never a message)
+      {
+         const char *slash = (const char*)memchr(line, '/', size); // the name follows the sizes
+
+         const char *p = slash;
+
+         while (p && p>line && p[-1]!=' ')
+         {
+            p--;
+         }
+
+         ChunkLeft = p ? QByteArray(p, slash - p).toLongLong() : 0;
+
+         continue;
+      }
+
+      if (size>5 && memcmp(line,"#gap ",5)==0) // gap marker: '#gap <first> <last> <sender>'
+      {
+         QList<QByteArray> gap = QByteArray(line + 5, size - 5).split(' ');
+
+         emit this->gap(gap.value(0).toLongLong(), gap.value(1).toLongLong());
+
+         continue;
+      }
+
+      if (size>=Prefix.size() && memcmp(line, Prefix.constData(), Prefix.size())==0)
+      {
+         const char *text = line + Prefix.size();
+
+         int length = size - Prefix.size();
+
+         if (Skip>0) // already delivered before the reconnection
+         {
+            Skip--;
+            continue;
+         }
+
+         Message message;
+
+         message.text = text;
+         message.size = length;
+         message.seq  = PendingSeq;
+         message.data = false;
+
+         Batch.append(message);
+
+         PendingLines++;
+
+         Received++;
+
+         Delay = MinDelay;
+      }
+      else
+      if (line[0]=='#' && size>1 && line[1]>='0' && line[1]<='9')
+      {
+         sequence(QByteArray(line + 1, size - 1).toLongLong());
+      }
+      else
+      {
+         control(line,size);
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgClient::handshake processes the replies of the negotiation: each reply ends with the console prompt
+ */
+void SCDMsgClient::handshake()
+{
+   while (State!=Streaming && State!=Disconnected)
+   {
+      const char *data = Buffer.constData() + Head;
+
+      int prompt = QByteArray::fromRawData(data, Used - Head).indexOf(":> ");
+
+      if (prompt<0)
+      {
+         return;
+      }
+
+      QByteArray reply(data, prompt);
+
+      int end = prompt + 3;
+
+      if (Lines && Head + end < Used && data[end]=='\n')
+      {
+         end++;
+      }
+
+      Head += end;
+
+      if (State==Greeting)
+      {
+         send("framing line\n");
+
+         State = Framing;
+
+         continue;
+      }
+
+      if (State==Framing)
+      {
+         Lines = reply.contains("Framing: line");
+      }
+      else
+      if (State==Session)
+      {
+         int at = reply.indexOf("Session: ");
+
+         if (at>=0)
+         {
+            Token = QString::fromUtf8(reply.mid(at + 9)).section('\n',0,0).trimmed();
+         }
+         else
+         {
+            Resumable = false; // server without sessions
+         }
+
+         LastSeq      = 0;
+         PendingSeq   = 0;
+         PendingLines = 0;
+         Skip         = 0;
+      }
+
+      subscribe(); // Resync: the reply has been processed by control()
+   }
+}
+
+/**
+ * @brief SCDMsgClient::subscribe opens the session, or resumes it, or spies the sender
+ */
+void SCDMsgClient::subscribe()
+{
+   if (Resumable && Token.isEmpty())
+   {
+      send("session\n");
+
+      State = Session;
+
+      return;
+   }
+
+   if (Resumable && State==Framing) // the missed messages are replayed, then the sender is spied again
+   {
+      bool received = LastSeq>0 || PendingSeq>0;
+
+      send("resume " + Token.toUtf8() + (received ? " " + QByteArray::number(LastSeq) : QByteArray()) + "\n");
+   }
+   else
+   {
+      send("spy " + Sender.toUtf8() + "\n");
+   }
+
+   State = Streaming;
+
+   emit streaming();
+}
+
+/**
+ * @brief SCDMsgClient::control processes a line which is not a message of the sender (server reply)
+ * @param line
+ * @param size
+ */
+void SCDMsgClient::control(const char *line, int size)
+{
+   QByteArray reply(line, size);
+
+   if (reply.startsWith("Session not found")) // server restarted: new session after the prompt of this reply
+   {
+      Token.clear();
+
+      State = Resync;
+   }
+   else
+   if (reply.startsWith("Session: ")) // resumed session without spied sender
+   {
+      send("spy " + Sender.toUtf8() + "\n");
+   }
+   else
+   if (reply.startsWith("Sender not found")) // not yet registered: retried after the reconnection delay
+   {
+      emit error(QString::fromUtf8(reply));
+
+      State = Disconnected;
+   }
+}
+
+/**
+ * @brief SCDMsgClient::sequence processes the sequence number which precedes a batch of messages. A batch is complete
+ *                               when the next sequence number arrives; a batch replayed after a reconnection skips
+ *                               the lines already delivered.
+ * @param seq
+ */
+void SCDMsgClient::sequence(qint64 seq)
+{
+   if (seq==PendingSeq)
+   {
+      Skip = PendingLines;
+   }
+   else
+   if (seq<=LastSeq)
+   {
+      Skip = INT_MAX;
+   }
+   else
+   {
+      if (PendingSeq>0)
+      {
+         LastSeq = PendingSeq;
+      }
+
+      PendingSeq   = seq;
+      PendingLines = 0;
+      Skip         = 0;
+   }
+}
+
+/**
+ * @brief SCDMsgClient::send writes a console command
+ * @param command
+ */
+void SCDMsgClient::send(const QByteArray &command)
+{
+   Socket->write(command);
+}
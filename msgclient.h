@@ -0,0 +1,151 @@
+#ifndef SCDMSGCLIENT_H
+#define SCDMSGCLIENT_H
+
+#include <QObject>
+#include <QVector>
+#include <QByteArray>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <functional>
+
+/**
+ * @brief The SCDMsgClient class spies a sender of a message center server, replacing the console protocol (prompts,
+ *        commands and replies) with a stream of decoded messages.
+ *
+ *        At connection the client negotiates the line framing (each message terminated by LF, so a message is
+ *        complete as soon as its LF arrives; the older servers keep the LF prefix framing) and a resumable session
+ *        (sequence numbers), then spies the sender. If the connection drops it reconnects with increasing delay,
+ *        resumes the session from the last sequence number received (the messages of a batch already received are
+ *        skipped), or opens a new session and subscribes again if the server has lost it.
+ *
+ *        The data are read into a reusable buffer and decoded in batches: each Message points into the buffer (no
+ *        copy, no allocation per message), and is valid until the next batch is decoded. The messages are delivered
+ *        to a handler for each batch (event loop required), or pulled one by one by next().
+ */
+class SCDMsgClient : public QObject
+{
+    Q_OBJECT
+
+  public:
+
+    /**
+     * @brief The Message struct a message or a binary payload chunk, pointing into the receive buffer
+     */
+    struct Message
+    {
+       const char *text; // message text (sender prefix excluded), or payload bytes
+       int size;
+       qint64 seq;       // sequence number of message batch (0: none)
+       bool data;        // part of a binary payload chunk (see SCDMsgCenter::postData)
+    };
+
+    typedef std::function<void(const QVector<SCDMsgClient::Message> &batch)> Handler;
+
+    explicit SCDMsgClient(QObject *parent = 0);
+
+    void setHandler(Handler handler);
+
+    void setAutoReconnect(bool enable);
+
+    void setResumable(bool enable);
+
+    void connectToServer(QString host, quint16 port, QString sender);
+
+    void disconnectFromServer();
+
+    bool next(Message *message, int msecs = -1);
+
+    bool isStreaming() const { return State==Streaming; }
+
+    bool lineFraming() const { return Lines; }
+
+    QString sender() const { return Sender; }
+
+    qint64 lastSequence() const { return LastSeq; }
+
+    quint64 received() const { return Received; }
+
+  signals:
+
+    void streaming(); // sender spied: the messages are flowing
+
+    void disconnected();
+
+    void error(QString error);
+
+    void gap(qint64 first, qint64 last); // messages of the resumed session lost (evicted from server history)
+
+  private slots:
+
+    void connected();
+
+    void readable();
+
+    void closed();
+
+    void reconnect();
+
+  private:
+
+    enum State {Disconnected, Greeting, Framing, Session, Resync, Streaming};
+
+    static const int ReadSize = 262144;       // bytes read (and decoded) by each batch
+    static const int MinDelay = 100;          // first reconnection delay (msec), doubled up to MaxDelay
+    static const int MaxDelay = 5000;
+
+    QTcpSocket *Socket;
+
+    QTimer *Retry;               // reconnection
+
+    Handler handler;
+
+    QString Host;
+    quint16 Port;
+    QString Sender;
+
+    QByteArray Prefix;           // '<sender>: '
+
+    int State;
+
+    bool AutoReconnect;
+    bool Resumable;
+    bool Lines;                  // line framing negotiated
+    bool Closing;                // disconnected by application
+
+    int Delay;                   // next reconnection delay
+
+    QString Token;               // session token
+
+    qint64 LastSeq;              // last batch received completely
+    qint64 PendingSeq;           // batch in progress (complete when the next sequence number arrives)
+    int PendingLines;            // lines of batch in progress already delivered
+    int Skip;                    // lines of a replayed batch already delivered
+
+    qint64 ChunkLeft;            // payload bytes of current chunk still to read
+
+    QByteArray Buffer;           // receive buffer
+    int Head;                    // first byte not yet decoded
+    int Used;                    // bytes into buffer
+
+    QVector<Message> Batch;      // decoded messages (reused)
+    int Cursor;                  // next message pulled by next()
+
+    quint64 Received;            // messages received
+
+    bool fill();
+
+    void decode();
+
+    void handshake();
+
+    void subscribe();
+
+    void control(const char *line, int size);
+
+    void sequence(qint64 seq);
+
+    void send(const QByteArray &command);
+};
+
+#endif // SCDMSGCLIENT_H
@@ -0,0 +1,359 @@
+/**
+ * @class  SCDMsgCommands - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: console commands registry
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         The console commands of message center, the commands registered by the application and the commands accepted
+ *         by each sender ('@<sender id> help') are kept into registries: the registry resolves the command, checks its
+ *         arguments and generates the help.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msgcommands.h"
+
+/**
+ * @brief SCDMsgCommands::add registers a command, replacing the command with the same name
+ * @param name command name (lower case)
+ * @param spec argument spec, e.g. "<sender id> [<rows:int>]"
+ * @param help
+ * @param id dispatch id
+ * @param handler application handler
+ * @param admin command reserved to the clients of an admin user
+ * @return false if spec is not valid
+ */
+bool SCDMsgCommands::add(QString name, QString spec, QString help, int id, SCDMsgCommandHandler handler, bool admin)
+{
+   QVector<Arg> args;
+
+   QString usage;
+
+   bool optional = false;
+
+   for (int n=0; n<spec.size(); n++)
+   {
+      QChar c = spec.at(n);
+
+      if (c=='[')
+      {
+         optional = true;
+      }
+      else
+      if (c==']')
+      {
+         optional = false;
+      }
+
+      if (c!='<')
+      {
+         usage += c;
+         continue;
+      }
+
+      int end = spec.indexOf('>',n);
+
+      if (end<0 || (!args.isEmpty() && args.last().type==Text)) // text must be the last argument
+      {
+         return false;
+      }
+
+      QString label = spec.mid(n+1,end-n-1);
+      QString type;
+
+      int colon = label.lastIndexOf(':');
+
+      if (colon>=0)
+      {
+         type  = label.mid(colon+1);
+         label = label.left(colon);
+      }
+
+      Arg arg;
+
+      arg.label    = label;
+      arg.optional = optional;
+
+      if (type.isEmpty())      arg.type = String;
+      else if (type=="int")    arg.type = Int;
+      else if (type=="long")   arg.type = Long;
+      else if (type=="switch") arg.type = Switch;
+      else if (type=="text")   arg.type = Text;
+      else
+      {
+         return false;
+      }
+
+      if (!optional && !args.isEmpty() && args.last().optional) // required arguments come first
+      {
+         return false;
+      }
+
+      args.append(arg);
+
+      usage += "<" + label + ">";
+
+      n = end;
+   }
+
+   Command command;
+
+   command.name    = name.toLower();
+   command.usage   = usage;
+   command.help    = help;
+   command.id      = id;
+   command.handler = handler;
+   command.admin   = admin;
+
+   QHash<QString,int>::const_iterator found = Index.constFind(command.name);
+
+   if (found!=Index.constEnd())
+   {
+      Commands.replace(found.value(),command);
+      Args.replace(found.value(),args);
+   }
+   else
+   {
+      Index.insert(command.name,Commands.size());
+
+      Commands.append(command);
+      Args.append(args);
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgCommands::remove
+ * @param name
+ * @return false if command not found
+ */
+bool SCDMsgCommands::remove(QString name)
+{
+   int n = Index.value(name.toLower(),-1);
+
+   if (n<0)
+   {
+      return false;
+   }
+
+   Commands.remove(n);
+   Args.remove(n);
+
+   Index.clear();
+
+   for (int i=0; i<Commands.size(); i++)
+   {
+      Index.insert(Commands.at(i).name,i);
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgCommands::clear
+ */
+void SCDMsgCommands::clear()
+{
+   Commands.clear();
+   Args.clear();
+   Index.clear();
+}
+
+/**
+ * @brief SCDMsgCommands::find
+ * @param name command name (lower case)
+ * @return command, 0 if not found
+ */
+const SCDMsgCommands::Command *SCDMsgCommands::find(const QString &name) const
+{
+   QHash<QString,int>::const_iterator found = Index.constFind(name);
+
+   return found!=Index.constEnd() ? &Commands.at(found.value()) : 0;
+}
+
+/**
+ * @brief SCDMsgCommands::parse checks the command arguments against their types. The arguments are separated by
+ *                              white space; a text argument is the rest of the line as typed (spaces preserved).
+ * @param command
+ * @param line arguments of command line (command name excluded)
+ * @param args receives the arguments
+ * @param error receives the error message
+ * @return false if arguments are missing, not valid or in excess
+ */
+bool SCDMsgCommands::parse(const Command *command, const QString &line, SCDMsgArgs *args, QString *error) const
+{
+   const QVector<Arg> &spec = Args.at(command - Commands.constData());
+
+   args->Values.clear();
+
+   int size = line.size();
+
+   while (size>0 && (line.at(size-1)=='\r' || line.at(size-1)=='\n')) // line terminator
+   {
+      size--;
+   }
+
+   int pos = 0;
+
+   for (int a=0; a<spec.size(); a++)
+   {
+      const Arg &arg = spec.at(a);
+
+      while (pos<size && line.at(pos).isSpace())
+      {
+         pos++;
+      }
+
+      if (pos>=size)
+      {
+         if (!arg.optional)
+         {
+            *error = "Usage: " + command->name + " " + command->usage;
+            return false;
+         }
+
+         break;
+      }
+
+      int start = pos;
+
+      while (pos<size && !line.at(pos).isSpace())
+      {
+         pos++;
+      }
+
+      QString value = line.mid(start,pos-start);
+
+      bool ok = true;
+
+      switch (arg.type)
+      {
+         case String:
+         break;
+
+         case Int:
+            value.toInt(&ok);
+         break;
+
+         case Long:
+            value.toLongLong(&ok);
+         break;
+
+         case Switch:
+            value = value.toLower();
+            ok    = value=="on" || value=="off";
+         break;
+
+         case Text:
+            value = line.mid(start,size-start);
+            pos   = size;
+         break;
+      }
+
+      if (!ok)
+      {
+         *error = "Invalid <" + arg.label + ">: " + value + " (usage: " + command->name + " " + command->usage + ")";
+         return false;
+      }
+
+      args->Values.append(value);
+   }
+
+   while (pos<size && line.at(pos).isSpace())
+   {
+      pos++;
+   }
+
+   if (pos<size)
+   {
+      *error = "Too many arguments: " + line.mid(pos,size-pos) + " (usage: " + command->name + " " + command->usage + ")";
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgCommands::help generates the help of registered commands
+ * @return
+ */
+QString SCDMsgCommands::help() const
+{
+   QString help;
+
+   for (int n=0; n<Commands.size(); n++)
+   {
+      const Command &command = Commands.at(n);
+
+      help += helpLine((command.name + " " + command.usage).trimmed(),command.help);
+   }
+
+   return help;
+}
+
+/**
+ * @brief SCDMsgCommands::helpLine formats a line of help
+ * @param syntax
+ * @param help
+ * @return
+ */
+QString SCDMsgCommands::helpLine(QString syntax, QString help)
+{
+   return "   - " + syntax.leftJustified(25) + " => " + help + "\n";
+}
+
+/**
+ * @brief SCDMsgCommands::skip
+ * @param line command line
+ * @param tokens number of leading tokens to skip
+ * @return the rest of line after the leading tokens, as typed
+ */
+QString SCDMsgCommands::skip(const QString &line, int tokens)
+{
+   int pos = 0;
+
+   for (int n=0; n<tokens; n++)
+   {
+      while (pos<line.size() && line.at(pos).isSpace())
+      {
+         pos++;
+      }
+
+      while (pos<line.size() && !line.at(pos).isSpace())
+      {
+         pos++;
+      }
+   }
+
+   return line.mid(pos);
+}
@@ -0,0 +1,108 @@
+#ifndef SCDMSGCOMMANDS_H
+#define SCDMSGCOMMANDS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+
+#include <functional>
+
+/**
+ * @brief The SCDMsgArgs class arguments of a console command, checked against the argument types of the command
+ */
+class SCDMsgArgs
+{
+  public:
+
+    int size() const {return Values.size();}
+
+    bool has(int n) const {return n<Values.size();}
+
+    QString value(int n, QString def = QString()) const {return n<Values.size() ? Values.at(n) : def;}
+
+    int toInt(int n, int def = 0) const {return n<Values.size() ? Values.at(n).toInt() : def;}
+
+    qint64 toLongLong(int n, qint64 def = 0) const {return n<Values.size() ? Values.at(n).toLongLong() : def;}
+
+    bool isOn(int n, bool def = false) const {return n<Values.size() ? Values.at(n)=="on" : def;}
+
+    QStringList values() const {return Values;}
+
+  private:
+
+    friend class SCDMsgCommands;
+
+    QStringList Values;
+};
+
+/**
+ * @brief SCDMsgCommandHandler application command handler: receives the arguments and the client socket descriptor,
+ *        returns the reply to client. It is called by message center thread with the message center locked: it must
+ *        return quickly and must not call back message center.
+ */
+typedef std::function<QString(const SCDMsgArgs &args, int clientSocketDescriptor)> SCDMsgCommandHandler;
+
+/**
+ * @brief The SCDMsgCommands class registry of console commands. A command is registered with an argument spec, e.g.
+ *        "<sender id> [<rows:int>]", which gives both the usage shown by help and the typed parsing of arguments:
+ *
+ *           <label>          required argument       [<label>]     optional argument
+ *           <label:int>      integer                 <label:long>  64 bit integer
+ *           <label:switch>   on|off                  <label:text>  rest of command line, as typed (last argument)
+ *
+ *        Commands are resolved by name with a single hash lookup, and help is generated in registration order.
+ *        Not thread safe: the message center uses it under its lock.
+ */
+class SCDMsgCommands
+{
+  public:
+
+    struct Command
+    {
+       QString name;
+       QString usage;                 // argument spec without types, shown by help
+       QString help;
+       int id;                        // dispatch id of built-in commands
+       SCDMsgCommandHandler handler;  // application commands
+       bool admin;                    // reserved to the clients of an admin user
+    };
+
+    bool add(QString name, QString spec, QString help, int id, SCDMsgCommandHandler handler = SCDMsgCommandHandler(),
+             bool admin = false);
+
+    bool remove(QString name);
+
+    void clear();
+
+    bool isEmpty() const {return Commands.isEmpty();}
+
+    const Command *find(const QString &name) const;
+
+    bool parse(const Command *command, const QString &line, SCDMsgArgs *args, QString *error) const;
+
+    QString help() const;
+
+    static QString helpLine(QString syntax, QString help);
+
+    static QString skip(const QString &line, int tokens);
+
+  private:
+
+    enum Type {String, Int, Long, Switch, Text};
+
+    struct Arg
+    {
+       QString label;
+       Type type;
+       bool optional;
+    };
+
+    QVector<Command> Commands;     // registration order
+
+    QVector<QVector<Arg> > Args;   // arguments of each command
+
+    QHash<QString,int> Index;      // command name => index
+};
+
+#endif // SCDMSGCOMMANDS_H
@@ -0,0 +1,522 @@
+/**
+ * @class  SCDMsgExec - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: remote execution of allowed commands
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         Opt-in: the application allows the commands which can be run by the clients (SCDMsgCenter::allowExec). The
+ *         console command 'exec <name> [<args>]' runs the command as a child process (no shell is involved), and its
+ *         output is streamed to the client as it arrives, through a temporary sender 'exec.<n>'. The output follows
+ *         the normal path of the sender messages, and the pipes are paused while the client has a backlog.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msgexec.h"
+#include "msgcenter.h"
+#include "msgtail.h"
+
+#include <QFile>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+/**
+ * @brief SCDMsgExec::SCDMsgExec
+ * @param mc message center
+ */
+SCDMsgExec::SCDMsgExec(SCDMsgCenter *mc) : QObject(mc), mc(mc)
+{
+   Buffer.resize(ReadSize);
+
+   Timer = new QTimer(this);
+
+   Timer->setInterval(20);
+
+   connect(Timer,SIGNAL(timeout()),this,SLOT(poll()));
+}
+
+/**
+ * @brief SCDMsgExec::~SCDMsgExec kills the running processes
+ */
+SCDMsgExec::~SCDMsgExec()
+{
+   for (int n=0; n<Processes.size(); n++)
+   {
+      Process *process = Processes.at(n);
+
+      ::kill(process->pid,SIGKILL);
+
+      closePipe(process,0);
+      closePipe(process,1);
+
+      ::waitpid(process->pid,0,0);
+
+      delete process;
+   }
+}
+
+/**
+ * @brief SCDMsgExec::allow allows a command
+ * @param name name used by 'exec' command
+ * @param program program path (searched into PATH if it has no '/')
+ * @param args fixed arguments
+ * @param argPattern each argument appended by the user must match it entirely (empty: no user arguments)
+ * @param options the user arguments can start with '-'
+ */
+void SCDMsgExec::allow(QString name, QString program, QStringList args, QString argPattern, bool options)
+{
+   Command command;
+
+   command.program = program;
+   command.args    = args;
+   command.options = options;
+
+   if (!argPattern.isEmpty())
+   {
+      command.argPattern.setPattern("\\A(?:" + argPattern + ")\\z");
+   }
+
+   Commands.insert(name,command);
+}
+
+/**
+ * @brief SCDMsgExec::allowed
+ * @return names of allowed commands
+ */
+QStringList SCDMsgExec::allowed() const
+{
+   QStringList names = Commands.keys();
+
+   names.sort();
+
+   return names;
+}
+
+/**
+ * @brief SCDMsgExec::check checks the command and each user argument against the pattern of the command. The
+ *                         arguments starting with '-' are refused unless the command allows options, so a client
+ *                         cannot inject options (e.g. '-exec', '--output=<path>') into an allowed command.
+ * @param name
+ * @param args user arguments
+ * @return the error, empty if the command can be run
+ */
+QString SCDMsgExec::check(QString name, QString args) const
+{
+   QHash<QString,Command>::const_iterator command = Commands.constFind(name);
+
+   if (command==Commands.constEnd())
+   {
+      return "Command not allowed: " + name;
+   }
+
+   QStringList list = args.split(' ',QString::SkipEmptyParts);
+
+   if (list.isEmpty())
+   {
+      return QString();
+   }
+
+   if (command.value().argPattern.pattern().isEmpty() || !command.value().argPattern.isValid())
+   {
+      return "Command " + name + " does not accept arguments";
+   }
+
+   for (int n=0; n<list.size(); n++)
+   {
+      const QString &arg = list.at(n);
+
+      if (arg.startsWith('-') && !command.value().options)
+      {
+         return "Option not allowed: " + arg;
+      }
+
+      if (!command.value().argPattern.match(arg).hasMatch())
+      {
+         return "Invalid argument: " + arg;
+      }
+   }
+
+   return QString();
+}
+
+/**
+ * @brief SCDMsgExec::start runs an allowed command. The sender is registered and spied by the client before the call.
+ * @param name
+ * @param args user arguments, split on spaces
+ * @param sender temporary sender of command output, removed at process exit
+ * @param clientSocketDescriptor requesting client
+ */
+void SCDMsgExec::start(QString name, QString args, QString sender, int clientSocketDescriptor)
+{
+   QString error = Processes.size()>=MaxProcesses ? QString("Too many running commands") : check(name,args);
+
+   if (!error.isEmpty())
+   {
+      mc->postMessage(error,sender);
+      mc->removeSender(sender);
+      return;
+   }
+
+   const Command command = Commands.value(name);
+
+   QList<QByteArray> argv;
+
+   argv.append(QFile::encodeName(command.program));
+
+   QStringList list = command.args;
+
+   list.append(args.split(' ',QString::SkipEmptyParts));
+
+   for (int n=0; n<list.size(); n++)
+   {
+      argv.append(list.at(n).toLocal8Bit());
+   }
+
+   QVector<char*> pointers; // prepared before fork: the child only calls async signal safe functions
+
+   for (int n=0; n<argv.size(); n++)
+   {
+      pointers.append(argv[n].data());
+   }
+
+   pointers.append(0);
+
+   int out[2], err[2];
+
+   int devnull = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+   if (devnull<0 || ::pipe2(out,O_CLOEXEC)<0)
+   {
+      mc->postMessage(QString("Unable to start: ") + strerror(errno),sender);
+      mc->removeSender(sender);
+
+      if (devnull>=0)
+      {
+         ::close(devnull);
+      }
+
+      return;
+   }
+
+   if (::pipe2(err,O_CLOEXEC)<0)
+   {
+      mc->postMessage(QString("Unable to start: ") + strerror(errno),sender);
+      mc->removeSender(sender);
+
+      ::close(devnull);
+      ::close(out[0]);
+      ::close(out[1]);
+
+      return;
+   }
+
+   pid_t pid = ::fork();
+
+   if (pid==0) // child
+   {
+      ::dup2(devnull,0);
+      ::dup2(out[1],1);
+      ::dup2(err[1],2);
+
+      ::execvp(pointers.at(0),pointers.data());
+
+      ::_exit(127);
+   }
+
+   ::close(devnull);
+   ::close(out[1]);
+   ::close(err[1]);
+
+   if (pid<0)
+   {
+      mc->postMessage(QString("Unable to start: ") + strerror(errno),sender);
+      mc->removeSender(sender);
+
+      ::close(out[0]);
+      ::close(err[0]);
+
+      return;
+   }
+
+   Process *process = new Process();
+
+   process->pid    = pid;
+   process->sender = sender;
+   process->client = clientSocketDescriptor;
+   process->fds[0] = out[0];
+   process->fds[1] = err[0];
+   process->paused = false;
+
+   for (int n=0; n<2; n++)
+   {
+      ::fcntl(process->fds[n],F_SETFL,::fcntl(process->fds[n],F_GETFL) | O_NONBLOCK);
+
+      process->notifiers[n] = new QSocketNotifier(process->fds[n],QSocketNotifier::Read,this);
+
+      connect(process->notifiers[n],SIGNAL(activated(int)),this,SLOT(readable(int)));
+   }
+
+   Processes.append(process);
+
+   QString line = list.isEmpty() ? command.program : command.program + " " + list.join(" ");
+
+   mc->postMessage("Started: " + line + " (pid " + QString::number(pid) + ")",sender);
+
+   Timer->start();
+}
+
+/**
+ * @brief SCDMsgExec::readable reads a pipe of a process and posts its complete lines
+ * @param fd
+ */
+void SCDMsgExec::readable(int fd)
+{
+   int stream;
+
+   Process *process = find(fd,&stream);
+
+   if (!process)
+   {
+      return;
+   }
+
+   qint64 total = 0;
+
+   while (total<MaxRead)
+   {
+      ssize_t size = ::read(fd, Buffer.data(), Buffer.size());
+
+      if (size>0)
+      {
+         post(process,stream,Buffer.constData(),size,false);
+
+         total += size;
+
+         continue;
+      }
+
+      if (size<0 && (errno==EINTR))
+      {
+         continue;
+      }
+
+      if (size<0 && errno==EAGAIN)
+      {
+         break;
+      }
+
+      post(process,stream,0,0,true); // end of output
+
+      closePipe(process,stream);
+
+      break;
+   }
+
+   qint64 backlog = mc->clientBacklog(process->client);
+
+   if (backlog<0) // the client has left: the process is terminated
+   {
+      ::kill(process->pid,SIGTERM);
+
+      closePipe(process,0);
+      closePipe(process,1);
+   }
+   else
+   if (backlog>MaxBacklog)
+   {
+      setPaused(process,true);
+   }
+}
+
+/**
+ * @brief SCDMsgExec::poll resumes the processes whose client has received its backlog, and reaps the exited processes
+ */
+void SCDMsgExec::poll()
+{
+   for (int n=Processes.size()-1; n>=0; n--)
+   {
+      Process *process = Processes.at(n);
+
+      if (process->paused)
+      {
+         qint64 backlog = mc->clientBacklog(process->client);
+
+         if (backlog<0)
+         {
+            ::kill(process->pid,SIGTERM);
+
+            closePipe(process,0);
+            closePipe(process,1);
+         }
+         else
+         if (backlog<MaxBacklog/2)
+         {
+            setPaused(process,false);
+         }
+      }
+
+      if (process->fds[0]<0 && process->fds[1]<0 && reap(process))
+      {
+         Processes.remove(n);
+
+         delete process;
+      }
+   }
+
+   if (Processes.isEmpty())
+   {
+      Timer->stop();
+   }
+}
+
+/**
+ * @brief SCDMsgExec::find
+ * @param fd
+ * @param stream receives 0 for stdout, 1 for stderr
+ * @return process reading from fd, 0 if not found
+ */
+SCDMsgExec::Process *SCDMsgExec::find(int fd, int *stream)
+{
+   for (int n=0; n<Processes.size(); n++)
+   {
+      for (int s=0; s<2; s++)
+      {
+         if (Processes.at(n)->fds[s]==fd)
+         {
+            *stream = s;
+
+            return Processes.at(n);
+         }
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * @brief SCDMsgExec::closePipe
+ * @param process
+ * @param stream
+ */
+void SCDMsgExec::closePipe(Process *process, int stream)
+{
+   if (process->fds[stream]<0)
+   {
+      return;
+   }
+
+   process->notifiers[stream]->setEnabled(false);
+   process->notifiers[stream]->deleteLater(); // the pipe can be closed by its own notification
+
+   ::close(process->fds[stream]);
+
+   process->fds[stream] = -1;
+}
+
+/**
+ * @brief SCDMsgExec::post splits the data read from a pipe into lines, and posts the complete lines as a batch
+ * @param process
+ * @param stream 0: stdout, 1: stderr (lines are prefixed by 'stderr: ')
+ * @param data
+ * @param size
+ * @param flush posts also the last incomplete line
+ */
+void SCDMsgExec::post(Process *process, int stream, const char *data, int size, bool flush)
+{
+   QStringList lines;
+
+   SCDMsgFileTail::splitLines(&process->partial[stream],data,size,flush,&lines,stream ? "stderr: " : "");
+
+   if (!lines.isEmpty())
+   {
+      mc->postMessages(process->sender,lines);
+   }
+}
+
+/**
+ * @brief SCDMsgExec::setPaused stops or restarts reading the pipes of a process
+ * @param process
+ * @param paused
+ */
+void SCDMsgExec::setPaused(Process *process, bool paused)
+{
+   process->paused = paused;
+
+   for (int s=0; s<2; s++)
+   {
+      if (process->fds[s]>=0)
+      {
+         process->notifiers[s]->setEnabled(!paused);
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgExec::reap collects the exit status of a process whose pipes are closed
+ * @param process
+ * @return false if the process is still running
+ */
+bool SCDMsgExec::reap(Process *process)
+{
+   int status = 0;
+
+   pid_t pid = ::waitpid(process->pid,&status,WNOHANG);
+
+   if (pid==0)
+   {
+      return false;
+   }
+
+   if (pid<0) // already reaped (SIGCHLD ignored by application)
+   {
+      mc->postMessage("Exited",process->sender);
+   }
+   else
+   if (WIFEXITED(status))
+   {
+      mc->postMessage("Exit status " + QString::number(WEXITSTATUS(status)),process->sender);
+   }
+   else
+   {
+      mc->postMessage("Terminated by signal " + QString::number(WTERMSIG(status)),process->sender);
+   }
+
+   mc->removeSender(process->sender);
+
+   return true;
+}
@@ -0,0 +1,97 @@
+#ifndef SCDMSGEXEC_H
+#define SCDMSGEXEC_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QRegularExpression>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <sys/types.h>
+
+class SCDMsgCenter;
+
+/**
+ * @brief The SCDMsgExec class runs the commands allowed by the application as child processes (console command
+ *        'exec'). The stdout and stderr of each process are read through non blocking pipes and posted line by line
+ *        to a temporary sender, spied by the requesting client. When the output queued for the client exceeds
+ *        MaxBacklog the pipes are no longer read, so a fast process is blocked by the full pipe until the client
+ *        has received its output.
+ *        Lives into the message center thread.
+ */
+class SCDMsgExec : public QObject
+{
+    Q_OBJECT
+
+  public:
+
+    explicit SCDMsgExec(SCDMsgCenter *mc);
+
+    ~SCDMsgExec();
+
+    void allow(QString name, QString program, QStringList args, QString argPattern, bool options);
+
+    QStringList allowed() const;
+
+    QString check(QString name, QString args) const; // empty if the command can be run
+
+  public slots:
+
+    void start(QString name, QString args, QString sender, int clientSocketDescriptor);
+
+  private slots:
+
+    void readable(int fd);
+
+    void poll();
+
+  private:
+
+    struct Command
+    {
+       QString program;
+       QStringList args;
+       QRegularExpression argPattern; // each user argument must match it entirely (empty: no user arguments)
+       bool options;                  // user arguments can start with '-'
+    };
+
+    struct Process
+    {
+       pid_t pid;
+       QString sender;                 // temporary sender of process output
+       int client;                     // requesting client socket descriptor
+       int fds[2];                     // stdout and stderr pipes (-1: closed)
+       QSocketNotifier *notifiers[2];
+       QByteArray partial[2];          // last incomplete line of each pipe
+       bool paused;                    // client backlog exceeded: pipes are not read
+    };
+
+    static const int MaxProcesses = 8;       // running processes
+    static const int MaxBacklog = 1048576;   // bytes queued for the client over which the pipes are paused
+    static const int ReadSize = 65536;       // bytes read by each read call
+    static const int MaxRead = 262144;       // bytes read for each readiness notification (fairness among processes)
+
+    SCDMsgCenter *mc;
+
+    QHash<QString,Command> Commands;    // allowed commands
+
+    QVector<Process*> Processes;        // running processes
+
+    QTimer *Timer;                      // resumes paused processes and reaps the exited ones
+
+    QByteArray Buffer;                  // read buffer, reused by all the reads
+
+    Process *find(int fd, int *stream);
+
+    void closePipe(Process *process, int stream);
+
+    void post(Process *process, int stream, const char *data, int size, bool flush);
+
+    void setPaused(Process *process, bool paused);
+
+    bool reap(Process *process);
+};
+
+#endif // SCDMSGEXEC_H
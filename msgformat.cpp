@@ -0,0 +1,536 @@
+/**
+ * @class  SCDMsgFormat - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: output formats of client messages
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         The log shippers read the messages as JSON Lines ('format jsonl'): one object for each message, with the
+ *         sender, the post time, the level, the sequence number and the text. The text is escaped scanning 16 bytes at
+ *         a time (SSE2): the spans without characters to escape are copied in bulk. The object prefix of each sender
+ *         and the timestamp of the current second are encoded once and cached.
+ *
+ *         The consoles choose the layout of their lines by a template ('format "%T %S[%L] %M"'), compiled once into a
+ *         sequence of copy and emit ops. The clients which use the same template share the same format, so the
+ *         message is encoded once for all of them.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *
+*/
+
+#include "msgformat.h"
+
+#include <string.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char *LevelNames[5] = {"debug", "info", "warning", "error", "critical"}; // see SCDMsgCenter::Level
+
+static const char *LevelColors[5] = {"\033[2m", "\033[0m", "\033[33m", "\033[31m", "\033[1;31m"}; // ANSI, by level
+
+static const int MaxPrefixes = 4096; // cached sender prefixes (the cache is cleared when full)
+
+/**
+ * @brief SCDMsgFormat::compile
+ * @param spec 'jsonl', or a template (can be enclosed by double quotes)
+ * @param error receives the error
+ * @return the format (owned by caller), 0 if spec is not valid
+ */
+SCDMsgFormat *SCDMsgFormat::compile(QString spec, QString *error)
+{
+   spec = spec.trimmed();
+
+   if (spec.toLower()=="jsonl")
+   {
+      return new SCDMsgFormat(Jsonl,"jsonl");
+   }
+
+   if (spec.size()>=2 && spec.startsWith('"') && spec.endsWith('"'))
+   {
+      spec = spec.mid(1,spec.size()-2);
+   }
+
+   if (!spec.contains('%'))
+   {
+      *error = "Invalid format: " + spec;
+      return 0;
+   }
+
+   SCDMsgFormat *format = new SCDMsgFormat(Template,spec);
+
+   QByteArray text = spec.toUtf8();
+
+   QByteArray literal;
+
+   for (int n=0; n<text.size(); n++)
+   {
+      char c = text.at(n);
+
+      if (c!='%' || n==text.size()-1)
+      {
+         literal += c;
+         continue;
+      }
+
+      c = text.at(++n);
+
+      if (c=='%')
+      {
+         literal += c;
+         continue;
+      }
+
+      Op op;
+
+      switch (c)
+      {
+         case 'T': op.code = Time;   break;
+         case 'S': op.code = Sender; break;
+         case 'L': op.code = Level;  break;
+         case 'N': op.code = Seq;    break;
+         case 'M': op.code = Text;   break;
+         case 'C': op.code = Color;  break;
+         case 'R': op.code = Reset;  break;
+
+         default:
+         {
+            *error = "Invalid template field: %" + QString(QChar(c)) + " (fields: %T %S %L %N %M %C %R %%)";
+
+            delete format;
+
+            return 0;
+         }
+      }
+
+      if (!literal.isEmpty()) // adjacent literal characters are copied by a single op
+      {
+         Op copy;
+
+         copy.code = Copy;
+         copy.text = literal;
+
+         format->Ops.append(copy);
+
+         literal.clear();
+      }
+
+      format->Ops.append(op);
+   }
+
+   literal += '\n'; // a line for each message
+
+   Op copy;
+
+   copy.code = Copy;
+   copy.text = literal;
+
+   format->Ops.append(copy);
+
+   return format;
+}
+
+/**
+ * @brief SCDMsgFormat::levelName
+ * @param level message level (see SCDMsgCenter::Level)
+ * @return
+ */
+const char *SCDMsgFormat::levelName(int level)
+{
+   return level>=0 && level<5 ? LevelNames[level] : LevelNames[1];
+}
+
+/**
+ * @brief SCDMsgFormat::encode encodes a message, or a batch of messages, of a sender
+ * @param sender
+ * @param msg message as posted to message center: '\n<sender>: <text>' for each message of the batch
+ * @param count number of messages
+ * @param seq sequence number of the (last) message (0: none)
+ * @param level message level (see SCDMsgCenter::Level)
+ * @param time post time (ms since epoch)
+ * @param cache encoding state of the calling thread
+ * @return
+ */
+QByteArray SCDMsgFormat::encode(const QString &sender, const QString &msg, int count, qint64 seq, int level, qint64 time,
+                                SCDMsgFormatCache *cache) const
+{
+   QByteArray bytes = msg.toUtf8(); // once for the whole batch
+
+   Fields fields;
+
+   fields.sender = sender.toUtf8();
+   fields.prefix = 0;
+   fields.stamp  = &timestamp(time,cache);
+   fields.level  = level;
+
+   int ms = time % 1000;
+
+   fields.millis[0] = '0' + ms/100;
+   fields.millis[1] = '0' + ms/10%10;
+   fields.millis[2] = '0' + ms%10;
+   fields.millis[3] = 'Z';
+
+   if (type==Jsonl)
+   {
+      QHash<QString,QByteArray>::const_iterator found = cache->prefixes.constFind(sender);
+
+      if (found==cache->prefixes.constEnd())
+      {
+         if (cache->prefixes.size()>=MaxPrefixes)
+         {
+            cache->prefixes.clear();
+         }
+
+         QByteArray prefix = "{\"sender\":\"";
+
+         escapeJson(&prefix,fields.sender.constData(),fields.sender.size());
+
+         prefix += "\",\"time\":\"";
+
+         found = cache->prefixes.insert(sender,prefix);
+      }
+
+      fields.prefix = &found.value();
+   }
+
+   QByteArray separator = "\n" + fields.sender + ": "; // header of each message of a batch
+
+   QByteArray out;
+
+   out.reserve(bytes.size() + bytes.size()/8 + count*(fields.sender.size() + fields.stamp->size() + 64));
+
+   const char *p   = bytes.constData();
+   const char *end = p + bytes.size();
+
+   if (p<end && *p=='\n')
+   {
+      p++;
+   }
+
+   if (end-p>=separator.size()-1 && memcmp(p, separator.constData() + 1, separator.size() - 1)==0)
+   {
+      p += separator.size() - 1;
+   }
+
+   for (int n=0; n<count; n++)
+   {
+      int next = n==count-1 ? -1 : bytes.indexOf(separator, p - bytes.constData());
+
+      const char *stop = next<0 ? end : bytes.constData() + next;
+
+      qint64 number = seq>0 ? seq - count + 1 + n : 0;
+
+      if (type==Jsonl)
+      {
+         appendJson(&out,fields,p,stop - p,number);
+      }
+      else
+      {
+         appendTemplate(&out,fields,p,stop - p,number);
+      }
+
+      if (next<0)
+      {
+         break;
+      }
+
+      p = stop + separator.size();
+   }
+
+   return out;
+}
+
+/**
+ * @brief SCDMsgFormat::encodeGap encodes the gap marker of a resumed session, which no message can reproduce:
+ *                                a JSON object with the field 'gap' instead of 'text', or the control line
+ *                                '#gap <first> <last> <sender>' of the console format for a template
+ * @param sender
+ * @param first first evicted sequence number
+ * @param last last evicted sequence number
+ * @return
+ */
+QByteArray SCDMsgFormat::encodeGap(const QString &sender, qint64 first, qint64 last) const
+{
+   QByteArray name = sender.toUtf8();
+
+   QByteArray out;
+
+   if (type==Jsonl)
+   {
+      out.append("{\"sender\":\"",11);
+
+      escapeJson(&out,name.constData(),name.size());
+
+      out.append("\",\"gap\":{\"first\":",17);
+
+      appendNumber(&out,first);
+
+      out.append(",\"last\":",8);
+
+      appendNumber(&out,last);
+
+      out.append("}}\n",3);
+   }
+   else
+   {
+      out.append("#gap ",5);
+
+      appendNumber(&out,first);
+
+      out.append(' ');
+
+      appendNumber(&out,last);
+
+      out.append(' ');
+      out.append(name);
+      out.append('\n');
+   }
+
+   return out;
+}
+
+/**
+ * @brief SCDMsgFormat::appendJson appends the JSON object of a message
+ * @param out
+ * @param fields
+ * @param text
+ * @param size
+ * @param seq sequence number of message (0: none)
+ */
+void SCDMsgFormat::appendJson(QByteArray *out, const Fields &fields, const char *text, int size, qint64 seq) const
+{
+   const char *name = levelName(fields.level);
+
+   out->append(*fields.prefix);
+   out->append(*fields.stamp);
+   out->append(fields.millis,4);
+   out->append("\",\"level\":\"",11);
+   out->append(name,strlen(name));
+   out->append('"');
+
+   if (seq>0)
+   {
+      out->append(",\"seq\":",7);
+
+      appendNumber(out,seq);
+   }
+
+   out->append(",\"text\":\"",9);
+
+   escapeJson(out,text,size);
+
+   out->append("\"}\n",3);
+}
+
+/**
+ * @brief SCDMsgFormat::appendTemplate appends the line of a message, running the ops of the compiled template
+ * @param out
+ * @param fields
+ * @param text
+ * @param size
+ * @param seq sequence number of message (0: none, the field is empty)
+ */
+void SCDMsgFormat::appendTemplate(QByteArray *out, const Fields &fields, const char *text, int size, qint64 seq) const
+{
+   for (int n=0; n<Ops.size(); n++)
+   {
+      const Op &op = Ops.at(n);
+
+      switch (op.code)
+      {
+         case Copy:
+            out->append(op.text);
+         break;
+
+         case Time:
+            out->append(*fields.stamp);
+            out->append(fields.millis,4);
+         break;
+
+         case Sender:
+            out->append(fields.sender);
+         break;
+
+         case Level:
+            out->append(levelName(fields.level));
+         break;
+
+         case Seq:
+            if (seq>0)
+            {
+               appendNumber(out,seq);
+            }
+         break;
+
+         case Text:
+            out->append(text,size);
+         break;
+
+         case Color:
+            out->append(LevelColors[fields.level>=0 && fields.level<5 ? fields.level : 1]);
+         break;
+
+         case Reset:
+            out->append("\033[0m");
+         break;
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgFormat::escapeJson appends a JSON string body. The text is scanned 16 bytes at a time for quotes,
+ *                                 backslashes and control characters: the clean spans are appended in bulk, and
+ *                                 only the bytes found are escaped one by one.
+ * @param out
+ * @param data UTF-8 text
+ * @param size
+ */
+void SCDMsgFormat::escapeJson(QByteArray *out, const char *data, int size)
+{
+   static const char Hex[] = "0123456789abcdef";
+
+   const char *p    = data;
+   const char *end  = data + size;
+   const char *span = data; // first byte not yet appended
+
+   while (true)
+   {
+#ifdef __SSE2__
+      const __m128i quote     = _mm_set1_epi8('"');
+      const __m128i backslash = _mm_set1_epi8('\\');
+      const __m128i control   = _mm_set1_epi8(0x1F);
+
+      while (end-p>=16) // the bytes <= 0x1F are those unchanged by max(byte,0x1F)
+      {
+         __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+
+         __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk,quote),_mm_cmpeq_epi8(chunk,backslash)),
+                                        _mm_cmpeq_epi8(_mm_max_epu8(chunk,control),control));
+
+         int mask = _mm_movemask_epi8(special);
+
+         if (mask)
+         {
+            p += __builtin_ctz(mask);
+            break;
+         }
+
+         p += 16;
+      }
+#endif
+
+      while (p<end && *p!='"' && *p!='\\' && (unsigned char)*p>=0x20) // tail, or whole text without SSE2
+      {
+         p++;
+      }
+
+      if (p==end)
+      {
+         break;
+      }
+
+      unsigned char c = *p;
+
+      out->append(span, p - span);
+
+      switch (c)
+      {
+         case '"':  out->append("\\\"",2); break;
+         case '\\': out->append("\\\\",2); break;
+         case '\n': out->append("\\n",2);  break;
+         case '\r': out->append("\\r",2);  break;
+         case '\t': out->append("\\t",2);  break;
+
+         default:
+         {
+            char escaped[6] = {'\\', 'u', '0', '0', Hex[c >> 4], Hex[c & 15]};
+
+            out->append(escaped,6);
+         }
+      }
+
+      span = ++p;
+   }
+
+   out->append(span, end - span);
+}
+
+/**
+ * @brief SCDMsgFormat::timestamp returns the ISO 8601 UTC date and time of a second, formatted once for each second
+ * @param time ms since epoch
+ * @param cache
+ * @return 'YYYY-MM-DDTHH:MM:SS.'
+ */
+const QByteArray &SCDMsgFormat::timestamp(qint64 time, SCDMsgFormatCache *cache)
+{
+   qint64 second = time / 1000;
+
+   if (second!=cache->second)
+   {
+      time_t t = second;
+
+      struct tm tm;
+
+      gmtime_r(&t,&tm);
+
+      char text[32];
+
+      int size = snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02d.", tm.tm_year + 1900, tm.tm_mon + 1,
+                          tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+      cache->stamp  = QByteArray(text,size);
+      cache->second = second;
+   }
+
+   return cache->stamp;
+}
+
+/**
+ * @brief SCDMsgFormat::appendNumber appends the decimal digits of a non negative number
+ * @param out
+ * @param value
+ */
+void SCDMsgFormat::appendNumber(QByteArray *out, qint64 value)
+{
+   char digits[24];
+
+   int n = sizeof(digits);
+
+   do
+   {
+      digits[--n] = '0' + value % 10;
+      value /= 10;
+   }
+   while (value>0);
+
+   out->append(digits + n, sizeof(digits) - n);
+}
@@ -0,0 +1,100 @@
+#ifndef SCDMSGFORMAT_H
+#define SCDMSGFORMAT_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+/**
+ * @brief The SCDMsgFormatCache struct the encoding state reused between the messages: the encoded prefix of each
+ *        sender and the timestamp of the current second. Not thread safe: the message center keeps one for each
+ *        shard, under the shard lock.
+ */
+struct SCDMsgFormatCache
+{
+   QHash<QString,QByteArray> prefixes; // sender => encoded object prefix
+
+   qint64 second = -1;                 // second of cached timestamp
+   QByteArray stamp;                   // 'YYYY-MM-DDTHH:MM:SS.' of second
+};
+
+/**
+ * @brief The SCDMsgFormat class an output format of the messages sent to a client, selected by 'format' command.
+ *        The console format is the raw message ('\n<sender>: <text>', see SCDMsgThreadHandler::frame) and has no
+ *        format object. The jsonl format writes a JSON object for each message, terminated by LF:
+ *
+ *           {"sender":"<sender>","time":"<ISO 8601 UTC>","level":"<level>","seq":<seq>,"text":"<text>"}
+ *
+ *        A template writes a line for each message, whose fields are given by:
+ *
+ *           %T time (ISO 8601 UTC), %S sender, %L level, %N sequence number, %M text, %C color of level (ANSI),
+ *           %R color reset, %% percent sign
+ *
+ *        e.g. '%T %S[%L] %M'. The template is compiled once into a sequence of copy and emit ops.
+ *
+ *        A message (or a batch) is encoded once for all the subscribers with the same format. A format is immutable
+ *        after compile, so it can be shared by any number of clients and threads.
+ */
+class SCDMsgFormat
+{
+  public:
+
+    enum Type {Jsonl, Template};
+
+    static SCDMsgFormat *compile(QString spec, QString *error);
+
+    QString spec() const {return Spec;}
+
+    QByteArray encode(const QString &sender, const QString &msg, int count, qint64 seq, int level, qint64 time,
+                      SCDMsgFormatCache *cache) const;
+
+    QByteArray encodeGap(const QString &sender, qint64 first, qint64 last) const;
+
+    static void escapeJson(QByteArray *out, const char *data, int size);
+
+    static const char *levelName(int level);
+
+  private:
+
+    /**
+     * @brief The OpCode enum template ops: copy a literal, or emit a field of the message
+     */
+    enum OpCode {Copy, Time, Sender, Level, Seq, Text, Color, Reset};
+
+    struct Op
+    {
+       int code;
+       QByteArray text; // literal of Copy
+    };
+
+    /**
+     * @brief The Fields struct the fields shared by the messages of a batch
+     */
+    struct Fields
+    {
+       QByteArray sender;        // UTF-8 sender id
+       const QByteArray *prefix; // jsonl object prefix of sender
+       const QByteArray *stamp;  // 'YYYY-MM-DDTHH:MM:SS.' of post time
+       char millis[4];           // 'mmmZ' of post time
+       int level;
+    };
+
+    SCDMsgFormat(int type, QString spec) : type(type), Spec(spec) {}
+
+    int type;
+
+    QString Spec; // normalized format (template without quotes)
+
+    QVector<Op> Ops; // compiled template
+
+    void appendJson(QByteArray *out, const Fields &fields, const char *text, int size, qint64 seq) const;
+
+    void appendTemplate(QByteArray *out, const Fields &fields, const char *text, int size, qint64 seq) const;
+
+    static const QByteArray &timestamp(qint64 time, SCDMsgFormatCache *cache);
+
+    static void appendNumber(QByteArray *out, qint64 value);
+};
+
+#endif // SCDMSGFORMAT_H
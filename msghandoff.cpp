@@ -0,0 +1,443 @@
+/**
+ * @class  SCDMsgHandoff - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center Server: handoff to a restarted process
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         A restart of the application closes the listening port and drops every monitoring connection. With handoff
+ *         enabled (SCDMsgServer::enableHandoff) the outgoing process listens on a unix socket. The new process connects
+ *         to it before starting its server (SCDMsgServer::takeOver), and receives:
+ *
+ *            - the listening socket and the client sockets, passed by SCM_RIGHTS: the port is never closed and the
+ *              client connections are not interrupted
+ *            - the message center state, serialized over the same socket (see SCDMsgCenter::handOff)
+ *
+ *         Protocol: a header with number of descriptors and state size, the descriptors in messages of up to MaxFds
+ *         (one byte of payload each), then the state.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msghandoff.h"
+#include "msgserver.h"
+
+#include <QFile>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+/**
+ * @brief SCDMsgHandoff::SCDMsgHandoff
+ * @param server server handed off
+ */
+SCDMsgHandoff::SCDMsgHandoff(SCDMsgServer *server) : QObject(server), server(server), ListenFd(-1), PeerUid(-1), Notifier(0)
+{
+}
+
+/**
+ * @brief SCDMsgHandoff::~SCDMsgHandoff
+ */
+SCDMsgHandoff::~SCDMsgHandoff()
+{
+   if (ListenFd>=0)
+   {
+      delete Notifier;
+
+      ::close(ListenFd);
+      ::unlink(QFile::encodeName(Path).constData());
+   }
+}
+
+/**
+ * @brief SCDMsgHandoff::listen waits for the successor process on a unix socket. The socket is accessible only by
+ *                              the owner, and only a successor run by the expected user is handed off (the listening
+ *                              socket, the client connections and the session tokens are passed).
+ * @param path
+ * @param peerUid user of the successor process (-1: user of this process)
+ * @return
+ */
+bool SCDMsgHandoff::listen(QString path, int peerUid)
+{
+   QByteArray name = QFile::encodeName(path);
+
+   sockaddr_un addr;
+
+   memset(&addr,0,sizeof(addr));
+
+   if (name.size() >= int(sizeof(addr.sun_path)))
+   {
+      return false;
+   }
+
+   addr.sun_family = AF_UNIX;
+
+   memcpy(addr.sun_path,name.constData(),name.size());
+
+   int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   if (fd<0)
+   {
+      return false;
+   }
+
+   struct stat st;
+
+   if (::lstat(name.constData(),&st)==0 && S_ISSOCK(st.st_mode)) // left by a crashed process: only a socket is replaced
+   {
+      ::unlink(name.constData());
+   }
+
+   if (::bind(fd,(sockaddr*)&addr,sizeof(addr))<0)
+   {
+      ::close(fd);
+      return false;
+   }
+
+   if (::chmod(name.constData(),0600)<0 || ::listen(fd,1)<0) // owner only, before any connection can be accepted
+   {
+      ::close(fd);
+      ::unlink(name.constData());
+      return false;
+   }
+
+   Path     = path;
+   ListenFd = fd;
+   PeerUid  = peerUid;
+
+   Notifier = new QSocketNotifier(ListenFd,QSocketNotifier::Read);
+
+   connect(Notifier,SIGNAL(activated(int)),this,SLOT(incoming()));
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgHandoff::incoming the successor is connected: hands off the server
+ */
+void SCDMsgHandoff::incoming()
+{
+   int channel = ::accept4(ListenFd, 0, 0, SOCK_CLOEXEC);
+
+   if (channel<0)
+   {
+      return;
+   }
+
+   if (!trusted(channel,PeerUid)) // a process of another user
+   {
+      ::close(channel);
+      return;
+   }
+
+   timeval timeout = {Timeout/1000, (Timeout%1000)*1000};
+
+   ::setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+   bool done = server->handOff(channel);
+
+   ::close(channel);
+
+   if (done)
+   {
+      Notifier->setEnabled(false);
+
+      emit handedOff();
+   }
+}
+
+/**
+ * @brief SCDMsgHandoff::send sends the descriptors and the state to the successor
+ * @param channel unix socket connected to successor
+ * @param fds descriptors (listening socket first)
+ * @param state
+ * @return
+ */
+bool SCDMsgHandoff::send(int channel, const QVector<int> &fds, const QByteArray &state)
+{
+   quint32 header[2] = {quint32(fds.size()), quint32(state.size())};
+
+   if (!writeAll(channel,(const char*)header,sizeof(header)))
+   {
+      return false;
+   }
+
+   for (int from=0; from<fds.size(); from+=MaxFds)
+   {
+      int count = qMin(MaxFds, fds.size() - from);
+
+      char byte = 0;
+
+      iovec iov;
+
+      iov.iov_base = &byte;
+      iov.iov_len  = 1;
+
+      QByteArray control(CMSG_SPACE(count * sizeof(int)),0);
+
+      msghdr msg;
+
+      memset(&msg,0,sizeof(msg));
+
+      msg.msg_iov        = &iov;
+      msg.msg_iovlen     = 1;
+      msg.msg_control    = control.data();
+      msg.msg_controllen = control.size();
+
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type  = SCM_RIGHTS;
+      cmsg->cmsg_len   = CMSG_LEN(count * sizeof(int));
+
+      memcpy(CMSG_DATA(cmsg), fds.constData() + from, count * sizeof(int));
+
+      ssize_t sent;
+
+      do
+      {
+         sent = ::sendmsg(channel, &msg, MSG_NOSIGNAL);
+      }
+      while (sent<0 && errno==EINTR);
+
+      if (sent!=1)
+      {
+         return false;
+      }
+   }
+
+   return writeAll(channel,state.constData(),state.size());
+}
+
+/**
+ * @brief SCDMsgHandoff::receive connects to the outgoing process and receives the descriptors and the state
+ * @param path unix socket of the outgoing process
+ * @param fds receives the descriptors (listening socket first)
+ * @param state receives the message center state
+ * @param peerUid user of the outgoing process (-1: user of this process)
+ * @return false if there is no outgoing process, or the handoff failed
+ */
+bool SCDMsgHandoff::receive(QString path, QVector<int> *fds, QByteArray *state, int peerUid)
+{
+   QByteArray name = QFile::encodeName(path);
+
+   sockaddr_un addr;
+
+   memset(&addr,0,sizeof(addr));
+
+   if (name.size() >= int(sizeof(addr.sun_path)))
+   {
+      return false;
+   }
+
+   addr.sun_family = AF_UNIX;
+
+   memcpy(addr.sun_path,name.constData(),name.size());
+
+   int channel = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+   if (channel<0)
+   {
+      return false;
+   }
+
+   timeval timeout = {(Timeout + DrainTimeout)/1000, ((Timeout + DrainTimeout)%1000)*1000}; // the sessions drain before the state is sent
+
+   ::setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+   quint32 header[2];
+
+   if (::connect(channel,(sockaddr*)&addr,sizeof(addr))<0 || !trusted(channel,peerUid) || !readAll(channel,(char*)header,sizeof(header)))
+   {
+      ::close(channel);
+      return false;
+   }
+
+   bool ok = true;
+
+   while (ok && quint32(fds->size())<header[0])
+   {
+      int count = qMin<int>(MaxFds, header[0] - fds->size());
+
+      char byte;
+
+      iovec iov;
+
+      iov.iov_base = &byte;
+      iov.iov_len  = 1;
+
+      QByteArray control(CMSG_SPACE(count * sizeof(int)),0);
+
+      msghdr msg;
+
+      memset(&msg,0,sizeof(msg));
+
+      msg.msg_iov        = &iov;
+      msg.msg_iovlen     = 1;
+      msg.msg_control    = control.data();
+      msg.msg_controllen = control.size();
+
+      ssize_t received;
+
+      do
+      {
+         received = ::recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+      }
+      while (received<0 && errno==EINTR);
+
+      cmsghdr *cmsg = received==1 ? CMSG_FIRSTHDR(&msg) : 0;
+
+      if (!cmsg || cmsg->cmsg_type!=SCM_RIGHTS || (msg.msg_flags & MSG_CTRUNC))
+      {
+         ok = false;
+         break;
+      }
+
+      int passed = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+      for (int n=0; n<passed; n++)
+      {
+         int fd;
+
+         memcpy(&fd, CMSG_DATA(cmsg) + n * sizeof(int), sizeof(int));
+
+         fds->append(fd);
+      }
+   }
+
+   if (ok)
+   {
+      state->resize(header[1]);
+
+      ok = readAll(channel,state->data(),state->size());
+   }
+
+   ::close(channel);
+
+   if (!ok) // incomplete handoff: the outgoing process continues to serve
+   {
+      for (int n=0; n<fds->size(); n++)
+      {
+         ::close(fds->at(n));
+      }
+
+      fds->clear();
+      state->clear();
+   }
+
+   return ok;
+}
+
+/**
+ * @brief SCDMsgHandoff::writeAll
+ * @param fd
+ * @param data
+ * @param size
+ * @return
+ */
+bool SCDMsgHandoff::writeAll(int fd, const char *data, qint64 size)
+{
+   while (size>0)
+   {
+      ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+
+      if (written<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (written<=0)
+      {
+         return false;
+      }
+
+      data += written;
+      size -= written;
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgHandoff::readAll
+ * @param fd
+ * @param data
+ * @param size
+ * @return
+ */
+bool SCDMsgHandoff::readAll(int fd, char *data, qint64 size)
+{
+   while (size>0)
+   {
+      ssize_t received = ::read(fd, data, size);
+
+      if (received<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (received<=0)
+      {
+         return false;
+      }
+
+      data += received;
+      size -= received;
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgHandoff::trusted checks the user of the process connected to a unix socket (SO_PEERCRED)
+ * @param channel
+ * @param uid expected user (-1: user of this process)
+ * @return
+ */
+bool SCDMsgHandoff::trusted(int channel, int uid)
+{
+   ucred cred;
+
+   socklen_t size = sizeof(cred);
+
+   if (::getsockopt(channel, SOL_SOCKET, SO_PEERCRED, &cred, &size)<0 || size!=sizeof(cred))
+   {
+      return false;
+   }
+
+   return cred.uid == (uid<0 ? ::geteuid() : uid_t(uid));
+}
@@ -0,0 +1,64 @@
+#ifndef SCDMSGHANDOFF_H
+#define SCDMSGHANDOFF_H
+
+#include <QObject>
+#include <QVector>
+#include <QByteArray>
+#include <QSocketNotifier>
+
+class SCDMsgServer;
+
+/**
+ * @brief The SCDMsgHandoff class hands off the message center to a restarted process: the outgoing process waits for
+ *        its successor on a unix socket, and passes it the listening socket, the client sockets (SCM_RIGHTS) and the
+ *        message center state (clients, sessions, sequence numbers, history, last values, alert rules).
+ */
+class SCDMsgHandoff : public QObject
+{
+    Q_OBJECT
+
+  public:
+
+    static const int DrainTimeout = 1000; // ms granted to the sessions to write their pending output before the handoff
+
+    explicit SCDMsgHandoff(SCDMsgServer *server);
+
+    ~SCDMsgHandoff();
+
+    bool listen(QString path, int peerUid = -1); // outgoing process: waits for the successor on path
+
+    static bool send(int channel, const QVector<int> &fds, const QByteArray &state);
+
+    static bool receive(QString path, QVector<int> *fds, QByteArray *state, int peerUid = -1); // successor: takes over from path
+
+  signals:
+
+    void handedOff(); // the successor has taken over: the application should quit
+
+  private slots:
+
+    void incoming();
+
+  private:
+
+    static const int MaxFds = 250;      // descriptors passed by each message (kernel limit SCM_MAX_FD is 253)
+    static const int Timeout = 2000;    // ms to complete the handoff
+
+    SCDMsgServer *server;
+
+    QString Path;
+
+    int ListenFd;
+
+    int PeerUid; // user of the successor process (-1: user of this process)
+
+    QSocketNotifier *Notifier;
+
+    static bool writeAll(int fd, const char *data, qint64 size);
+
+    static bool readAll(int fd, char *data, qint64 size);
+
+    static bool trusted(int channel, int uid);
+};
+
+#endif // SCDMSGHANDOFF_H
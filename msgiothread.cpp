@@ -0,0 +1,411 @@
+/**
+ * @class  SCDMsgIoThread - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center Server: shared I/O thread
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         An I/O thread runs a single event loop that hosts many client sessions (SCDMsgThreadHandler).
+ *         Each session is an event driven object: it does not own a thread or a stack, it only reacts
+ *         to socket and message center events dispatched by the shared event loop.
+ *         The message server uses a small pool of these threads when started with setIoThreads(n),
+ *         otherwise it creates one SCDMsgServerThread for each connection.
+ *
+ *         When many sessions of the same I/O thread spy the same sender, the message center posts the message
+ *         only once to the thread dispatcher, which writes it to every subscribed session of the thread.
+ *         The fan-out of large subscriber sets is so split among the I/O threads and executed in parallel.
+ *         A session receives all its messages from the same thread event queue, so the ordering is preserved.
+ *
+ *         Each thread measures the time spent processing events, and the time spent writing the output of each of
+ *         its sessions. When a thread is overloaded while another one is not, the server moves a heavy session with
+ *         its socket and its pending output to the less loaded thread (see SCDMsgServer::rebalance): the session
+ *         leaves the routing tables of message center, receives its messages directly while it moves, and is moved
+ *         only after the messages already queued for it into the thread, so no message is lost or reordered.
+ *
+ *         The dispatcher also schedules the output of the sessions: a session with pending data is appended to the
+ *         ready list, and on each round every ready session writes up to RoundQuota * weight bytes (deficit round
+ *         robin). The sessions which still have data are served again on next round, after the others.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msgiothread.h"
+#include "msgthreadhandler.h"
+#include "msgcenter.h"
+
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+
+/**
+ * @brief SCDMsgIoThread::SCDMsgIoThread
+ * @param id thread index into server pool
+ * @param parent
+ */
+SCDMsgIoThread::SCDMsgIoThread(int id, QObject *parent) : QThread(parent), Id(id), Sessions(0)
+{
+   setObjectName("mc-io-" + QString::number(id));
+
+   Dispatcher = new SCDMsgIoDispatcher();
+
+   Dispatcher->moveToThread(this);
+}
+
+/**
+ * @brief SCDMsgIoThread::~SCDMsgIoThread stops the event loop and waits for thread end
+ */
+SCDMsgIoThread::~SCDMsgIoThread()
+{
+   quit();
+   wait();
+
+   delete Dispatcher;
+}
+
+/**
+ * @brief SCDMsgIoThread::attach moves a new client session into this thread and opens it.
+ *                               Must be called by the thread which has created the session (the server thread).
+ * @param session
+ */
+void SCDMsgIoThread::attach(SCDMsgThreadHandler *session)
+{
+   Sessions.ref();
+
+   connect(session,SIGNAL(destroyed()),this,SLOT(sessionDestroyed()),Qt::DirectConnection); // keep session count
+
+   session->setDispatcher(Dispatcher);
+
+   session->moveToThread(this);
+
+   QMetaObject::invokeMethod(session,"open",Qt::QueuedConnection); // socket must be created into the I/O thread
+}
+
+/**
+ * @brief SCDMsgIoThread::shed asks this thread to move the session whose move best balances the load to target.
+ *                             Can be called by any thread.
+ * @param target less loaded thread
+ * @param load busy share of this thread during last interval
+ * @param targetLoad busy share of target thread
+ */
+void SCDMsgIoThread::shed(SCDMsgIoThread *target, double load, double targetLoad)
+{
+   QCoreApplication::postEvent(Dispatcher, new SCDMsgMigrateEvent(target,load,targetLoad));
+}
+
+/**
+ * @brief SCDMsgIoThread::migrate moves a session hosted by this thread to target, with its socket and its pending
+ *                               output. Must be called by this thread, when the messages for the session posted to
+ *                               the dispatcher of this thread have been processed: the messages posted to the
+ *                               session itself follow it into target thread, in order.
+ * @param session
+ * @param target
+ */
+void SCDMsgIoThread::migrate(SCDMsgThreadHandler *session, SCDMsgIoThread *target)
+{
+   Dispatcher->unschedule(session);
+
+   disconnect(session,SIGNAL(destroyed()),this,SLOT(sessionDestroyed()));
+
+   Sessions.deref();
+   MigratedOut.ref();
+
+   target->Sessions.ref();
+   target->MigratedIn.ref();
+
+   connect(session,SIGNAL(destroyed()),target,SLOT(sessionDestroyed()),Qt::DirectConnection);
+
+   session->setDispatcher(target->dispatcher());
+
+   session->moveTo(target);
+}
+
+/**
+ * @brief SCDMsgIoThread::sessionDestroyed a session hosted by this thread has been closed
+ */
+void SCDMsgIoThread::sessionDestroyed()
+{
+   Sessions.deref();
+}
+
+/**
+ * @brief SCDMsgIoThread::setRoundQuota sets the output quota of the sessions. Must be called before start().
+ * @param bytes
+ */
+void SCDMsgIoThread::setRoundQuota(int bytes)
+{
+   Dispatcher->setRoundQuota(qMax(1,bytes));
+}
+
+/**
+ * @brief SCDMsgIoThread::run starts the shared event loop, measuring the time spent processing events
+ */
+void SCDMsgIoThread::run()
+{
+   QAbstractEventDispatcher *events = eventDispatcher();
+
+   connect(events,SIGNAL(awake()),Dispatcher,SLOT(awake()),Qt::DirectConnection);
+   connect(events,SIGNAL(aboutToBlock()),Dispatcher,SLOT(aboutToBlock()),Qt::DirectConnection);
+
+   exec();
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::SCDMsgIoDispatcher
+ * @param parent
+ */
+SCDMsgIoDispatcher::SCDMsgIoDispatcher(QObject *parent) : QObject(parent), RoundPending(false), RoundQuota(16384), Busy(0), AwakeSince(-1)
+{
+   Clock.start();
+   LoadClock.start();
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::busyTime returns the time spent by the thread processing events (including the event
+ *                                     in progress). Can be called by any thread.
+ * @return ns
+ */
+qint64 SCDMsgIoDispatcher::busyTime() const
+{
+   qint64 since = AwakeSince.load();
+
+   return Busy.load() + (since>=0 ? Clock.nsecsElapsed() - since : 0);
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::awake the thread starts processing events
+ */
+void SCDMsgIoDispatcher::awake()
+{
+   if (AwakeSince.load()<0)
+   {
+      AwakeSince.store(Clock.nsecsElapsed());
+   }
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::aboutToBlock the thread has no more events to process
+ */
+void SCDMsgIoDispatcher::aboutToBlock()
+{
+   qint64 since = AwakeSince.load();
+
+   if (since>=0)
+   {
+      Busy.fetchAndAddRelaxed(Clock.nsecsElapsed() - since);
+
+      AwakeSince.store(-1);
+   }
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::event writes a batch message to all destination sessions.
+ *                                  A session is deleted only by its own thread after it has been removed from message
+ *                                  center, so every session of a batch is still alive when the batch is processed.
+ * @param e
+ * @return
+ */
+bool SCDMsgIoDispatcher::event(QEvent *e)
+{
+   if (e->type()==SCDMsgBatchEvent::eventType())
+   {
+      SCDMsgBatchEvent *batch = static_cast<SCDMsgBatchEvent*>(e);
+
+      for (int n=0; n<batch->sessions.size(); n++)
+      {
+         SCDMsgThreadHandler *session = batch->sessions.at(n);
+
+         session->receive(batch->kind,batch->msg,batch->data,batch->seq,batch->encoded);
+      }
+
+      return true;
+   }
+
+   if (e->type()==SCDMsgMigrateEvent::eventType())
+   {
+      SCDMsgMigrateEvent *migrate = static_cast<SCDMsgMigrateEvent*>(e);
+
+      if (!migrate->session) // first step: chooses the session
+      {
+         shed(migrate);
+      }
+      else // second step: the messages queued before the session left the routing tables have been processed
+      {
+         static_cast<SCDMsgIoThread*>(thread())->migrate(migrate->session,migrate->target);
+      }
+
+      return true;
+   }
+
+   return QObject::event(e);
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::shed chooses the session whose move to the target thread lowers most the busy share of
+ *                                 the busiest of the two threads, estimated by the time spent writing the output of
+ *                                 each session. The messages for the session are then posted to the session itself,
+ *                                 and the session is moved after the messages already posted to this dispatcher.
+ * @param migrate
+ */
+void SCDMsgIoDispatcher::shed(SCDMsgMigrateEvent *migrate)
+{
+   qint64 total = 0;
+
+   for (QHash<SCDMsgThreadHandler*,qint64>::const_iterator load = Loads.constBegin(); load!=Loads.constEnd(); ++load)
+   {
+      total += load.value();
+   }
+
+   if (total<=0)
+   {
+      return;
+   }
+
+   SCDMsgThreadHandler *session = 0;
+
+   double best = migrate->load - MinGain; // a move which does not lower the max load is not worth it
+
+   for (QHash<SCDMsgThreadHandler*,qint64>::const_iterator load = Loads.constBegin(); load!=Loads.constEnd(); ++load)
+   {
+      double share = migrate->load * load.value() / total;
+
+      double result = qMax(migrate->load - share, migrate->targetLoad + share);
+
+      if (result<best)
+      {
+         best    = result;
+         session = load.key();
+      }
+   }
+
+   if (!session || !session->mc || !session->mc->setClientDispatcher(session->socketDescriptor(),0))
+   {
+      return;
+   }
+
+   Loads.remove(session);
+
+   SCDMsgMigrateEvent *next = new SCDMsgMigrateEvent(migrate->target);
+
+   next->session = session;
+
+   QCoreApplication::postEvent(this,next); // after the messages already posted for the session
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::schedule appends a session with pending output to the ready list, and queues a round
+ * @param session
+ */
+void SCDMsgIoDispatcher::schedule(SCDMsgThreadHandler *session)
+{
+   if (!session->Scheduled)
+   {
+      session->Scheduled = true;
+
+      Ready.append(session);
+   }
+
+   if (!RoundPending)
+   {
+      RoundPending = true;
+
+      QMetaObject::invokeMethod(this,"round",Qt::QueuedConnection); // round after the events already queued
+   }
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::unschedule removes a session from ready list
+ * @param session
+ */
+void SCDMsgIoDispatcher::unschedule(SCDMsgThreadHandler *session)
+{
+   if (session->Scheduled)
+   {
+      Ready.removeOne(session);
+
+      session->Scheduled = false;
+   }
+
+   Loads.remove(session);
+}
+
+/**
+ * @brief SCDMsgIoDispatcher::round serves once every ready session. The sessions which exhaust their quota are served
+ *                                  again on next round, so the other events of the thread are processed in between.
+ */
+void SCDMsgIoDispatcher::round()
+{
+   RoundPending = false;
+
+   QList<SCDMsgThreadHandler*> ready;
+
+   ready.swap(Ready);
+
+   for (int n=0; n<ready.size(); n++)
+   {
+      ready.at(n)->Scheduled = false;
+   }
+
+   if (LoadClock.elapsed()>LoadDecay) // the session loads follow the recent output
+   {
+      LoadClock.restart();
+
+      QHash<SCDMsgThreadHandler*,qint64>::iterator load = Loads.begin();
+
+      while (load!=Loads.end())
+      {
+         load.value() /= 2;
+
+         if (load.value()>0)
+         {
+            ++load;
+         }
+         else
+         {
+            load = Loads.erase(load);
+         }
+      }
+   }
+
+   for (int n=0; n<ready.size(); n++)
+   {
+      SCDMsgThreadHandler *session = ready.at(n);
+
+      qint64 start = Clock.nsecsElapsed();
+
+      bool more = session->service(RoundQuota);
+
+      Loads[session] += Clock.nsecsElapsed() - start;
+
+      if (more)
+      {
+         schedule(session);
+      }
+   }
+}
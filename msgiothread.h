@@ -0,0 +1,144 @@
+#ifndef SCDMSGIOTHREAD_H
+#define SCDMSGIOTHREAD_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QPointer>
+#include <QHash>
+
+class SCDMsgThreadHandler;
+class SCDMsgIoThread;
+
+/**
+ * @brief SCDMsgMigrateEvent asks an overloaded I/O thread to move one of its sessions to a less loaded thread.
+ *        Without session, the thread chooses the session to move (see SCDMsgIoDispatcher::shed), then posts the
+ *        event again with the session: the session is moved when the messages already queued for it into the
+ *        thread have been processed.
+ */
+class SCDMsgMigrateEvent : public QEvent
+{
+  public:
+
+    explicit SCDMsgMigrateEvent(SCDMsgIoThread *target, double load = 0, double targetLoad = 0) :
+        QEvent(eventType()), target(target), load(load), targetLoad(targetLoad) {}
+
+    static QEvent::Type eventType() {static int type = QEvent::registerEventType(); return QEvent::Type(type);}
+
+    SCDMsgIoThread *target;  // destination thread
+    double load;             // busy share of source thread during last interval
+    double targetLoad;       // busy share of destination thread
+
+    QPointer<SCDMsgThreadHandler> session; // session to move (null: to be chosen)
+};
+
+/**
+ * @brief SCDMsgIoDispatcher lives into an I/O thread and delivers a message to all the sessions of the thread
+ *        which subscribed it (see SCDMsgBatchEvent)
+ */
+class SCDMsgIoDispatcher : public QObject
+{
+  Q_OBJECT
+
+  public:
+
+    explicit SCDMsgIoDispatcher(QObject *parent = 0);
+
+    bool event(QEvent *e);
+
+    void schedule(SCDMsgThreadHandler *session);   // session has pending output: serve it on next round
+
+    void unschedule(SCDMsgThreadHandler *session); // session is going to be destroyed, or moved to another thread
+
+    void setRoundQuota(int bytes) {RoundQuota = bytes;}
+
+    qint64 busyTime() const; // thread safe: ns spent by the thread processing events
+
+  public slots:
+
+    void round();
+
+    void awake();        // thread event loop woken up (direct connection from the thread event dispatcher)
+
+    void aboutToBlock(); // thread event loop going to wait for events
+
+  private:
+
+    static const int LoadDecay = 1000;      // ms after which the session loads are halved
+    const double MinGain = 0.05;            // min reduction of the busy share of the overloaded thread to move a session
+
+    QList<SCDMsgThreadHandler*> Ready; // sessions with pending output, in round robin order
+
+    bool RoundPending; // a round is already queued into the thread event loop
+
+    int RoundQuota;    // bytes granted to each session (for unit of weight) on each round
+
+    QHash<SCDMsgThreadHandler*,qint64> Loads; // session => ns spent writing its output (halved every LoadDecay)
+    QElapsedTimer LoadClock;                   // last halving of session loads
+
+    QElapsedTimer Clock;                    // time base of busy time
+    QAtomicInteger<qint64> Busy;            // ns spent processing events, up to last wait
+    QAtomicInteger<qint64> AwakeSince;      // time of last wake up (-1: waiting for events)
+
+    void shed(SCDMsgMigrateEvent *migrate);
+};
+
+class SCDMsgIoThread : public QThread
+{
+  Q_OBJECT
+
+  public:
+
+    explicit SCDMsgIoThread(int id = 0, QObject *parent = 0);
+
+    ~SCDMsgIoThread();
+
+    void attach(SCDMsgThreadHandler *session); // move a client session into this thread and open it
+
+    int sessions() {return Sessions.load();}
+
+    int id() {return Id;}
+
+    void setRoundQuota(int bytes); // output bytes granted to each session (for unit of weight) on each round
+
+    QObject *dispatcher() {return Dispatcher;}
+
+    qint64 busyTime() const {return Dispatcher->busyTime();} // thread safe: ns spent processing events
+
+    void shed(SCDMsgIoThread *target, double load, double targetLoad); // thread safe: move a session to target
+
+    void migrate(SCDMsgThreadHandler *session, SCDMsgIoThread *target); // called by this thread
+
+    int migratedIn() {return MigratedIn.load();}
+
+    int migratedOut() {return MigratedOut.load();}
+
+    int load() {return Load.load();}
+
+    void setLoad(int permille) {Load.store(permille);} // busy share during last interval, measured by the server
+
+  public slots:
+
+    void sessionDestroyed();
+
+  protected:
+
+    void run(); // thread execution
+
+  private:
+
+    int Id; // thread index into server pool
+
+    QAtomicInt Sessions; // number of client sessions living into this thread
+
+    QAtomicInt MigratedIn;  // sessions moved from other threads
+    QAtomicInt MigratedOut; // sessions moved to other threads
+
+    QAtomicInt Load;        // busy share during last interval (per mille)
+
+    SCDMsgIoDispatcher *Dispatcher; // fan-out dispatcher living into this thread
+};
+
+#endif // SCDMSGIOTHREAD_H
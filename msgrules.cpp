@@ -0,0 +1,355 @@
+/**
+ * @class  SCDMsgRules - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: alert rules
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         Server side alerts: the rules are evaluated by message center on every posted message, and when a rule fires
+ *         an alert message is posted to sender 'alerts', so that the operators can spy only the alerts instead of
+ *         watching the whole message streams. Example: more than 50 'underrun' messages of any sock.* in 10 seconds.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msgrules.h"
+
+/**
+ * @brief SCDMsgRules::add compiles a rule and adds it, replacing the rule with the same name
+ * @param rule
+ */
+void SCDMsgRules::add(const SCDMsgRule &rule)
+{
+   Compiled compiled;
+
+   compiled.rule        = rule;
+   compiled.senderParts = rule.sender.split('*');
+   compiled.text        = QStringMatcher(rule.text);
+
+   compiled.rule.count   = qMax(0,rule.count);
+   compiled.rule.seconds = qMax(1,rule.seconds);
+
+   int n = 0;
+
+   while (n<Rules.size() && Rules.at(n).rule.name!=rule.name)
+   {
+      n++;
+   }
+
+   if (n<Rules.size())
+   {
+      Rules.replace(n,compiled);
+   }
+   else
+   {
+      Rules.append(compiled);
+   }
+
+   Senders.clear(); // windows are rebuilt on next message of each sender
+}
+
+/**
+ * @brief SCDMsgRules::remove
+ * @param name
+ * @return false if rule not found
+ */
+bool SCDMsgRules::remove(QString name)
+{
+   for (int n=0; n<Rules.size(); n++)
+   {
+      if (Rules.at(n).rule.name==name)
+      {
+         Rules.removeAt(n);
+
+         Senders.clear();
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/**
+ * @brief SCDMsgRules::rules
+ * @return
+ */
+QVector<SCDMsgRule> SCDMsgRules::rules() const
+{
+   QVector<SCDMsgRule> rules;
+
+   for (int n=0; n<Rules.size(); n++)
+   {
+      rules.append(Rules.at(n).rule);
+   }
+
+   return rules;
+}
+
+/**
+ * @brief SCDMsgRules::evaluate counts a message into the windows of the rules matching its sender, and fires the rules
+ *                              which exceed their count
+ * @param sender
+ * @param level message level
+ * @param msg message, or batch of messages
+ * @param count number of messages
+ * @param now current time (milliseconds)
+ * @param alerts receives one alert message for each fired rule
+ * @return number of fired rules
+ */
+int SCDMsgRules::evaluate(const QString &sender, int level, const QString &msg, int count, qint64 now, QStringList *alerts)
+{
+   QHash<QString, QVector<Window> >::iterator found = Senders.find(sender);
+
+   if (found==Senders.end()) // first message of sender: finds its rules
+   {
+      QVector<Window> windows;
+
+      for (int n=0; n<Rules.size(); n++)
+      {
+         if (matchSender(Rules.at(n).senderParts,sender))
+         {
+            Window window;
+
+            window.rule       = n;
+            window.slot       = 0;
+            window.total      = 0;
+            window.quietUntil = 0;
+
+            for (int b=0; b<Buckets; b++)
+            {
+               window.buckets[b] = 0;
+            }
+
+            windows.append(window);
+         }
+      }
+
+      found = Senders.insert(sender,windows);
+   }
+
+   QVector<Window> &windows = found.value();
+
+   QVarLengthArray<int,64> bodies; // start and end of each message body (split on first text rule)
+
+   int fired = 0;
+
+   for (int w=0; w<windows.size(); w++)
+   {
+      Window &window = windows[w];
+
+      const Compiled &compiled = Rules.at(window.rule);
+
+      if (level<compiled.rule.level)
+      {
+         continue;
+      }
+
+      int hits = 0;
+
+      if (compiled.rule.text.isEmpty())
+      {
+         hits = count;
+      }
+      else
+      {
+         if (bodies.isEmpty())
+         {
+            split(sender,msg,&bodies);
+         }
+
+         for (int b=0; b<bodies.size(); b+=2) // each message counts once, its sender prefix excluded
+         {
+            if (compiled.text.indexIn(msg.constData() + bodies.at(b), bodies.at(b+1) - bodies.at(b))>=0)
+            {
+               hits++;
+            }
+         }
+      }
+
+      if (hits==0)
+      {
+         continue;
+      }
+
+      qint64 width = compiled.rule.seconds * 1000 / Buckets; // bucket width (milliseconds)
+      qint64 slot  = now / width;
+
+      if (slot - window.slot >= Buckets) // window expired
+      {
+         for (int b=0; b<Buckets; b++)
+         {
+            window.buckets[b] = 0;
+         }
+
+         window.total = 0;
+      }
+      else
+      {
+         for (qint64 s=window.slot+1; s<=slot; s++) // expired buckets
+         {
+            window.total -= window.buckets[s % Buckets];
+
+            window.buckets[s % Buckets] = 0;
+         }
+      }
+
+      window.slot = slot;
+
+      window.buckets[slot % Buckets] += hits;
+      window.total += hits;
+
+      if (window.total>compiled.rule.count && now>=window.quietUntil)
+      {
+         alerts->append(compiled.rule.name + ": " + QString::number(window.total) + " messages of " + sender
+                        + " in " + QString::number(compiled.rule.seconds) + "s" + (compiled.rule.text.isEmpty() ? "" : " matching '" + compiled.rule.text + "'"));
+
+         window.quietUntil = now + compiled.rule.seconds * 1000; // fires at most once for each window
+
+         fired++;
+      }
+   }
+
+   return fired;
+}
+
+/**
+ * @brief SCDMsgRules::prefixAt
+ * @param msg
+ * @param pos
+ * @param sender
+ * @return size of the prefix '<sender>: ' at pos of msg, 0 if there is no prefix
+ */
+int SCDMsgRules::prefixAt(const QString &msg, int pos, const QString &sender)
+{
+   int size = sender.size();
+
+   if (pos + size + 2 > msg.size() || msg.at(pos+size)!=':' || msg.at(pos+size+1)!=' ')
+   {
+      return 0;
+   }
+
+   const QChar *text = msg.constData() + pos;
+
+   for (int n=0; n<size; n++)
+   {
+      if (text[n]!=sender.at(n))
+      {
+         return 0;
+      }
+   }
+
+   return size + 2;
+}
+
+/**
+ * @brief SCDMsgRules::split finds the bodies of the messages of a batch '\n<sender>: <text>\n<sender>: <text>...':
+ *                           a message starts at each line with the sender prefix (its text can span more lines)
+ * @param sender
+ * @param msg message, or batch of messages
+ * @param bodies receives start and end of each message text
+ */
+void SCDMsgRules::split(const QString &sender, const QString &msg, QVarLengthArray<int,64> *bodies)
+{
+   int pos = msg.startsWith('\n') ? 1 : 0;
+
+   pos += prefixAt(msg,pos,sender);
+
+   int start = pos;
+
+   for (int lf = msg.indexOf('\n',pos); lf>=0; lf = msg.indexOf('\n',lf+1))
+   {
+      int prefix = prefixAt(msg,lf+1,sender);
+
+      if (prefix>0) // next message
+      {
+         bodies->append(start);
+         bodies->append(lf);
+
+         start = lf + 1 + prefix;
+      }
+   }
+
+   bodies->append(start);
+   bodies->append(msg.size());
+}
+
+/**
+ * @brief SCDMsgRules::toString returns the rule as shown by 'rules' command
+ * @param rule
+ * @return
+ */
+QString SCDMsgRules::toString(const SCDMsgRule &rule)
+{
+   return rule.name + " " + rule.sender + " " + QString::number(rule.level) + " " + QString::number(rule.count)
+          + " " + QString::number(rule.seconds) + (rule.text.isEmpty() ? "" : " " + rule.text);
+}
+
+/**
+ * @brief SCDMsgRules::matchSender matches a sender id against a wildcard pattern split by '*'
+ * @param parts
+ * @param sender
+ * @return
+ */
+bool SCDMsgRules::matchSender(const QStringList &parts, const QString &sender)
+{
+   if (parts.size()==1) // no wildcard
+   {
+      return sender==parts.first();
+   }
+
+   if (!sender.startsWith(parts.first()) || !sender.endsWith(parts.last()))
+   {
+      return false;
+   }
+
+   int from = parts.first().size();
+   int to   = sender.size() - parts.last().size();
+
+   if (to<from)
+   {
+      return false;
+   }
+
+   for (int n=1; n<parts.size()-1; n++)
+   {
+      int pos = sender.indexOf(parts.at(n),from);
+
+      if (pos<0 || pos + parts.at(n).size() > to)
+      {
+         return false;
+      }
+
+      from = pos + parts.at(n).size();
+   }
+
+   return true;
+}
@@ -0,0 +1,79 @@
+#ifndef SCDMSGRULES_H
+#define SCDMSGRULES_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringMatcher>
+#include <QVector>
+#include <QHash>
+#include <QVarLengthArray>
+
+/**
+ * @brief The SCDMsgRule struct an alert rule: fires when more than count messages of a sender matching the sender
+ *        pattern (wildcard '*'), with at least level and whose text (sender prefix excluded) contains text, are posted
+ *        within seconds.
+ */
+struct SCDMsgRule
+{
+   QString name;
+   QString sender;  // sender id pattern, '*' matches any characters
+   int level;       // min message level (see SCDMsgCenter::Level)
+   QString text;    // text contained by message (empty: any message)
+   int count;       // max messages within the window
+   int seconds;     // sliding window
+};
+
+/**
+ * @brief The SCDMsgRules class compiled alert rules, evaluated on every posted message.
+ *        The rules matching a sender are found once, on first message of the sender, then each message only updates
+ *        the sliding window counters of its rules (no allocations). Each window is a ring of time buckets.
+ *        Not thread safe: the message center keeps a copy of the rules for each shard, under the shard lock.
+ */
+class SCDMsgRules
+{
+  public:
+
+    void add(const SCDMsgRule &rule); // adds or replaces the rule with the same name
+
+    bool remove(QString name);
+
+    QVector<SCDMsgRule> rules() const;
+
+    bool isEmpty() const {return Rules.isEmpty();}
+
+    int evaluate(const QString &sender, int level, const QString &msg, int count, qint64 now, QStringList *alerts);
+
+    static QString toString(const SCDMsgRule &rule);
+
+  private:
+
+    static const int Buckets = 10; // time buckets of a sliding window
+
+    struct Compiled
+    {
+       SCDMsgRule rule;
+       QStringList senderParts; // sender pattern split by '*'
+       QStringMatcher text;
+    };
+
+    struct Window
+    {
+       int rule;              // compiled rule index
+       qint64 slot;           // time slot of current bucket
+       int buckets[Buckets];  // messages for each time slot
+       int total;             // messages within the window
+       qint64 quietUntil;     // rule fired: do not fire again before
+    };
+
+    QVector<Compiled> Rules;
+
+    QHash<QString, QVector<Window> > Senders; // sender => windows of the rules matching the sender
+
+    static bool matchSender(const QStringList &parts, const QString &sender);
+
+    static int prefixAt(const QString &msg, int pos, const QString &sender);
+
+    static void split(const QString &sender, const QString &msg, QVarLengthArray<int,64> *bodies);
+};
+
+#endif // SCDMSGRULES_H
@@ -16,6 +16,24 @@
  *           - msgserverthread.cpp,
  *           - msgthreadhandler.h
  *           - msgthreadhandler.cpp
+ *           - msgiothread.h
+ *           - msgiothread.cpp
+ *           - msgstats.h
+ *           - msgstats.cpp
+ *           - msgrules.h
+ *           - msgrules.cpp
+ *           - msghandoff.h
+ *           - msghandoff.cpp
+ *           - msgcommands.h
+ *           - msgcommands.cpp
+ *           - msgexec.h
+ *           - msgexec.cpp
+ *           - msgtail.h
+ *           - msgtail.cpp
+ *           - msgsyslog.h
+ *           - msgsyslog.cpp
+ *           - msgformat.h
+ *           - msgformat.cpp
  *
 */
 
@@ -23,6 +41,11 @@
 
 #include "msgserver.h"
 #include "msgserverthread.h"
+#include "msgthreadhandler.h"
+#include "msgiothread.h"
+#include "msghandoff.h"
+
+#include <unistd.h>
 
 /**
  * @brief SCDMsgServer::SCDMsgServer
@@ -46,6 +69,176 @@ SCDMsgServer::SCDMsgServer(int port, bool verbose, QString logFile, SCDMsgCenter
    }
 
    LogErrorFile = logFile;
+
+   SocketProfiles[0] = SCDMsgSocketProfile::console();
+   SocketProfiles[1] = SCDMsgSocketProfile::spy();
+}
+
+/**
+ * @brief SCDMsgSocketProfile::console default profile of console mode: no delay and small send buffer, so the replies
+ *                                     reach the client immediately and a slow console does not queue into the kernel
+ * @return
+ */
+SCDMsgSocketProfile SCDMsgSocketProfile::console()
+{
+   SCDMsgSocketProfile profile;
+
+   profile.noDelay    = true;
+   profile.sendBuffer = 16384;
+
+   return profile;
+}
+
+/**
+ * @brief SCDMsgSocketProfile::spy default profile of spy mode: large send buffer, writes driven by TCP_NOTSENT_LOWAT
+ *                                 and corked batches, for throughput
+ * @return
+ */
+SCDMsgSocketProfile SCDMsgSocketProfile::spy()
+{
+   SCDMsgSocketProfile profile;
+
+   profile.noDelay      = false;
+   profile.sendBuffer   = 1024*1024;
+   profile.notSentLowat = 131072;
+   profile.cork         = true;
+
+   return profile;
+}
+
+/**
+ * @brief SCDMsgServer::setSocketProfile sets the socket options of the connections of this listener for an operating
+ *                                      mode. Applies to the connections accepted after the call.
+ * @param mode 0: console mode, 1: spy mode (realtime messages receiving)
+ * @param profile
+ */
+void SCDMsgServer::setSocketProfile(int mode, const SCDMsgSocketProfile &profile)
+{
+   SocketProfiles[mode ? 1 : 0] = profile;
+}
+
+/**
+ * @brief SCDMsgServer::~SCDMsgServer stops the shared I/O threads
+ */
+SCDMsgServer::~SCDMsgServer()
+{
+   qDeleteAll(ioThreads); // each thread quits its event loop and waits for end
+
+   ioThreads.clear();
+}
+
+/**
+ * @brief SCDMsgServer::setIoThreads sets the number of shared I/O threads which host the client sessions.
+ *                                   With count = 0 (default) each client connection is handled by its own thread.
+ *                                   With count > 0 each new connection is assigned to the least loaded I/O thread,
+ *                                   so that thousands of sessions cost a few KB each instead of a thread each.
+ *                                   Must be called before start().
+ * @param count
+ */
+void SCDMsgServer::setIoThreads(int count)
+{
+   if (!isListening())
+   {
+      IoThreadCount = qMax(0,count);
+   }
+}
+
+/**
+ * @brief SCDMsgServer::leastLoadedIoThread returns the I/O thread which hosts the lowest number of sessions
+ * @return
+ */
+SCDMsgIoThread *SCDMsgServer::leastLoadedIoThread()
+{
+   SCDMsgIoThread *io = ioThreads.at(0);
+
+   for (int n=1; n<ioThreads.size(); n++)
+   {
+      if (ioThreads.at(n)->sessions() < io->sessions())
+      {
+         io = ioThreads.at(n);
+      }
+   }
+
+   return io;
+}
+
+/**
+ * @brief SCDMsgServer::rebalance measures the busy share of each I/O thread during last interval. If the busiest thread
+ *                                is overloaded and the idlest is not, the busiest one moves a session to the idlest
+ *                                one (at most one move for each interval, see SCDMsgIoDispatcher::shed).
+ */
+void SCDMsgServer::rebalance()
+{
+   qint64 elapsed = qMax(Q_INT64_C(1),RebalanceClock.nsecsElapsed());
+
+   RebalanceClock.restart();
+
+   int busiest = 0;
+   int idlest  = 0;
+
+   QVector<double> loads(ioThreads.size());
+
+   for (int n=0; n<ioThreads.size(); n++)
+   {
+      qint64 busy = ioThreads.at(n)->busyTime();
+
+      loads[n] = qBound(0.0, double(busy - IoBusy.at(n)) / elapsed, 1.0);
+
+      IoBusy[n] = busy;
+
+      ioThreads.at(n)->setLoad(int(loads.at(n)*1000));
+
+      if (loads.at(n)>loads.at(busiest))
+      {
+         busiest = n;
+      }
+
+      if (loads.at(n)<loads.at(idlest))
+      {
+         idlest = n;
+      }
+   }
+
+   if (Cooldown) // the loads of last interval do not reflect the last move
+   {
+      Cooldown = false;
+      return;
+   }
+
+   if (loads.at(busiest)<HighLoad || loads.at(busiest) - loads.at(idlest) < MinImbalance || ioThreads.at(busiest)->sessions()<2)
+   {
+      return;
+   }
+
+   ioThreads.at(busiest)->shed(ioThreads.at(idlest),loads.at(busiest),loads.at(idlest));
+
+   Cooldown = true;
+}
+
+/**
+ * @brief SCDMsgServer::ioStats
+ * @return sessions, busy share and moved sessions of each I/O thread
+ */
+QString SCDMsgServer::ioStats()
+{
+   QString stats = QString(" %1 %2 %3 %4 %5\n").arg("thread",-10).arg("sessions",10).arg("load %",8).arg("moved in",10).arg("moved out",10);
+
+   int moved = 0;
+
+   for (int n=0; n<ioThreads.size(); n++)
+   {
+      SCDMsgIoThread *io = ioThreads.at(n);
+
+      stats += QString(" %1 %2 %3 %4 %5\n").arg(io->objectName(),-10)
+                                           .arg(io->sessions(),10)
+                                           .arg(io->load()/10.0,8,'f',1)
+                                           .arg(io->migratedIn(),10)
+                                           .arg(io->migratedOut(),10);
+
+      moved += io->migratedOut();
+   }
+
+   return stats + " sessions moved: " + QString::number(moved) + "\n";
 }
 
 /**
@@ -53,7 +246,58 @@ SCDMsgServer::SCDMsgServer(int port, bool verbose, QString logFile, SCDMsgCenter
  */
 bool SCDMsgServer::start()
 {
-   Status = listen(QHostAddress::Any,Port);
+   while (ioThreads.size() < IoThreadCount) // starts the shared I/O thread pool
+   {
+      SCDMsgIoThread *io = new SCDMsgIoThread(ioThreads.size());
+
+      io->setRoundQuota(IoRoundQuota);
+
+      io->start();
+
+      ioThreads.append(io);
+   }
+
+   if (ioThreads.size()>1 && IoRebalance>0 && !RebalanceTimer) // hot sessions are moved between the I/O threads
+   {
+      IoBusy.fill(0,ioThreads.size());
+
+      for (int n=0; n<ioThreads.size(); n++)
+      {
+         IoBusy[n] = ioThreads.at(n)->busyTime();
+      }
+
+      RebalanceClock.start();
+
+      RebalanceTimer = new QTimer(this);
+
+      connect(RebalanceTimer,SIGNAL(timeout()),this,SLOT(rebalance()));
+
+      RebalanceTimer->start(IoRebalance);
+   }
+
+   if (!ioThreads.isEmpty())
+   {
+      mc->addCommand("iostats","","I/O threads: sessions, load and moved sessions",[this](const SCDMsgArgs &, int)
+      {
+         return ioStats();
+      });
+   }
+
+   if (AdoptedListener>=0) // the port has never been closed
+   {
+      Status = setSocketDescriptor(AdoptedListener);
+
+      if (!Status)
+      {
+         ::close(AdoptedListener);
+      }
+
+      AdoptedListener = -1;
+   }
+   else
+   {
+      Status = listen(QHostAddress::Any,Port);
+   }
 
    if (Status)    // listen for incoming connections
    {
@@ -64,6 +308,13 @@ bool SCDMsgServer::start()
       QTextStream(stdout) << "Could not start the Message Center Server on port: " << Port  << " => " << this->errorString();
    }
 
+   for (int n=0; n<AdoptedClients.size(); n++) // sessions of the connections taken over (restored by message center)
+   {
+      incomingConnection(AdoptedClients.at(n));
+   }
+
+   AdoptedClients.clear();
+
    return Status;
 }
 
@@ -84,9 +335,107 @@ void SCDMsgServer::stop()
  */
 void SCDMsgServer::incomingConnection(qintptr SocketDescriptor)
 {
+   if (!ioThreads.isEmpty()) // the session is hosted by a shared I/O thread
+   {
+      SCDMsgThreadHandler *session = new SCDMsgThreadHandler(SocketDescriptor, mc, true);
+
+      session->setSocketProfiles(SocketProfiles[0],SocketProfiles[1]);
+
+      leastLoadedIoThread()->attach(session);
+
+      return;
+   }
+
    SCDMsgServerThread *SockThread = new SCDMsgServerThread(SocketDescriptor, mc, this);  // Create a thread for handling client connections passing a socket descrirptor
 
    connect(SockThread,SIGNAL(finished()),SockThread,SLOT(deleteLater()));     // delete thread when finisced()
 
+   SockThread->setSocketProfiles(SocketProfiles[0],SocketProfiles[1]);
+
    SockThread->start(); // start the thread;
 }
+
+/**
+ * @brief SCDMsgServer::enableHandoff enables the handoff to a restarted process: the successor connects to the unix
+ *                                    socket path (see takeOver) and receives the listening socket, the client
+ *                                    connections and the message center state, then handedOff() is emitted.
+ * @param path
+ * @param peerUid user of the successor process (-1: user of this process)
+ * @return false if the unix socket can not be created
+ */
+bool SCDMsgServer::enableHandoff(QString path, int peerUid)
+{
+   if (!Handoff)
+   {
+      Handoff = new SCDMsgHandoff(this);
+
+      connect(Handoff,SIGNAL(handedOff()),this,SIGNAL(handedOff()));
+   }
+
+   return Handoff->listen(path,peerUid);
+}
+
+/**
+ * @brief SCDMsgServer::takeOver takes over from the outgoing process waiting on path, if any. Must be called before
+ *                               start(): the server then uses the received listening socket, and restores the
+ *                               received client connections.
+ * @param path
+ * @param peerUid user of the outgoing process (-1: user of this process)
+ * @return false if no outgoing process has handed off (start() listens as usual)
+ */
+bool SCDMsgServer::takeOver(QString path, int peerUid)
+{
+   QVector<int> fds;
+
+   QByteArray state;
+
+   if (!SCDMsgHandoff::receive(path,&fds,&state,peerUid) || fds.isEmpty())
+   {
+      return false;
+   }
+
+   AdoptedListener = fds.first();
+   AdoptedClients  = fds.mid(1);
+
+   if (!mc->restoreState(state,AdoptedClients)) // unknown state format: the clients reconnect instead of staying silent
+   {
+      QTextStream(stdout) << "\nMessage Center state of outgoing process not readable: " << AdoptedClients.size() << " clients closed" << endl;
+
+      for (int n=0; n<AdoptedClients.size(); n++)
+      {
+         ::close(AdoptedClients.at(n));
+      }
+
+      AdoptedClients.clear();
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgServer::handOff hands off the server to the successor connected to channel
+ * @param channel
+ * @return
+ */
+bool SCDMsgServer::handOff(int channel)
+{
+   if (!isListening())
+   {
+      return false;
+   }
+
+   pauseAccepting();
+
+   if (!mc->handOff(channel,socketDescriptor(),SCDMsgHandoff::DrainTimeout))
+   {
+      resumeAccepting();
+
+      return false;
+   }
+
+   close(); // the successor owns a copy of the listening socket
+
+   QTextStream(stdout) << "\nMessage Center Server handed off to successor process" << endl;
+
+   return true;
+}
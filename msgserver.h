@@ -2,9 +2,29 @@
 #define SCDMSGSERVER_H
 
 #include <QTcpServer>
+#include <QTimer>
+#include <QElapsedTimer>
 
 #include <msgcenter.h>
 
+class SCDMsgIoThread;
+class SCDMsgHandoff;
+
+/**
+ * @brief The SCDMsgSocketProfile struct socket options of a client connection for an operating mode:
+ *        the options are switched automatically when the client enters console mode or spy mode.
+ */
+struct SCDMsgSocketProfile
+{
+   bool noDelay     = false; // TCP_NODELAY: send small writes immediately
+   int sendBuffer   = 0;     // SO_SNDBUF in bytes (0: leave unchanged)
+   int notSentLowat = 0;     // TCP_NOTSENT_LOWAT in bytes: socket is writable only when unsent data are under it (0: socket default)
+   bool cork        = false; // TCP_CORK while a batch of messages is written: full segments for coalesced messages
+
+   static SCDMsgSocketProfile console(); // interactive console: low latency
+   static SCDMsgSocketProfile spy();     // realtime messages receiving: throughput
+};
+
 class SCDMsgServer : public QTcpServer
 {
     Q_OBJECT
@@ -16,24 +36,76 @@ class SCDMsgServer : public QTcpServer
     int  Port;
     int Status=0;
 
+    int IoThreadCount=0; // number of shared I/O threads (0: one thread for each connection)
+
+    int IoRoundQuota=16384; // output bytes granted to each session on each round of its I/O thread
+
+    QVector<SCDMsgIoThread*> ioThreads; // shared I/O thread pool
+
+    SCDMsgIoThread *leastLoadedIoThread();
+
+    int IoRebalance=1000; // ms between two load checks of the I/O threads (0: sessions never moved)
+
+    const double HighLoad = 0.75;    // busy share over which an I/O thread sheds a session
+    const double MinImbalance = 0.25; // min difference of busy share between the busiest and the idlest thread
+
+    QTimer *RebalanceTimer = 0;
+    QElapsedTimer RebalanceClock;    // start of current load interval
+    QVector<qint64> IoBusy;          // busy time of each I/O thread at start of current interval
+    bool Cooldown = false;           // a session has been moved during the interval: its load is not yet measured
+
+    SCDMsgSocketProfile SocketProfiles[2]; // socket profiles for console mode (0) and spy mode (1)
+
+    SCDMsgHandoff *Handoff = 0;  // waits for the successor process (handoff enabled)
+
+    int AdoptedListener = -1;    // listening socket taken over from the outgoing process
+    QVector<int> AdoptedClients; // client sockets taken over from the outgoing process
+
   public:
 
     explicit SCDMsgServer(int port = 33331, bool verbose=true, QString logFile="msgserver.log", SCDMsgCenter *msgCnt = 0, QObject *parent = 0);
 
+    ~SCDMsgServer();
+
     bool start(); // Start tcp server for incoming connections
     void stop();
     bool status() {return Status;}
 
+    void setIoThreads(int count); // Host client sessions on a pool of shared I/O threads (must be called before start)
+    int  ioThreadCount() {return IoThreadCount;}
+
+    void setIoRoundQuota(int bytes) {IoRoundQuota = bytes;} // must be called before start
+
+    void setIoRebalance(int msec) {IoRebalance = msec;} // load check interval of I/O threads (0: off), before start
+
+    QString ioStats(); // sessions, load and migrations of the I/O threads
+
+    void setSocketProfile(int mode, const SCDMsgSocketProfile &profile); // mode 0: console, 1: spy
+
+    SCDMsgSocketProfile socketProfile(int mode) {return SocketProfiles[mode ? 1 : 0];}
+
     bool Verbose;
 
     QString LogErrorFile;
 
     SCDMsgCenter *messageCenter() {return mc;}
 
+    bool enableHandoff(QString path, int peerUid = -1); // waits for a restarted process (run by peerUid, -1: same user) on unix socket path
+
+    bool takeOver(QString path, int peerUid = -1); // takes over from the outgoing process (must be called before start)
+
+    bool handOff(int channel);        // hands off listening socket, clients and state to the successor
+
   signals:
 
+    void handedOff(); // the successor has taken over: the application should quit
+
   public slots:
 
+  private slots:
+
+    void rebalance();
+
   protected:
 
      void incomingConnection(qintptr SocketDescriptor);
@@ -18,6 +18,24 @@
  *            - msgserver.cpp,
  *            - msgthreadhandler.h
  *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
  *
 */
 
@@ -45,6 +63,17 @@ SCDMsgServerThread::~SCDMsgServerThread()
 
 }
 
+/**
+ * @brief SCDMsgServerThread::setSocketProfiles sets the socket options for console and spy mode (before start)
+ * @param console
+ * @param spy
+ */
+void SCDMsgServerThread::setSocketProfiles(const SCDMsgSocketProfile &console, const SCDMsgSocketProfile &spy)
+{
+   SocketProfiles[0] = console;
+   SocketProfiles[1] = spy;
+}
+
 /**
  * @brief SCDMsgServerThread::run starts remote client connection thread
  */
@@ -52,11 +81,13 @@ void SCDMsgServerThread::run()
 {
    SCDMsgThreadHandler *tev = new SCDMsgThreadHandler(SocketDescriptor, mc); // Thread handler class live into thread
 
+   tev->setSocketProfiles(SocketProfiles[0],SocketProfiles[1]);
+
    if (tev->start()) // start socket connection and set the socket signal handler slot
    {
       if (mc)
       {
-         mc->addClient(SocketDescriptor); // register client to message center. client can receive message from application message senders
+         mc->addClient(SocketDescriptor,tev); // register client to message center. client can receive message from application message senders
       }
 
       exec(); //  start thared event loop e do not return until quit or exit is not called (on socket disconnect, exits from event loop)
@@ -18,6 +18,8 @@ class SCDMsgServerThread : public QThread
 
     void run(); // thread execution
 
+    void setSocketProfiles(const SCDMsgSocketProfile &console, const SCDMsgSocketProfile &spy); // before start
+
   signals:
 
     void error(QTcpSocket::SocketError SocketError);
@@ -32,6 +34,8 @@ class SCDMsgServerThread : public QThread
     SCDMsgCenter *mc;
 
     QTcpSocket *Socket;   // socket of current connection
+
+    SCDMsgSocketProfile SocketProfiles[2]; // socket profiles for console and spy mode
 };
 
 #endif // SCDSERVERTHREAD_H
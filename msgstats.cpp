@@ -0,0 +1,319 @@
+/**
+ * @class  SCDMsgTopSenders, SCDMsgPatterns - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: senders statistics
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         Heavy hitters sketch of the message senders: it is updated by postMessage with constant memory,
+ *         and it is read by the 'top' command of message center.
+ *
+ *         Message templates of a sender: the messages are clustered online into templates with variable fields
+ *         (numbers, ids...), so that a sender which posts 100k messages per second can be read as a few hundred
+ *         templates with their counts ('patterns' and 'digest' commands of message center).
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include <algorithm>
+
+#include "msgstats.h"
+
+/**
+ * @brief SCDMsgTopSenders::SCDMsgTopSenders
+ * @param capacity max number of counted senders
+ */
+SCDMsgTopSenders::SCDMsgTopSenders(int capacity) : Capacity(qMax(1,capacity))
+{
+   Entries.reserve(Capacity);
+   Index.reserve(Capacity);
+}
+
+/**
+ * @brief SCDMsgTopSenders::add counts the messages of sender
+ * @param sender
+ * @param bytes messages size
+ * @param count number of messages
+ */
+void SCDMsgTopSenders::add(const QString &sender, qint64 bytes, int count)
+{
+   QHash<QString,int>::const_iterator found = Index.constFind(sender);
+
+   if (found!=Index.constEnd())
+   {
+      Entry &entry = Entries[found.value()];
+
+      entry.count += count;
+      entry.bytes += bytes;
+
+      siftDown(found.value());
+
+      return;
+   }
+
+   if (Entries.size()<Capacity)
+   {
+      Entry entry;
+
+      entry.sender = sender;
+      entry.count  = count;
+      entry.bytes  = bytes;
+      entry.error  = 0;
+
+      int n = Entries.size();
+
+      Entries.append(entry);
+
+      while (n>0 && Entries.at(n).count < Entries.at((n-1)/2).count) // sift up
+      {
+         Entries[n] = Entries.at((n-1)/2);
+
+         Index[Entries.at(n).sender] = n;
+
+         n = (n-1)/2;
+      }
+
+      Entries[n] = entry;
+
+      Index.insert(sender,n);
+
+      return;
+   }
+
+   Entry &entry = Entries[0]; // replaces the sender with lowest count (heap root)
+
+   Index.remove(entry.sender);
+   Index.insert(sender,0);
+
+   entry.sender = sender;
+   entry.error  = entry.count;
+   entry.count += count;
+   entry.bytes += bytes;
+
+   siftDown(0);
+}
+
+/**
+ * @brief SCDMsgTopSenders::siftDown moves an entry whose count has grown down the min-heap
+ * @param n entry index
+ */
+void SCDMsgTopSenders::siftDown(int n)
+{
+   Entry entry = Entries.at(n);
+
+   int size = Entries.size();
+
+   while (2*n+1 < size)
+   {
+      int child = 2*n+1;
+
+      if (child+1 < size && Entries.at(child+1).count < Entries.at(child).count)
+      {
+         child++;
+      }
+
+      if (entry.count <= Entries.at(child).count)
+      {
+         break;
+      }
+
+      Entries[n] = Entries.at(child);
+
+      Index[Entries.at(n).sender] = n;
+
+      n = child;
+   }
+
+   Entries[n] = entry;
+
+   Index[entry.sender] = n;
+}
+
+/**
+ * @brief SCDMsgTopSenders::clear resets all counters
+ */
+void SCDMsgTopSenders::clear()
+{
+   Entries.clear();
+   Index.clear();
+}
+
+/**
+ * @brief SCDMsgTopSenders::sort sorts the entries by count, highest first
+ * @param entries
+ */
+void SCDMsgTopSenders::sort(QVector<Entry> &entries)
+{
+   std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {return a.count > b.count;});
+}
+
+/**
+ * @brief SCDMsgPatterns::SCDMsgPatterns
+ * @param similarity min fraction of equal tokens to match a template
+ * @param maxTemplates max number of templates, then new messages are only counted as overflow
+ */
+SCDMsgPatterns::SCDMsgPatterns(double similarity, int maxTemplates) :
+    Similarity(similarity), MaxTemplates(maxTemplates), Messages(0), Overflow(0)
+{
+}
+
+/**
+ * @brief SCDMsgPatterns::add clusters a message
+ * @param message
+ * @param id receives the template id of message, -1 if message has not been clustered
+ * @return New if message opened a new template, Milestone if template count reached a power of ten
+ */
+SCDMsgPatterns::Event SCDMsgPatterns::add(const QString &message, int *id)
+{
+   Messages++;
+
+   QStringList tokens = message.split(' ',QString::SkipEmptyParts);
+
+   for (int n=0; n<tokens.size(); n++) // masks variable fields
+   {
+      const QString &token = tokens.at(n);
+
+      for (int c=0; c<token.size(); c++)
+      {
+         if (token.at(c).isDigit())
+         {
+            tokens[n] = "<*>";
+            break;
+         }
+      }
+   }
+
+   QString key = QString::number(tokens.size()) + ' ' + (tokens.isEmpty() ? QString() : tokens.first());
+
+   QHash<QString, QVector<int> >::const_iterator found = Groups.constFind(key); // a group is created only with its first template
+
+   static const QVector<int> none;
+
+   const QVector<int> &group = found!=Groups.constEnd() ? found.value() : none;
+
+   int best = -1;
+
+   double bestSimilarity = 0;
+
+   for (int g=0; g<group.size(); g++)
+   {
+      const QStringList &pattern = Templates.at(group.at(g)).tokens;
+
+      int equal = 0;
+
+      for (int n=0; n<tokens.size(); n++)
+      {
+         if (pattern.at(n)==tokens.at(n) && pattern.at(n)!="<*>")
+         {
+            equal++;
+         }
+      }
+
+      double similarity = tokens.isEmpty() ? 1 : double(equal)/tokens.size();
+
+      if (similarity>bestSimilarity || best<0)
+      {
+         best           = group.at(g);
+         bestSimilarity = similarity;
+      }
+   }
+
+   if (best>=0 && bestSimilarity>=Similarity)
+   {
+      Template &pattern = Templates[best];
+
+      for (int n=0; n<tokens.size(); n++) // different tokens become variable fields
+      {
+         if (pattern.tokens.at(n)!=tokens.at(n))
+         {
+            pattern.tokens[n] = "<*>";
+         }
+      }
+
+      pattern.count++;
+
+      if (id)
+      {
+         *id = best;
+      }
+
+      qint64 count = pattern.count;
+
+      while (count>=10 && count%10==0)
+      {
+         count /= 10;
+      }
+
+      return count==1 ? Milestone : Counted;
+   }
+
+   if (Templates.size()>=MaxTemplates)
+   {
+      Overflow++;
+
+      if (id)
+      {
+         *id = -1;
+      }
+
+      return Counted;
+   }
+
+   Template pattern;
+
+   pattern.id     = Templates.size();
+   pattern.tokens = tokens;
+   pattern.count  = 1;
+
+   Templates.append(pattern);
+
+   Groups[key].append(pattern.id);
+
+   if (id)
+   {
+      *id = pattern.id;
+   }
+
+   return New;
+}
+
+/**
+ * @brief SCDMsgPatterns::templates returns the templates sorted by count, highest first
+ * @return
+ */
+QVector<SCDMsgPatterns::Template> SCDMsgPatterns::templates() const
+{
+   QVector<Template> templates = Templates;
+
+   std::sort(templates.begin(), templates.end(), [](const Template &a, const Template &b) {return a.count > b.count;});
+
+   return templates;
+}
@@ -0,0 +1,101 @@
+#ifndef SCDMSGSTATS_H
+#define SCDMSGSTATS_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QStringList>
+
+/**
+ * @brief The SCDMsgTopSenders class heavy hitters sketch of message senders (space saving algorithm).
+ *        Keeps at most capacity counters: the senders with highest post rate are always counted,
+ *        a new sender replaces the counter with lowest count and inherits it (messages and bytes) as estimation
+ *        error. The counters are kept into a min-heap by count, so the lowest one is replaced in O(log capacity).
+ *        Not thread safe: the message center keeps one sketch for each shard under the shard lock.
+ */
+class SCDMsgTopSenders
+{
+  public:
+
+    struct Entry
+    {
+       QString sender;
+       qint64 count; // messages (overestimated by at most error)
+       qint64 bytes; // message bytes (overestimated as count)
+       qint64 error; // count inherited from replaced sender
+    };
+
+    explicit SCDMsgTopSenders(int capacity = 64);
+
+    void add(const QString &sender, qint64 bytes, int count = 1); // count the messages of sender
+
+    QVector<Entry> entries() const {return Entries;} // unsorted (see sort)
+
+    void clear();
+
+    static void sort(QVector<Entry> &entries); // sort by count, highest first
+
+  private:
+
+    int Capacity;
+
+    QVector<Entry> Entries;   // min-heap by count
+
+    QHash<QString,int> Index; // sender => entry index
+
+    void siftDown(int n);     // restores the heap after the count of entry n has grown
+};
+
+/**
+ * @brief The SCDMsgPatterns class online clustering of the messages of a sender into templates (Drain algorithm).
+ *        A message is split into tokens, the tokens which contain digits are masked as variable fields (<*>),
+ *        and the message is matched only against the templates with the same number of tokens and the same
+ *        first token (the fixed depth prefix tree of Drain). If the most similar template has at least
+ *        similarity of tokens equal, the message is counted on it and the different tokens become variable,
+ *        otherwise the message opens a new template.
+ *        Not thread safe: the message center keeps the miners into the shards, under the shard lock.
+ */
+class SCDMsgPatterns
+{
+  public:
+
+    enum Event {Counted, New, Milestone}; // result of add: milestone means count reached a power of ten
+
+    struct Template
+    {
+       int id;
+       QStringList tokens;
+       qint64 count;
+
+       QString text() const {return tokens.join(' ');}
+    };
+
+    explicit SCDMsgPatterns(double similarity = 0.5, int maxTemplates = 1000);
+
+    Event add(const QString &message, int *id = 0); // count a message, id receives its template id (-1: overflow)
+
+    QString text(int id) const {return Templates.at(id).text();}
+
+    qint64 count(int id) const {return Templates.at(id).count;}
+
+    QVector<Template> templates() const; // templates sorted by count, highest first
+
+    qint64 messages() const {return Messages;}
+
+    qint64 overflow() const {return Overflow;}
+
+  private:
+
+    double Similarity;
+
+    int MaxTemplates;
+
+    qint64 Messages; // counted messages
+    qint64 Overflow; // messages not clustered because there are already MaxTemplates templates
+
+    QVector<Template> Templates; // template id => template
+
+    QHash<QString, QVector<int> > Groups; // token count and first token => template ids
+};
+
+#endif // SCDMSGSTATS_H
@@ -0,0 +1,494 @@
+/**
+ * @class  SCDMsgSyslog - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: syslog compatible local ingest socket
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         The third party components which log by syslog(3) can be spied as the live senders: the messages received on
+ *         a local datagram socket are posted to message center by a sender for each application name.
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msgsyslog.h"
+#include "msgcenter.h"
+
+#include <QFile>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *FacilityNames[24] = {"kern", "user", "mail", "daemon", "auth", "syslog", "lpr", "news", "uucp",
+                                        "cron", "authpriv", "ftp", "ntp", "audit", "alert", "clock", "local0",
+                                        "local1", "local2", "local3", "local4", "local5", "local6", "local7"};
+
+/**
+ * @brief SCDMsgSyslog::SCDMsgSyslog
+ * @param mc message center
+ * @param parent
+ */
+SCDMsgSyslog::SCDMsgSyslog(SCDMsgCenter *mc, QObject *parent) : QObject(parent), mc(mc), Socket(-1), Notifier(0), Received(0)
+{
+}
+
+/**
+ * @brief SCDMsgSyslog::~SCDMsgSyslog closes the socket and removes the senders
+ */
+SCDMsgSyslog::~SCDMsgSyslog()
+{
+   close();
+
+   for (QHash<QByteArray,QString>::const_iterator i = Senders.constBegin(); i!=Senders.constEnd(); ++i)
+   {
+      mc->removeSender(i.value());
+   }
+
+   for (int n=0; n<24; n++)
+   {
+      if (!Facilities[n].isEmpty())
+      {
+         mc->removeSender(Facilities[n]);
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgSyslog::listen binds the datagram socket. A stale socket left at path is replaced.
+ * @param path socket path (e.g. '/dev/log', or the forward target of system log daemon)
+ * @return false if the socket can not be bound
+ */
+bool SCDMsgSyslog::listen(QString path)
+{
+   close();
+
+   QByteArray name = QFile::encodeName(path);
+
+   struct sockaddr_un addr;
+
+   if (name.isEmpty() || name.size()>=(int)sizeof(addr.sun_path))
+   {
+      return false;
+   }
+
+   memset(&addr,0,sizeof(addr));
+
+   addr.sun_family = AF_UNIX;
+
+   memcpy(addr.sun_path,name.constData(),name.size());
+
+   struct stat st;
+
+   if (::lstat(name.constData(),&st)==0 && S_ISSOCK(st.st_mode)) // only a socket is replaced
+   {
+      ::unlink(name.constData());
+   }
+
+   Socket = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (Socket<0)
+   {
+      return false;
+   }
+
+   if (::bind(Socket,(struct sockaddr*)&addr,sizeof(addr))<0)
+   {
+      ::close(Socket);
+
+      Socket = -1;
+
+      return false;
+   }
+
+   ::chmod(name.constData(),0666); // any local process can log
+
+   int size = 4*1024*1024; // absorbs the bursts while the thread is busy
+
+   ::setsockopt(Socket,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+
+   Path = name;
+
+   Buffer.resize(MaxDatagrams*DatagramSize);
+
+   Notifier = new QSocketNotifier(Socket,QSocketNotifier::Read,this);
+
+   connect(Notifier,SIGNAL(activated(int)),this,SLOT(readable()));
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgSyslog::close closes the socket and removes its path
+ */
+void SCDMsgSyslog::close()
+{
+   if (Socket<0)
+   {
+      return;
+   }
+
+   delete Notifier;
+
+   Notifier = 0;
+
+   ::close(Socket);
+
+   ::unlink(Path.constData());
+
+   Socket = -1;
+}
+
+/**
+ * @brief SCDMsgSyslog::readable receives the datagrams by blocks of MaxDatagrams, and posts each block
+ */
+void SCDMsgSyslog::readable()
+{
+   struct mmsghdr msgs[MaxDatagrams];
+   struct iovec iovecs[MaxDatagrams];
+
+   char *buffer = Buffer.data();
+
+   for (int n=0; n<MaxDatagrams; n++)
+   {
+      iovecs[n].iov_base = buffer + n*DatagramSize;
+      iovecs[n].iov_len  = DatagramSize;
+
+      memset(&msgs[n].msg_hdr,0,sizeof(msgs[n].msg_hdr));
+
+      msgs[n].msg_hdr.msg_iov    = &iovecs[n];
+      msgs[n].msg_hdr.msg_iovlen = 1;
+   }
+
+   int total = 0;
+
+   while (total<MaxRead)
+   {
+      int count = ::recvmmsg(Socket, msgs, MaxDatagrams, MSG_DONTWAIT, 0);
+
+      if (count<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (count<=0)
+      {
+         break;
+      }
+
+      for (int n=0; n<count; n++)
+      {
+         parse(buffer + n*DatagramSize, msgs[n].msg_len);
+      }
+
+      flush();
+
+      Received += count;
+
+      total += count;
+
+      if (count<MaxDatagrams) // socket drained
+      {
+         break;
+      }
+   }
+}
+
+/**
+ * @brief SCDMsgSyslog::parse parses a RFC 5424 or RFC 3164 message, and appends it to the batch of its sender
+ * @param data
+ * @param size
+ */
+void SCDMsgSyslog::parse(const char *data, int size)
+{
+   const char *p   = data;
+   const char *end = data + size;
+
+   while (end>p && (end[-1]=='\n' || end[-1]=='\0')) // syslog(3) may append a newline or the terminator
+   {
+      end--;
+   }
+
+   int pri = 13; // user.notice, when the priority is missing
+
+   if (p<end && *p=='<')
+   {
+      int value = 0;
+
+      const char *q = p + 1;
+
+      while (q<end && q-p<=4 && *q>='0' && *q<='9')
+      {
+         value = value*10 + (*q++ - '0');
+      }
+
+      if (q<end && *q=='>' && q>p+1 && value<24*8)
+      {
+         pri = value;
+         p   = q + 1;
+      }
+   }
+
+   int facility = pri >> 3;
+   int severity = pri & 7;
+
+   const char *app    = 0;
+   const char *appEnd = 0;
+   const char *pid    = 0;
+   const char *pidEnd = 0;
+
+   if (end-p>=2 && p[0]=='1' && p[1]==' ') // RFC 5424: VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG
+   {
+      p += 2;
+
+      const char *fields[5][2]; // TIMESTAMP HOSTNAME APP-NAME PROCID MSGID
+
+      for (int n=0; n<5; n++)
+      {
+         fields[n][0] = p;
+
+         const char *space = (const char*)memchr(p, ' ', end - p);
+
+         p = space ? space : end;
+
+         fields[n][1] = p;
+
+         if (p<end)
+         {
+            p++;
+         }
+      }
+
+      app    = fields[2][0];
+      appEnd = fields[2][1];
+      pid    = fields[3][0];
+      pidEnd = fields[3][1];
+
+      if (p<end && *p=='[') // structured data: skipped (']' escaped by '\')
+      {
+         while (p<end && *p=='[')
+         {
+            p++;
+
+            while (p<end && *p!=']')
+            {
+               p += (*p=='\\' && p+1<end) ? 2 : 1;
+            }
+
+            if (p<end)
+            {
+               p++;
+            }
+         }
+      }
+      else
+      if (p<end && *p=='-')
+      {
+         p++;
+      }
+
+      if (p<end && *p==' ')
+      {
+         p++;
+      }
+
+      if (end-p>=3 && (unsigned char)p[0]==0xEF && (unsigned char)p[1]==0xBB && (unsigned char)p[2]==0xBF) // BOM
+      {
+         p += 3;
+      }
+   }
+   else // RFC 3164: [TIMESTAMP] [HOSTNAME] TAG[PID]: MSG (the local messages have no hostname)
+   {
+      if (end-p>=16 && p[3]==' ' && p[6]==' ' && p[9]==':' && p[12]==':' && p[15]==' ') // 'Mmm dd hh:mm:ss '
+      {
+         p += 16;
+      }
+
+      for (int n=0; n<2 && p<end; n++) // a token which is not a tag is a hostname
+      {
+         const char *q = p;
+
+         while (q<end && *q!=' ' && *q!=':' && *q!='[')
+         {
+            q++;
+         }
+
+         if (q<end && (*q==':' || *q=='['))
+         {
+            app    = p;
+            appEnd = q;
+
+            if (*q=='[')
+            {
+               pid = q + 1;
+
+               const char *close = (const char*)memchr(pid, ']', end - pid);
+
+               pidEnd = close ? close : pid;
+
+               q = close ? close + 1 : q;
+            }
+
+            if (q<end && *q==':')
+            {
+               q++;
+            }
+
+            if (q<end && *q==' ')
+            {
+               q++;
+            }
+
+            p = q;
+
+            break;
+         }
+
+         if (q>=end || n==1)
+         {
+            break;
+         }
+
+         p = q + 1; // hostname
+      }
+   }
+
+   QString msg = QString::fromUtf8(p, end - p);
+
+   if (pid && pidEnd>pid && !(pidEnd-pid==1 && *pid=='-'))
+   {
+      msg = "[" + QString::fromLatin1(pid, pidEnd - pid) + "] " + msg;
+   }
+
+   QString id = sender(app, app ? appEnd - app : 0, facility);
+
+   QHash<QString,QStringList>::iterator batch = Batches.find(id);
+
+   if (batch==Batches.end())
+   {
+      batch = Batches.insert(id,QStringList());
+
+      Order.append(id);
+   }
+
+   if (severity<=4) // warning or higher: posted with its level, after the messages which precede it
+   {
+      int level = severity<=2 ? SCDMsgCenter::Critical : (severity==3 ? SCDMsgCenter::Error : SCDMsgCenter::Warning);
+
+      mc->postMessages(id,batch.value());
+
+      batch.value().clear();
+
+      mc->postMessage(msg,id,level);
+   }
+   else
+   {
+      batch.value().append(msg);
+   }
+}
+
+/**
+ * @brief SCDMsgSyslog::sender gets the sender of an application, registering it at first message. The application
+ *                             name is sanitized; without name, or when MaxSenders are registered, the facility
+ *                             sender is used.
+ * @param app
+ * @param size
+ * @param facility
+ * @return
+ */
+QString SCDMsgSyslog::sender(const char *app, int size, int facility)
+{
+   if (size>0 && !(size==1 && *app=='-'))
+   {
+      size = qMin(size,(int)MaxAppName);
+
+      QByteArray key = QByteArray::fromRawData(app,size); // no copy for the lookup
+
+      QHash<QByteArray,QString>::const_iterator found = Senders.constFind(key);
+
+      if (found!=Senders.constEnd())
+      {
+         return found.value();
+      }
+
+      if (Senders.size()<MaxSenders)
+      {
+         QByteArray name(app,size);
+
+         for (int n=0; n<name.size(); n++)
+         {
+            char c = name.at(n);
+
+            if (!((c>='a' && c<='z') || (c>='A' && c<='Z') || (c>='0' && c<='9') || c=='.' || c=='_' || c=='-'))
+            {
+               name[n] = '_';
+            }
+         }
+
+         QString id = "syslog." + QString::fromLatin1(name);
+
+         Senders.insert(QByteArray(app,size),id);
+
+         mc->addSender(id);
+
+         return id;
+      }
+   }
+
+   facility = qBound(0,facility,23);
+
+   if (Facilities[facility].isEmpty())
+   {
+      Facilities[facility] = QString("syslog.") + FacilityNames[facility];
+
+      mc->addSender(Facilities[facility]);
+   }
+
+   return Facilities[facility];
+}
+
+/**
+ * @brief SCDMsgSyslog::flush posts the batches of current block, by order of first message of each sender
+ */
+void SCDMsgSyslog::flush()
+{
+   for (int n=0; n<Order.size(); n++)
+   {
+      mc->postMessages(Order.at(n),Batches.value(Order.at(n)));
+   }
+
+   Batches.clear();
+   Order.clear();
+}
@@ -0,0 +1,76 @@
+#ifndef SCDMSGSYSLOG_H
+#define SCDMSGSYSLOG_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QSocketNotifier>
+
+class SCDMsgCenter;
+
+/**
+ * @brief The SCDMsgSyslog class receives the messages of syslog(3) on a local datagram socket (AF_UNIX, e.g.
+ *        '/dev/log' or a socket configured as forward target of the system log daemon). RFC 3164 and RFC 5424
+ *        messages are accepted: the app name (tag) of each message selects the sender 'syslog.<app>', registered at
+ *        first message. The datagrams are received by recvmmsg in blocks of MaxDatagrams, and the messages of each
+ *        block are posted as a batch for each sender (SCDMsgCenter::postMessages). The messages with severity
+ *        warning or higher are posted one by one with their level, so they are evaluated by the alert rules.
+ *        Lives into the thread which creates it (an event loop is required).
+ */
+class SCDMsgSyslog : public QObject
+{
+    Q_OBJECT
+
+  public:
+
+    explicit SCDMsgSyslog(SCDMsgCenter *mc, QObject *parent = 0);
+
+    ~SCDMsgSyslog();
+
+    bool listen(QString path);
+
+    void close();
+
+    quint64 received() const { return Received; }
+
+  private slots:
+
+    void readable();
+
+  private:
+
+    static const int MaxDatagrams = 64;      // datagrams received by each recvmmsg
+    static const int DatagramSize = 8192;    // longer messages are truncated
+    static const int MaxRead = 4096;         // datagrams received for each readiness notification
+    static const int MaxSenders = 256;       // over this number the messages are posted by the facility senders
+    static const int MaxAppName = 48;
+
+    SCDMsgCenter *mc;
+
+    int Socket;                        // datagram socket (-1: not listening)
+
+    QByteArray Path;                   // socket path, removed by close
+
+    QSocketNotifier *Notifier;
+
+    QByteArray Buffer;                 // receive buffers of all datagrams of a block
+
+    QHash<QByteArray,QString> Senders; // app name => registered sender
+
+    QString Facilities[24];            // registered facility senders (empty: not registered)
+
+    QHash<QString,QStringList> Batches; // sender => messages of current block
+
+    QStringList Order;                 // senders of current block, by first message
+
+    quint64 Received;                  // datagrams received
+
+    void parse(const char *data, int size);
+
+    QString sender(const char *app, int size, int facility);
+
+    void flush();
+};
+
+#endif // SCDMSGSYSLOG_H
@@ -0,0 +1,484 @@
+/**
+ * @class  SCDMsgFileTail - https://github.com/SC-Develop/SCD_MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/SC-Develop/
+ *
+ * @brief  Message Center: log files as message senders
+ *
+ *         This is a part of SCD Message Center QT Class Library
+ *
+ *         The subsystems of the application which write classic log files can be spied as the live senders: each file
+ *         is a sender, and its new lines are posted to message center as they are written (like 'tail -F').
+ *
+ *         This file must be distribuited with files:
+ *
+ *            - msgcenter.cpp,
+ *            - msgcenter.h,
+ *            - msgserver.h,
+ *            - msgserver.cpp,
+ *            - msgserverthread.h
+ *            - msgserverthread.cpp
+ *            - msgthreadhandler.h
+ *            - msgthreadhandler.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
+ *
+*/
+
+#include "msgtail.h"
+#include "msgcenter.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/**
+ * @brief SCDMsgFileTail::SCDMsgFileTail
+ * @param mc message center
+ * @param parent
+ */
+SCDMsgFileTail::SCDMsgFileTail(SCDMsgCenter *mc, QObject *parent) : QObject(parent), mc(mc), Notifier(0)
+{
+   Inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+   if (Inotify>=0)
+   {
+      Notifier = new QSocketNotifier(Inotify,QSocketNotifier::Read,this);
+
+      connect(Notifier,SIGNAL(activated(int)),this,SLOT(notified()));
+   }
+
+   Buffer.resize(ReadSize);
+}
+
+/**
+ * @brief SCDMsgFileTail::~SCDMsgFileTail removes the file senders
+ */
+SCDMsgFileTail::~SCDMsgFileTail()
+{
+   while (!Tails.isEmpty())
+   {
+      remove(Tails.last()->sender);
+   }
+
+   if (Inotify>=0)
+   {
+      delete Notifier;
+
+      ::close(Inotify);
+   }
+}
+
+/**
+ * @brief SCDMsgFileTail::add registers a sender which posts the lines appended to a file. If the file does not exist,
+ *                            it is followed as soon as it is created.
+ * @param sender
+ * @param path
+ * @param fromStart posts also the lines already into the file
+ * @return false if the directory of file can not be watched, or sender already tails a file
+ */
+bool SCDMsgFileTail::add(QString sender, QString path, bool fromStart)
+{
+   if (Inotify<0)
+   {
+      return false;
+   }
+
+   for (int n=0; n<Tails.size(); n++)
+   {
+      if (Tails.at(n)->sender==sender)
+      {
+         return false;
+      }
+   }
+
+   QFileInfo info(path);
+
+   Tail *tail = new Tail();
+
+   tail->sender = sender;
+   tail->path   = info.absoluteFilePath();
+   tail->dir    = QFile::encodeName(info.absolutePath());
+   tail->name   = QFile::encodeName(info.fileName());
+   tail->fd     = -1;
+   tail->wd     = -1;
+   tail->inode  = 0;
+   tail->offset = 0;
+
+   tail->dirWd = ::inotify_add_watch(Inotify, tail->dir.constData(), IN_CREATE | IN_MOVED_TO);
+
+   if (tail->dirWd<0)
+   {
+      delete tail;
+      return false;
+   }
+
+   Dirs.insert(tail->dirWd,tail->dir);
+
+   Tails.append(tail);
+
+   mc->addSender(sender);
+
+   open(tail,fromStart);
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgFileTail::remove stops tailing the file of sender, and removes the sender
+ * @param sender
+ * @return false if sender not found
+ */
+bool SCDMsgFileTail::remove(QString sender)
+{
+   for (int n=0; n<Tails.size(); n++)
+   {
+      Tail *tail = Tails.at(n);
+
+      if (tail->sender!=sender)
+      {
+         continue;
+      }
+
+      close(tail);
+
+      Tails.remove(n);
+
+      bool shared = false; // directory watched for other files
+
+      for (int i=0; i<Tails.size(); i++)
+      {
+         shared = shared || Tails.at(i)->dirWd==tail->dirWd;
+      }
+
+      if (!shared)
+      {
+         ::inotify_rm_watch(Inotify,tail->dirWd);
+
+         Dirs.remove(tail->dirWd);
+      }
+
+      mc->removeSender(sender);
+
+      delete tail;
+
+      return true;
+   }
+
+   return false;
+}
+
+/**
+ * @brief SCDMsgFileTail::open opens the file and watches its changes
+ * @param tail
+ * @param fromStart reads from start of file, otherwise from its end
+ * @return false if the file does not exist
+ */
+bool SCDMsgFileTail::open(Tail *tail, bool fromStart)
+{
+   QByteArray path = QFile::encodeName(tail->path);
+
+   tail->fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+
+   if (tail->fd<0)
+   {
+      return false;
+   }
+
+   struct stat st;
+
+   ::fstat(tail->fd,&st);
+
+   tail->inode  = st.st_ino;
+   tail->offset = fromStart ? 0 : st.st_size;
+
+   tail->partial.clear();
+
+   tail->wd = ::inotify_add_watch(Inotify, path.constData(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+
+   if (tail->wd>=0)
+   {
+      Files.insert(tail->wd,tail);
+   }
+
+   if (fromStart)
+   {
+      read(tail);
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgFileTail::close closes the file and its watch
+ * @param tail
+ */
+void SCDMsgFileTail::close(Tail *tail)
+{
+   if (tail->wd>=0)
+   {
+      ::inotify_rm_watch(Inotify,tail->wd);
+
+      Files.remove(tail->wd);
+
+      tail->wd = -1;
+   }
+
+   if (tail->fd>=0)
+   {
+      ::close(tail->fd);
+
+      tail->fd = -1;
+   }
+}
+
+/**
+ * @brief SCDMsgFileTail::reopen follows a rotation: the rest of the old file is posted, and the new file is read
+ *                               from its start (it waits for the new file if it has not been created yet)
+ * @param tail
+ */
+void SCDMsgFileTail::reopen(Tail *tail)
+{
+   if (tail->fd>=0)
+   {
+      read(tail);
+
+      QStringList lines;
+
+      splitLines(&tail->partial,0,0,true,&lines); // last line without newline
+
+      if (!lines.isEmpty())
+      {
+         mc->postMessages(tail->sender,lines);
+      }
+
+      close(tail);
+   }
+
+   open(tail,true);
+}
+
+/**
+ * @brief SCDMsgFileTail::read reads the data appended to file since last read, and posts its lines
+ * @param tail
+ */
+void SCDMsgFileTail::read(Tail *tail)
+{
+   struct stat st;
+
+   if (tail->fd<0 || ::fstat(tail->fd,&st)<0)
+   {
+      return;
+   }
+
+   QStringList lines;
+
+   if (st.st_size < tail->offset) // truncated (copytruncate rotation)
+   {
+      tail->offset = 0;
+
+      tail->partial.clear();
+
+      lines.append("<file truncated>");
+   }
+
+   for (;;)
+   {
+      ssize_t size = ::pread(tail->fd, Buffer.data(), Buffer.size(), tail->offset);
+
+      if (size<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (size<=0)
+      {
+         break;
+      }
+
+      tail->offset += size;
+
+      splitLines(&tail->partial,Buffer.constData(),size,false,&lines);
+
+      if (lines.size()>=MaxBatch)
+      {
+         mc->postMessages(tail->sender,lines);
+
+         lines.clear();
+      }
+   }
+
+   if (!lines.isEmpty())
+   {
+      mc->postMessages(tail->sender,lines);
+   }
+}
+
+/**
+ * @brief SCDMsgFileTail::splitLines splits data into lines, appended to the incomplete line of previous data. A line
+ *                                   longer than MaxLine bytes is split at exactly MaxLine bytes.
+ * @param partial incomplete line: its bytes are taken before data, and it receives the incomplete line left by data
+ * @param data
+ * @param size
+ * @param flush takes also the last incomplete line
+ * @param lines receives the complete lines
+ * @param prefix prepended to each line
+ */
+void SCDMsgFileTail::splitLines(QByteArray *partial, const char *data, int size, bool flush, QStringList *lines, const QString &prefix)
+{
+   const char *end = data + size;
+
+   while (data<end)
+   {
+      const char *newline = (const char*)memchr(data, '\n', end - data);
+
+      int length = (newline ? newline : end) - data;
+
+      int room = MaxLine - partial->size();
+
+      if (length>room) // too long: the line is split
+      {
+         partial->append(data, room);
+
+         data += room;
+      }
+      else
+      {
+         partial->append(data, length);
+
+         if (!newline)
+         {
+            break;
+         }
+
+         data = newline + 1;
+
+         if (partial->endsWith('\r'))
+         {
+            partial->chop(1);
+         }
+      }
+
+      lines->append(prefix + QString::fromLocal8Bit(*partial));
+
+      partial->clear();
+   }
+
+   if (flush && !partial->isEmpty())
+   {
+      lines->append(prefix + QString::fromLocal8Bit(*partial));
+
+      partial->clear();
+   }
+}
+
+/**
+ * @brief SCDMsgFileTail::notified processes the inotify events
+ */
+void SCDMsgFileTail::notified()
+{
+   alignas(inotify_event) char events[4096];
+
+   for (;;)
+   {
+      ssize_t size = ::read(Inotify, events, sizeof(events));
+
+      if (size<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (size<=0)
+      {
+         break;
+      }
+
+      for (char *p = events; p < events + size; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+      {
+         const inotify_event *event = (const inotify_event*)p;
+
+         QHash<int,Tail*>::const_iterator file = Files.constFind(event->wd);
+
+         if (file!=Files.constEnd())
+         {
+            Tail *tail = file.value();
+
+            if (event->mask & IN_IGNORED) // watch removed by kernel (file deleted)
+            {
+               Files.remove(event->wd);
+
+               tail->wd = -1;
+            }
+            else
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) // rotated
+            {
+               reopen(tail);
+            }
+            else
+            if (event->mask & IN_MODIFY)
+            {
+               read(tail);
+            }
+            else
+            if (event->mask & IN_ATTRIB) // unlinked: IN_DELETE_SELF comes only after the file is closed
+            {
+               struct stat st;
+
+               if (tail->fd>=0 && ::fstat(tail->fd,&st)==0 && st.st_nlink==0)
+               {
+                  reopen(tail);
+               }
+            }
+
+            continue;
+         }
+
+         QHash<int,QByteArray>::const_iterator dir = Dirs.constFind(event->wd);
+
+         if (dir==Dirs.constEnd() || !(event->mask & (IN_CREATE | IN_MOVED_TO)) || event->len==0)
+         {
+            continue;
+         }
+
+         QByteArray name(event->name); // created into a watched directory: a tailed file after rotation?
+
+         for (int n=0; n<Tails.size(); n++)
+         {
+            Tail *tail = Tails.at(n);
+
+            if (tail->dirWd!=event->wd || tail->name!=name)
+            {
+               continue;
+            }
+
+            struct stat st;
+
+            if (tail->fd<0 || (::stat(QFile::encodeName(tail->path).constData(),&st)==0 && st.st_ino!=tail->inode))
+            {
+               reopen(tail);
+            }
+         }
+      }
+   }
+}
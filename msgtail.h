@@ -0,0 +1,86 @@
+#ifndef SCDMSGTAIL_H
+#define SCDMSGTAIL_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QSocketNotifier>
+
+#include <sys/types.h>
+
+class SCDMsgCenter;
+
+/**
+ * @brief The SCDMsgFileTail class posts the lines appended to log files as messages of a sender for each file.
+ *        The files are watched by inotify: an idle file costs nothing, and the new data are read by pread into a
+ *        reusable buffer, split into lines and posted as a batch (SCDMsgCenter::postMessages).
+ *        Rotation (the file is renamed or deleted and created again) and truncation (copytruncate) are followed.
+ *        Lives into the thread which creates it (an event loop is required).
+ */
+class SCDMsgFileTail : public QObject
+{
+    Q_OBJECT
+
+  public:
+
+    explicit SCDMsgFileTail(SCDMsgCenter *mc, QObject *parent = 0);
+
+    ~SCDMsgFileTail();
+
+    bool add(QString sender, QString path, bool fromStart = false);
+
+    bool remove(QString sender);
+
+    static const int MaxLine = 4096;     // longer lines are split
+
+    static void splitLines(QByteArray *partial, const char *data, int size, bool flush, QStringList *lines,
+                           const QString &prefix = QString());
+
+  private slots:
+
+    void notified();
+
+  private:
+
+    struct Tail
+    {
+       QString sender;
+       QString path;
+       QByteArray dir;      // directory of the file (watched for a new file after rotation)
+       QByteArray name;     // file name into directory
+       int fd;              // open file (-1: waiting for the file to be created)
+       int wd;              // inotify watch of the file (-1: none)
+       int dirWd;           // inotify watch of the directory
+       ino_t inode;         // inode of the open file
+       qint64 offset;       // next byte to read
+       QByteArray partial;  // last incomplete line
+    };
+
+    static const int ReadSize = 65536;   // bytes read by each pread
+    static const int MaxBatch = 1024;    // max lines posted by each batch
+
+    SCDMsgCenter *mc;
+
+    int Inotify;                       // inotify descriptor
+
+    QSocketNotifier *Notifier;
+
+    QVector<Tail*> Tails;
+
+    QHash<int,Tail*> Files;            // file watch => tail
+    QHash<int,QByteArray> Dirs;        // directory watch => directory
+
+    QByteArray Buffer;                 // read buffer, reused by all the files
+
+    bool open(Tail *tail, bool fromStart);
+
+    void close(Tail *tail);
+
+    void read(Tail *tail);
+
+
+    void reopen(Tail *tail);
+};
+
+#endif // SCDMSGTAIL_H
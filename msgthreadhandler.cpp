@@ -8,6 +8,20 @@
  *         This is a part of SCD Message Center QT Class Library a realtime messaging/commands system for exchange of
  *         inter-process messages/commands based on Tcp Socket
  *
+ *         Outgoing data are written in order: the text messages first, then one chunk of each pending binary
+ *         payload or file in turn, so that large payloads do not block the normal traffic of the connection.
+ *         Each chunk is preceded by the header line (without the "<sender>: " prefix of the messages, so that no
+ *         posted message can be taken for a chunk header):
+ *
+ *            #data|#file <transfer id> <offset> <chunk size>/<total size> <sender id|file name>
+ *
+ *         File chunks are sent by sendfile(2) directly from page cache to socket (Linux).
+ *
+ *         The sessions of a shared I/O thread do not write as soon as data arrive: they are scheduled by the thread
+ *         dispatcher, which grants to each one a byte quota for each round weighted by the user profile
+ *         (deficit round robin), so a client receiving a firehose can not monopolize the thread.
+ *         The user profile can also cap the bandwidth of all sessions of a user (see SCDMsgCenter::setUserProfile).
+ *
  *         This file must be distribuited with files:
  *
  *            - msgcenter.cpp,
@@ -16,22 +30,140 @@
  *            - msgserver.cpp,
  *            - msgserverthread.h
  *            - msgserverthread.cpp
+ *            - msgiothread.h
+ *            - msgiothread.cpp
+ *            - msgstats.h
+ *            - msgstats.cpp
+ *            - msgrules.h
+ *            - msgrules.cpp
+ *            - msghandoff.h
+ *            - msghandoff.cpp
+ *            - msgcommands.h
+ *            - msgcommands.cpp
+ *            - msgexec.h
+ *            - msgexec.cpp
+ *            - msgtail.h
+ *            - msgtail.cpp
+ *            - msgsyslog.h
+ *            - msgsyslog.cpp
+ *            - msgformat.h
+ *            - msgformat.cpp
  *
 */
 
 #include "QObject"
+#include "QCoreApplication"
 #include "msgserverthread.h"
 #include "msgthreadhandler.h"
+#include "msgiothread.h"
+
+#include <QTimer>
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#endif
 
 #define echo QTextStream(stdout) << "\n" <<
 
 /**
  * @brief SCDMsgThreadHandler::SCDMsgThreadHandler
- * @param Id
- * @param parent
+ * @param socketDescriptor
+ * @param mc
+ * @param shared true if the handler is a session hosted by a shared I/O thread, false if it owns its thread
+ */
+SCDMsgThreadHandler::SCDMsgThreadHandler(int socketDescriptor, SCDMsgCenter *mc, bool shared) :
+    SocketDescriptor(socketDescriptor), mc(mc), Socket(0), Shared(shared), Dispatcher(0),
+    OutputHead(0), OutputBytes(0), Backlog(0), Conflate(true), Sequenced(false), LineFraming(false), Draining(false), TransferId(0), RawFd(-1), RawOffset(0), RawLeft(0), RawClose(false), WriteFd(-1), WriteNotifier(0),
+    User("Anonymous"), Weight(1), Rate(0), Allowance(0), Deficit(0), Scheduled(false), CapRetry(false), ChunkTurn(false),
+    SocketMode(-1), DefaultNotSentLowat(0)
+{
+   SocketProfiles[0] = SCDMsgSocketProfile::console();
+   SocketProfiles[1] = SCDMsgSocketProfile::spy();
+}
+
+/**
+ * @brief SCDMsgThreadHandler::setSocketProfiles sets the socket options for console and spy mode (before start)
+ * @param console
+ * @param spy
+ */
+void SCDMsgThreadHandler::setSocketProfiles(const SCDMsgSocketProfile &console, const SCDMsgSocketProfile &spy)
+{
+   SocketProfiles[0] = console;
+   SocketProfiles[1] = spy;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::applySocketProfile sets the socket options of operating mode
+ * @param mode 0: console, 1: spy
+ */
+void SCDMsgThreadHandler::applySocketProfile(int mode)
+{
+   mode = mode ? 1 : 0;
+
+   if (mode==SocketMode)
+   {
+      return;
+   }
+
+   const SCDMsgSocketProfile &profile = SocketProfiles[mode];
+
+   int on = profile.noDelay ? 1 : 0;
+
+   ::setsockopt(SocketDescriptor, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+   if (profile.sendBuffer>0)
+   {
+      ::setsockopt(SocketDescriptor, SOL_SOCKET, SO_SNDBUF, &profile.sendBuffer, sizeof(profile.sendBuffer));
+   }
+
+#ifdef TCP_NOTSENT_LOWAT
+   if (SocketMode<0) // value restored by the profiles which do not set it
+   {
+      socklen_t size = sizeof(DefaultNotSentLowat);
+
+      if (::getsockopt(SocketDescriptor, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &DefaultNotSentLowat, &size)<0)
+      {
+         DefaultNotSentLowat = 0;
+      }
+   }
+
+   int lowat = profile.notSentLowat>0 ? profile.notSentLowat : DefaultNotSentLowat;
+
+   if (profile.notSentLowat>0 || (SocketMode>=0 && SocketProfiles[SocketMode].notSentLowat>0))
+   {
+      ::setsockopt(SocketDescriptor, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+   }
+#endif
+
+   if (SocketMode>=0 && SocketProfiles[SocketMode].cork && !profile.cork)
+   {
+      setCork(false);
+   }
+
+   SocketMode = mode;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::setCork corks/uncorks the socket: while corked the kernel sends only full segments
+ * @param cork
  */
-SCDMsgThreadHandler::SCDMsgThreadHandler(int socketDescriptor, SCDMsgCenter *mc) : SocketDescriptor(socketDescriptor), mc(mc)
+void SCDMsgThreadHandler::setCork(bool cork)
 {
+#ifdef TCP_CORK
+   int on = cork ? 1 : 0;
+
+   ::setsockopt(SocketDescriptor, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#else
+   Q_UNUSED(cork);
+#endif
 }
 
 /**
@@ -39,6 +171,20 @@ SCDMsgThreadHandler::SCDMsgThreadHandler(int socketDescriptor, SCDMsgCenter *mc)
  */
 SCDMsgThreadHandler::~SCDMsgThreadHandler()
 {
+   if (Dispatcher)
+   {
+      static_cast<SCDMsgIoDispatcher*>(Dispatcher)->unschedule(this);
+   }
+
+   closeTransfers();
+
+   if (WriteFd>=0)
+   {
+      delete WriteNotifier;
+
+      ::close(WriteFd);
+   }
+
    if (Socket)
    {
       delete Socket;
@@ -55,6 +201,7 @@ int SCDMsgThreadHandler::start()
 
    connect(Socket,SIGNAL(readyRead()),this,SLOT(readyRead()));         // set event for reading data from socket when avalaible
    connect(Socket,SIGNAL(disconnected()),this,SLOT(disconnected()));   // set event for closing connection;
+   connect(Socket,SIGNAL(bytesWritten(qint64)),this,SLOT(pump()));     // write next pending data
 
    if (!Socket->setSocketDescriptor(SocketDescriptor)) // Check for socket error
    {
@@ -63,9 +210,699 @@ int SCDMsgThreadHandler::start()
       return 0;
    }
 
-   connect(mc,SIGNAL(messageToClient_signal(QString,int)),this,SLOT(receiveFromMsgCenter(QString,int))); // set the slot to receive message from messge center
+   applySocketProfile(0); // console mode
+
+   return 1; // messages from message center are posted to this session (see deliver())
+}
+
+/**
+ * @brief SCDMsgThreadHandler::open starts a session hosted by a shared I/O thread (invoked into the I/O thread)
+ */
+void SCDMsgThreadHandler::open()
+{
+   if (start())
+   {
+      if (mc)
+      {
+         mc->addClient(SocketDescriptor,this); // register client to message center
+      }
+   }
+   else
+   {
+      deleteLater(); // the session is destroyed, the I/O thread continues to serve the others sessions
+   }
+}
+
+/**
+ * @brief SCDMsgThreadHandler::deliver posts a message to this session: the message will be written to the socket
+ *                                     by the thread which hosts the session. Can be called by any thread.
+ * @param msg
+ */
+void SCDMsgThreadHandler::deliver(const QString &msg)
+{
+   QCoreApplication::postEvent(this, new SCDMsgEvent(msg));
+}
+
+/**
+ * @brief SCDMsgThreadHandler::deliver posts a binary payload or a file to this session. Can be called by any thread.
+ * @param kind SCDMsgEvent::Data or SCDMsgEvent::File
+ * @param msg sender id of payload or file name
+ * @param data payload or file path
+ * @param seq sequence number of message
+ * @param encoded message encoded by the session output format (empty: console format)
+ */
+void SCDMsgThreadHandler::deliver(int kind, const QString &msg, const QByteArray &data, qint64 seq, const QByteArray &encoded)
+{
+   QCoreApplication::postEvent(this, new SCDMsgEvent(msg,kind,data,seq,encoded));
+}
+
+/**
+ * @brief SCDMsgThreadHandler::receive process a message, a payload or a file posted by message center
+ * @param kind
+ * @param msg
+ * @param data
+ * @param seq sequence number of message (written before the message in a resumable session)
+ * @param encoded message encoded by the session output format, written as is (the format writes the sequence numbers)
+ */
+void SCDMsgThreadHandler::receive(int kind, const QString &msg, const QByteArray &data, qint64 seq, const QByteArray &encoded)
+{
+   if ((kind==SCDMsgEvent::Text || kind==SCDMsgEvent::Gap) && !encoded.isEmpty())
+   {
+      queueText(encoded);
+   }
+   else
+   if (kind==SCDMsgEvent::Text || kind==SCDMsgEvent::Gap)
+   {
+      receiveFromMsgCenter(Sequenced && seq>0 ? "\n#" + QString::number(seq) + msg : msg,SocketDescriptor);
+   }
+   else
+   if (kind==SCDMsgEvent::Keyed)
+   {
+      queueKeyed(!encoded.isEmpty() ? encoded : frame(Sequenced && seq>0 ? "\n#" + QString::number(seq) + msg : msg),data);
+   }
+   else
+   if (kind==SCDMsgEvent::Sequence)
+   {
+      Sequenced = data.toInt()!=0;
+   }
+   else
+   if (kind==SCDMsgEvent::Drain) // no more messages are routed to session: its output must reach the socket first
+   {
+      Draining = true;
+
+      pump();
+   }
+   else
+   if (kind==SCDMsgEvent::Handoff) // the successor process owns a copy of the socket (output already drained): it is closed without shutdown
+   {
+      closeTransfers();
+
+      Output.clear();
+      KeyedSlots.clear();
+
+      OutputBytes = 0;
+
+      updateBacklog();
+
+      if (Socket)
+      {
+         Socket->abort();
+      }
+   }
+   else
+   if (kind==SCDMsgEvent::Conflate)
+   {
+      Conflate = data.toInt()!=0;
+   }
+   else
+   if (kind==SCDMsgEvent::Framing)
+   {
+      LineFraming = data.toInt()!=0;
+   }
+   else
+   if (kind==SCDMsgEvent::Data)
+   {
+      queueTransfer(msg,data,-1,data.size());
+   }
+   else
+   if (kind==SCDMsgEvent::Profile) // user profile: data is "<weight> <bytes per second>"
+   {
+      QList<QByteArray> profile = data.split(' ');
+
+      User      = msg;
+      Weight    = qMax(1,profile.value(0).toInt());
+      Rate      = profile.value(1).toLongLong();
+      Allowance = 0;
+   }
+   else
+   if (kind==SCDMsgEvent::Mode)
+   {
+      applySocketProfile(data.toInt());
+   }
+   else
+   if (kind==SCDMsgEvent::File)
+   {
+      int fd = ::open(data.constData(),O_RDONLY | O_CLOEXEC);
+
+      off_t size = fd<0 ? -1 : ::lseek(fd,0,SEEK_END);
+
+      if (size<0)
+      {
+         if (fd>=0)
+         {
+            ::close(fd);
+         }
+
+         receiveFromMsgCenter("\nUnable to open file: " + msg + "\n",SocketDescriptor);
+
+         return;
+      }
+
+      queueTransfer(msg,QByteArray(),fd,size);
+   }
+}
+
+/**
+ * @brief SCDMsgThreadHandler::queueKeyed queues a state message. In conflation mode, if a message with the same key is
+ *                                        still pending it is overwritten in place: a slow client receives only the
+ *                                        last value of each key, so its queue is bounded by the number of keys.
+ * @param text framed (or encoded) message
+ * @param key sender and key of the state message (a session can spy several senders)
+ */
+void SCDMsgThreadHandler::queueKeyed(const QByteArray &text, const QByteArray &key)
+{
+   if (!Conflate)
+   {
+      queueText(text);
+      return;
+   }
+
+   QHash<QByteArray,qint64>::const_iterator slot = KeyedSlots.constFind(key);
+
+   if (slot!=KeyedSlots.constEnd())
+   {
+      QByteArray &pending = Output[slot.value() - OutputHead].text;
+
+      OutputBytes -= pending.size();
+
+      pending = text; // conflated: keeps the queue position
+
+      OutputBytes += pending.size();
+
+      return;
+   }
+
+   Message message;
+
+   message.text = text;
+   message.key  = key;
+
+   KeyedSlots.insert(key,OutputHead + Output.size());
+
+   OutputBytes += message.text.size();
+
+   Output.enqueue(message);
+
+   pump();
+}
+
+/**
+ * @brief SCDMsgThreadHandler::queueText queues a framed (or encoded) text message
+ * @param text
+ */
+void SCDMsgThreadHandler::queueText(const QByteArray &text)
+{
+   Message message;
+
+   message.text = text;
+
+   OutputBytes += message.text.size();
+
+   Output.enqueue(message);
+
+   pump();
+}
+
+/**
+ * @brief SCDMsgThreadHandler::takeOutput dequeues the first pending text message
+ * @return
+ */
+QByteArray SCDMsgThreadHandler::takeOutput()
+{
+   Message message = Output.dequeue();
+
+   OutputHead++;
+
+   OutputBytes -= message.text.size();
+
+   if (!message.key.isEmpty())
+   {
+      KeyedSlots.remove(message.key);
+   }
+
+   return message.text;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::frame encodes a text message. In line framing the leading LF of the message (or of the
+ *                                   first line of a batch) is moved to its end, so a reader knows that a message
+ *                                   is complete as soon as its LF arrives.
+ * @param msg
+ * @return
+ */
+QByteArray SCDMsgThreadHandler::frame(const QString &msg) const
+{
+   QByteArray text = msg.toLatin1();
+
+   if (LineFraming && text.startsWith('\n'))
+   {
+      text.remove(0,1);
+      text.append('\n');
+   }
+
+   return text;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::queueTransfer queues a binary payload or a file to be written in chunks
+ * @param name
+ * @param data
+ * @param fd
+ * @param size
+ */
+void SCDMsgThreadHandler::queueTransfer(const QString &name, const QByteArray &data, int fd, qint64 size)
+{
+   Transfer transfer;
+
+   transfer.id     = ++TransferId;
+   transfer.name   = name.toLatin1();
+   transfer.data   = data;
+   transfer.fd     = fd;
+   transfer.offset = 0;
+   transfer.size   = size;
 
-   return 1;
+   Transfers.enqueue(transfer);
+
+   pump();
+}
+
+/**
+ * @brief SCDMsgThreadHandler::pump requests to write pending data: a session of a shared I/O thread is scheduled for
+ *                                 the next output round of the thread, a session which owns its thread writes now.
+ */
+void SCDMsgThreadHandler::pump()
+{
+   if (Dispatcher)
+   {
+      static_cast<SCDMsgIoDispatcher*>(Dispatcher)->schedule(this);
+   }
+   else
+   {
+      service(-1);
+   }
+
+   updateBacklog();
+
+   notifyDrained();
+}
+
+/**
+ * @brief SCDMsgThreadHandler::notifyDrained reports to message center that all the output has been written to the
+ *                                          socket, while a handoff is in progress
+ */
+void SCDMsgThreadHandler::notifyDrained()
+{
+   if (!Draining || !Output.isEmpty() || !Transfers.isEmpty() || RawLeft>0 || (Socket && Socket->bytesToWrite()>0))
+   {
+      return;
+   }
+
+   Draining = false;
+
+   if (mc)
+   {
+      mc->sessionDrained(SocketDescriptor);
+   }
+}
+
+/**
+ * @brief SCDMsgThreadHandler::updateBacklog publishes the bytes not yet sent to client, for the producers which
+ *                                          adapt their rate to the client (see SCDMsgExec)
+ */
+void SCDMsgThreadHandler::updateBacklog()
+{
+   Backlog.store(OutputBytes + (Socket ? Socket->bytesToWrite() : 0));
+}
+
+/**
+ * @brief SCDMsgThreadHandler::service writes pending data while the socket buffer is under HighWater, and while the
+ *                                    session credit (deficit round robin among the sessions of the I/O thread) and
+ *                                    the user bandwidth cap allow it. Text messages and chunks of the pending
+ *                                    transfers are written in turn.
+ * @param quantum credit granted for this round for each unit of weight (-1: unlimited)
+ * @return true if the session has used all its credit and has more pending data for the next round
+ */
+bool SCDMsgThreadHandler::service(qint64 quantum)
+{
+   if (!Socket || Socket->state()!=QAbstractSocket::ConnectedState)
+   {
+      return false;
+   }
+
+   if (RawLeft>0 && !sendRaw()) // nothing can be written before the end of file chunk in progress
+   {
+      return false;
+   }
+
+   if (quantum>=0)
+   {
+      Deficit += quantum * Weight;
+   }
+
+   bool cork = SocketMode>=0 && SocketProfiles[SocketMode].cork && (Output.size() + Transfers.size())>1;
+
+   if (cork) // the batch of coalesced messages leaves in full segments
+   {
+      setCork(true);
+   }
+
+   bool more = false; // credit exhausted with pending data
+
+   while (Socket->bytesToWrite() < HighWater)
+   {
+      bool chunk = !Transfers.isEmpty() && (Output.isEmpty() || ChunkTurn);
+
+      qint64 cost;
+
+      if (chunk)
+      {
+         const Transfer &transfer = Transfers.head();
+
+         cost = qMin<qint64>(ChunkSize, transfer.size - transfer.offset) + transfer.name.size() + 48;
+      }
+      else
+      if (!Output.isEmpty())
+      {
+         cost = Output.head().text.size();
+      }
+      else
+      {
+         Deficit = 0; // idle session: no credit is saved
+
+         break;
+      }
+
+      if (quantum>=0 && cost > Deficit) // credit exhausted: next round
+      {
+         more = true;
+
+         break;
+      }
+
+      if (!takeBandwidth(cost)) // user bandwidth cap reached: retried by timer
+      {
+         break;
+      }
+
+      if (quantum>=0)
+      {
+         Deficit -= cost;
+      }
+
+      if (chunk)
+      {
+         writeChunk();
+
+         ChunkTurn = false;
+
+         if (RawLeft>0 && !sendRaw()) // resumed on socket write readiness
+         {
+            break;
+         }
+      }
+      else
+      {
+         Socket->write(takeOutput());
+
+         ChunkTurn = true;
+      }
+   }
+
+   if (!more && quantum>=0) // socket buffer full or cap reached: the unused credit of this round is not saved
+   {
+      Deficit = qMin(Deficit, quantum * Weight);
+   }
+
+   Socket->flush();
+
+   if (cork)
+   {
+      setCork(false); // pushes the last partial segment
+   }
+
+   updateBacklog();
+
+   notifyDrained();
+
+   return more; // if false: idle, or socket buffer full (resumed by bytesWritten)
+}
+
+/**
+ * @brief SCDMsgThreadHandler::writeChunk writes the next chunk of the first pending transfer
+ */
+void SCDMsgThreadHandler::writeChunk()
+{
+   Transfer transfer = Transfers.dequeue();
+
+   qint64 len = qMin<qint64>(ChunkSize, transfer.size - transfer.offset);
+
+   QByteArray header = QByteArray(LineFraming ? "" : "\n") + (transfer.fd<0 ? "#data " : "#file ")
+                     + QByteArray::number(transfer.id) + " "
+                     + QByteArray::number(transfer.offset) + " "
+                     + QByteArray::number(len) + "/"
+                     + QByteArray::number(transfer.size) + " "
+                     + transfer.name + "\n";
+
+   bool last = transfer.offset + len >= transfer.size;
+
+   if (transfer.fd<0)
+   {
+      Socket->write(header);
+      Socket->write(transfer.data.constData() + transfer.offset, len);
+   }
+   else
+   {
+      Socket->write(header);
+
+#ifdef Q_OS_LINUX
+      Socket->flush(); // the header must reach the socket before the sendfile data
+
+      RawFd     = transfer.fd;
+      RawOffset = transfer.offset;
+      RawLeft   = len;
+      RawClose  = last;
+#else
+      QByteArray chunk(len,0);
+
+      if (::pread(transfer.fd, chunk.data(), len, transfer.offset)!=len)
+      {
+         chunk.fill(0); // file truncated during transfer: keeps the framing
+      }
+
+      Socket->write(chunk);
+
+      if (last)
+      {
+         ::close(transfer.fd);
+      }
+#endif
+   }
+
+   transfer.offset += len;
+
+   if (!last)
+   {
+      Transfers.enqueue(transfer); // next chunk after the others transfers
+   }
+}
+
+/**
+ * @brief SCDMsgThreadHandler::takeBandwidth takes bytes from the bandwidth allowance of the session user
+ * @param bytes
+ * @return false if the user cap is reached: the session is pumped again by a timer
+ */
+bool SCDMsgThreadHandler::takeBandwidth(qint64 bytes)
+{
+   if (Rate<=0 || !mc) // no cap
+   {
+      return true;
+   }
+
+   if (Allowance < bytes)
+   {
+      Allowance += mc->takeBandwidth(User, qMax<qint64>(bytes,ChunkSize) - Allowance);
+   }
+
+   if (Allowance < bytes)
+   {
+      if (!CapRetry)
+      {
+         CapRetry = true;
+
+         QTimer::singleShot(CapRetryInterval,this,SLOT(capExpired()));
+      }
+
+      return false;
+   }
+
+   Allowance -= bytes;
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::capExpired bandwidth allowance refilled: resumes writing
+ */
+void SCDMsgThreadHandler::capExpired()
+{
+   CapRetry = false;
+
+   pump();
+}
+
+/**
+ * @brief SCDMsgThreadHandler::sendRaw sends the file chunk in progress from page cache to socket by sendfile
+ * @return true if the chunk has been completely sent
+ */
+bool SCDMsgThreadHandler::sendRaw()
+{
+#ifdef Q_OS_LINUX
+   if (Socket->bytesToWrite()>0) // chunk header still into socket buffer: wait for bytesWritten
+   {
+      return false;
+   }
+
+   while (RawLeft>0)
+   {
+      ssize_t sent = ::sendfile(SocketDescriptor, RawFd, &RawOffset, RawLeft);
+
+      if (sent>0)
+      {
+         RawLeft -= sent;
+      }
+      else
+      if (sent<0 && errno==EINTR)
+      {
+         continue;
+      }
+      else
+      if (sent<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) // socket buffer full: wait for write readiness
+      {
+         if (WriteFd<0)
+         {
+            WriteFd = ::dup(SocketDescriptor); // the socket descriptor has already its own notifier
+
+            WriteNotifier = new QSocketNotifier(WriteFd,QSocketNotifier::Write);
+
+            connect(WriteNotifier,SIGNAL(activated(int)),this,SLOT(pump()));
+         }
+
+         WriteNotifier->setEnabled(true);
+
+         return false;
+      }
+      else // file truncated or socket error: the stream can not be resynchronized
+      {
+         RawLeft = 0;
+
+         if (RawClose) // otherwise the file is still owned by its transfer into the queue (see closeTransfers)
+         {
+            ::close(RawFd);
+         }
+
+         RawFd = -1;
+
+         Socket->abort();
+
+         return false;
+      }
+   }
+
+   if (WriteNotifier)
+   {
+      WriteNotifier->setEnabled(false);
+   }
+
+   if (RawClose)
+   {
+      ::close(RawFd);
+   }
+
+   RawFd = -1;
+#endif
+
+   return true;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::closeTransfers discards the pending transfers and closes their files
+ */
+void SCDMsgThreadHandler::closeTransfers()
+{
+   while (!Transfers.isEmpty())
+   {
+      Transfer transfer = Transfers.dequeue();
+
+      if (transfer.fd>=0)
+      {
+         ::close(transfer.fd);
+      }
+   }
+
+   if (RawFd>=0 && RawClose) // an unfinished transfer is no longer into the queue only during its last chunk
+   {
+      ::close(RawFd);
+   }
+
+   RawFd   = -1;
+   RawLeft = 0;
+}
+
+/**
+ * @brief SCDMsgThreadHandler::event process the messages posted by message center
+ * @param e
+ * @return
+ */
+bool SCDMsgThreadHandler::event(QEvent *e)
+{
+   if (e->type()==SCDMsgEvent::eventType())
+   {
+      SCDMsgEvent *msg = static_cast<SCDMsgEvent*>(e);
+
+      receive(msg->kind,msg->msg,msg->data,msg->seq,msg->encoded);
+
+      return true;
+   }
+
+   return QObject::event(e);
+}
+
+/**
+ * @brief SCDMsgThreadHandler::moveTo moves the session, its socket and its pending output to another shared I/O thread.
+ *                                    Must be called by the thread which hosts the session, after the dispatcher of
+ *                                    the new thread has been set. The events already posted to the session are
+ *                                    delivered by the new thread, in order.
+ * @param thread
+ */
+void SCDMsgThreadHandler::moveTo(QThread *thread)
+{
+   if (Socket)
+   {
+      Socket->moveToThread(thread);
+   }
+
+   if (WriteNotifier)
+   {
+      WriteNotifier->moveToThread(thread);
+   }
+
+   moveToThread(thread);
+
+   QMetaObject::invokeMethod(this,"migrated",Qt::QueuedConnection); // runs into the new thread
+}
+
+/**
+ * @brief SCDMsgThreadHandler::migrated the session has been moved to a new I/O thread: the messages are routed again
+ *                                      by the dispatcher of the new thread, and the pending output is written
+ */
+void SCDMsgThreadHandler::migrated()
+{
+   if (mc)
+   {
+      mc->setClientDispatcher(SocketDescriptor,Dispatcher);
+   }
+
+   pump();
 }
 
 /**
@@ -85,7 +922,19 @@ void SCDMsgThreadHandler::readyRead()
  */
 void SCDMsgThreadHandler::disconnected()
 {
-   thread()->quit(); 
+   if (Shared) // only this session ends, the shared I/O thread continues to run
+   {
+      if (mc)
+      {
+         mc->removeClient(SocketDescriptor);
+      }
+
+      deleteLater();
+   }
+   else
+   {
+      thread()->quit();
+   }
 }
 
 /**
@@ -100,13 +949,18 @@ void SCDMsgThreadHandler::receiveFromMsgCenter(QString msg, int toSocketDescript
    {
       if (msg.trimmed()=="exit")
       {
+         closeTransfers();
+
+         while (!Output.isEmpty())
+         {
+            Socket->write(takeOutput());
+         }
+
          Socket->close();
       }
       else
       {
-         Socket->write(msg.toLatin1());
-         Socket->flush();
-         Socket->waitForBytesWritten();
+         queueText(frame(msg));
       }
    }
 }
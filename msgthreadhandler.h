@@ -3,31 +3,119 @@
 
 #include <QThread>
 #include <QTcpSocket>
+#include <QEvent>
+#include <QQueue>
+#include <QHash>
+#include <QSocketNotifier>
+#include <QAtomicInteger>
+
+#include <sys/types.h>
 
 #include "msgserverthread.h"
 
+class SCDMsgThreadHandler;
+
+/**
+ * @brief SCDMsgEvent message posted by message center to a single client session
+ */
+class SCDMsgEvent : public QEvent
+{
+  public:
+
+    enum Kind {Text, Data, File, Profile, Mode, Keyed, Conflate, Sequence, Handoff, Framing, Drain, Gap};
+
+    explicit SCDMsgEvent(const QString &msg, int kind = Text, const QByteArray &data = QByteArray(), qint64 seq = 0,
+                         const QByteArray &encoded = QByteArray()) :
+        QEvent(eventType()), msg(msg), kind(kind), data(data), seq(seq), encoded(encoded) {}
+
+    static QEvent::Type eventType() {static int type = QEvent::registerEventType(); return QEvent::Type(type);}
+
+    QString msg;     // text message, sender id of a binary payload, name of a file or user name of a profile
+    int kind;        // Text, Data (binary payload), File (file download), Profile (session user profile), Mode,
+                     // Keyed (state message: only the last value of a key is kept), Conflate (keyed messages mode)
+                     // Sequence (sequence numbers mode), Handoff (connection passed to a restarted process),
+                     // Framing (line framing mode), Drain (report when all output is written, before handoff)
+                     // or Gap (control line: messages of a resumed session evicted from history)
+    QByteArray data; // binary payload, file path, user profile, operating mode (0: console, 1: spy), key of a keyed
+                     // message, conflation mode, sequence numbers mode, line framing mode (0: off, 1: on) or gap
+                     // ('<first> <last>')
+    qint64 seq;      // sequence number of message into its sender stream (0: none)
+    QByteArray encoded; // message encoded by the client output format, written as is (empty: console format)
+};
+
+/**
+ * @brief SCDMsgBatchEvent message posted by message center once for all sessions of a shared I/O thread
+ */
+class SCDMsgBatchEvent : public QEvent
+{
+  public:
+
+    explicit SCDMsgBatchEvent(const QString &msg, int kind = SCDMsgEvent::Text, const QByteArray &data = QByteArray(), qint64 seq = 0,
+                              const QByteArray &encoded = QByteArray()) :
+        QEvent(eventType()), msg(msg), kind(kind), data(data), seq(seq), encoded(encoded) {}
+
+    static QEvent::Type eventType() {static int type = QEvent::registerEventType(); return QEvent::Type(type);}
+
+    QString msg;
+    int kind;
+    QByteArray data;
+    qint64 seq;
+    QByteArray encoded; // shared by all the sessions (same output format)
+
+    QVector<SCDMsgThreadHandler*> sessions; // destination sessions, all living into the same I/O thread
+};
+
 class SCDMsgThreadHandler: public QObject
 {
     Q_OBJECT
 
+    friend class SCDMsgIoDispatcher;
+
   public:
 
-    explicit SCDMsgThreadHandler(int socketDescriptor,  SCDMsgCenter *mc);
+    explicit SCDMsgThreadHandler(int socketDescriptor,  SCDMsgCenter *mc, bool shared = false);
 
     ~SCDMsgThreadHandler();
 
     int start();
 
+    void deliver(const QString &msg); // thread safe: queue a message to this session
+
+    void deliver(int kind, const QString &msg, const QByteArray &data, qint64 seq = 0, const QByteArray &encoded = QByteArray()); // thread safe: queue a payload or a file
+
+    void receive(int kind, const QString &msg, const QByteArray &data, qint64 seq = 0, const QByteArray &encoded = QByteArray());
+
+    int socketDescriptor() {return SocketDescriptor;}
+
+    qint64 backlog() const {return Backlog.load();} // thread safe: bytes of text messages not yet sent to client
+
+    QObject *dispatcher() {return Dispatcher;}
+
+    void setDispatcher(QObject *dispatcher) {Dispatcher = dispatcher;}
+
+    bool event(QEvent *e);
+
+    void setSocketProfiles(const SCDMsgSocketProfile &console, const SCDMsgSocketProfile &spy);
+
+    void moveTo(QThread *thread); // move the session with its socket to another I/O thread (called by hosting thread)
+
   signals:
 
     void error(QTcpSocket::SocketError SocketError);
 
   public slots:
 
+    void open();
     void readyRead();
     void disconnected();
     void receiveFromMsgCenter(QString msg, int toSocketDescriptor);
 
+  private slots:
+
+    void pump();
+    void capExpired();
+    void migrated();
+
   private:
 
     int SocketDescriptor; // descriptor(handle) of current socket
@@ -35,6 +123,104 @@ class SCDMsgThreadHandler: public QObject
     SCDMsgCenter *mc;
 
     QTcpSocket *Socket;   // socket of current connection
+
+    bool Shared;          // session lives into a shared I/O thread (SCDMsgIoThread)
+
+    QObject *Dispatcher;  // batch message dispatcher of the shared I/O thread (null if the session owns its thread)
+
+    /**
+     * @brief The Transfer struct a binary payload or a file streamed to client in chunks
+     */
+    struct Transfer
+    {
+       int id;
+       QByteArray name;  // sender id or file name
+       QByteArray data;  // binary payload (empty for files)
+       int fd;           // file descriptor (-1 for binary payloads)
+       qint64 offset;    // next chunk offset
+       qint64 size;      // payload or file size
+    };
+
+    static const int ChunkSize = 16384;       // max chunk size of payloads and files
+    static const int HighWater = 65536;       // socket buffer level under which pending data are written
+    static const int CapRetryInterval = 20;   // ms before retrying to write when the user bandwidth cap is reached
+
+    /**
+     * @brief The Message struct a pending text message
+     */
+    struct Message
+    {
+       QByteArray text;
+       QByteArray key;   // key of a state message (empty: not keyed)
+    };
+
+    QQueue<Message> Output;      // pending text messages
+    qint64 OutputHead;           // number of messages dequeued from Output (position of Output head)
+    qint64 OutputBytes;          // size of pending text messages
+
+    QAtomicInteger<qint64> Backlog; // pending text messages and socket buffer (read by producers to slow down)
+
+    QHash<QByteArray,qint64> KeyedSlots; // sender and key => position of its pending state message into Output
+    bool Conflate;                       // a state message overwrites the pending message with the same key
+
+    bool Sequenced; // messages are preceded by their sequence number (resumable session)
+
+    bool LineFraming; // messages are terminated by LF instead of preceded by it (see 'framing' command)
+
+    bool Draining;    // handoff in progress: report to message center when all output has been written
+
+    QQueue<Transfer> Transfers;  // pending payloads and files: a chunk of each one is written in turn
+
+    int TransferId;        // last transfer id
+
+    int RawFd;             // file of the chunk in progress (sent by sendfile directly to socket descriptor)
+    off_t RawOffset;       // next byte of the chunk in progress
+    qint64 RawLeft;        // bytes of the chunk in progress still to send
+    bool RawClose;         // close the file at the end of chunk in progress (last chunk)
+
+    int WriteFd;                     // duplicated socket descriptor, used to wait for socket write readiness
+    QSocketNotifier *WriteNotifier;  // notifies write readiness when sendfile would block
+
+    QString User;      // session user
+    int Weight;        // output share into the I/O thread
+    qint64 Rate;       // user bandwidth cap (bytes per second, 0: no cap)
+    qint64 Allowance;  // bandwidth taken from user cap and not yet used
+    qint64 Deficit;    // output credit of deficit round robin
+    bool Scheduled;    // session is into the ready list of the I/O thread dispatcher
+    bool CapRetry;     // retry timer armed after user cap has been reached
+    bool ChunkTurn;    // next item to write is a transfer chunk (text messages and chunks are written in turn)
+
+    void queueTransfer(const QString &name, const QByteArray &data, int fd, qint64 size);
+
+    void queueKeyed(const QByteArray &text, const QByteArray &key);
+
+    void queueText(const QByteArray &text);
+
+    QByteArray takeOutput();
+
+    QByteArray frame(const QString &msg) const;
+
+    void updateBacklog();
+
+    bool service(qint64 quantum);
+
+    void writeChunk();
+
+    bool takeBandwidth(qint64 bytes);
+
+    bool sendRaw();
+
+    void closeTransfers();
+
+    void notifyDrained();
+
+    SCDMsgSocketProfile SocketProfiles[2]; // socket options for console mode and spy mode
+    int SocketMode;                        // current operating mode (-1: no profile applied)
+    int DefaultNotSentLowat;               // TCP_NOTSENT_LOWAT of the socket before the first profile (0: none)
+
+    void applySocketProfile(int mode);
+
+    void setCork(bool cork);
 };
 
 #endif // SCDMESSAGETHREADHANDLER_H
@@ -0,0 +1,409 @@
+/**
+ * @class  BenchClients - https://github.com/sc-develop/SCD-MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ * @brief SCD Message Center Benchmark: connection churn and per-connection memory
+ *
+ *        This is a part of SCD Message Center Benchmark Program
+ *
+*/
+
+#include <QTextStream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "benchclients.h"
+
+/**
+ * @brief BenchClients::BenchClients
+ * @param parent
+ * @param port message center port
+ */
+BenchClients::BenchClients(QObject *parent, int port) :
+    QThread(parent),
+    port(port),
+    Budget(0),
+    Concurrency(16),
+    Seconds(3),
+    Result(0)
+{
+
+}
+
+/**
+ * @brief BenchClients::run => thread main function: runs the steps (fewest clients first) and prints a row for each
+ *                             one. The RSS of each step is measured from a baseline taken before the first step: the
+ *                             memory freed by the closed sessions stays in the process and is reused by the next step,
+ *                             so a baseline taken at each step would not count it.
+ */
+void BenchClients::run()
+{
+   QTextStream out(stdout);
+
+   clock.start();
+
+   QThread::msleep(500); // message center server is started by main thread
+
+   out << "clients   ttfp p50 us   ttfp p99 us   rss/conn bytes   connects/s\n";
+   out.flush();
+
+   QVector<int> steps = Steps;
+
+   std::sort(steps.begin(), steps.end());
+
+   qint64 base = rss();
+
+   for (int s=0; s<steps.size(); s++)
+   {
+      int count = steps.at(s);
+
+      QVector<int> fds;
+
+      QVector<qint64> latencies;
+
+      if (!connectAll(count,&fds,&latencies))
+      {
+         out << count << ": unable to connect all the clients (" << fds.size() << " connected)\n";
+
+         closeAll(&fds);
+
+         Result = 1;
+         break;
+      }
+
+      QThread::msleep(1000); // server threads settle
+
+      qint64 perConnection = (rss() - base) / qMax(1,count);
+
+      qint64 cycles = churn(Concurrency,Seconds);
+
+      out << QString("%1%2%3%4%5").arg(count,7)
+                                  .arg(percentile(latencies,50) / 1000,14)
+                                  .arg(percentile(latencies,99) / 1000,14)
+                                  .arg(perConnection,17)
+                                  .arg(cycles / qMax(1,Seconds),13);
+
+      if (Budget>0 && perConnection>Budget)
+      {
+         out << "   over budget (" << Budget << " bytes)";
+
+         Result = 1;
+      }
+
+      out << "\n";
+      out.flush();
+
+      closeAll(&fds);
+
+      QThread::msleep(2000); // server sessions end
+   }
+}
+
+/**
+ * @brief BenchClients::open starts a non blocking connection to message center
+ * @param conn
+ * @return
+ */
+bool BenchClients::open(Connection *conn)
+{
+   conn->fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (conn->fd<0)
+   {
+      return false;
+   }
+
+   sockaddr_in addr;
+
+   memset(&addr,0,sizeof(addr));
+
+   addr.sin_family      = AF_INET;
+   addr.sin_port        = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   conn->start   = clock.nsecsElapsed();
+   conn->tail[0] = 0;
+   conn->tail[1] = 0;
+
+   if (::connect(conn->fd,(sockaddr*)&addr,sizeof(addr))<0 && errno!=EINPROGRESS)
+   {
+      ::close(conn->fd);
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * @brief BenchClients::receive reads the connection, looking for the prompt ':> '
+ * @param conn
+ * @return 1 prompt received, 0 not yet, -1 connection closed
+ */
+int BenchClients::receive(Connection *conn)
+{
+   char buffer[4096];
+
+   ssize_t size = ::read(conn->fd, buffer, sizeof(buffer));
+
+   if (size<0 && (errno==EAGAIN || errno==EINTR))
+   {
+      return 0;
+   }
+
+   if (size<=0)
+   {
+      return -1;
+   }
+
+   for (ssize_t n=0; n<size; n++)
+   {
+      if (buffer[n]==' ' && conn->tail[0]==':' && conn->tail[1]=='>')
+      {
+         return 1;
+      }
+
+      conn->tail[0] = conn->tail[1];
+      conn->tail[1] = buffer[n];
+   }
+
+   return 0;
+}
+
+/**
+ * @brief BenchClients::connectAll connects count clients, at most InFlight at the same time
+ * @param count
+ * @param fds receives the connected sockets (closed by the caller, also on failure)
+ * @param latencies receives the time to first prompt of each connection (ns)
+ * @return false if a connection failed
+ */
+bool BenchClients::connectAll(int count, QVector<int> *fds, QVector<qint64> *latencies)
+{
+   QVector<Connection> pending;
+
+   QVector<pollfd> polled;
+
+   int started = 0;
+
+   bool failed = false;
+
+   while (!failed && fds->size()<count)
+   {
+      while (pending.size()<InFlight && started<count)
+      {
+         Connection conn;
+
+         if (!open(&conn))
+         {
+            failed = true;
+            break;
+         }
+
+         pending.append(conn);
+
+         started++;
+      }
+
+      if (failed)
+      {
+         break;
+      }
+
+      polled.resize(pending.size());
+
+      for (int n=0; n<pending.size(); n++)
+      {
+         polled[n].fd      = pending.at(n).fd;
+         polled[n].events  = POLLIN;
+         polled[n].revents = 0;
+      }
+
+      if (::poll(polled.data(), polled.size(), 100)<0 && errno!=EINTR)
+      {
+         failed = true;
+         break;
+      }
+
+      for (int n=pending.size()-1; n>=0; n--)
+      {
+         Connection &conn = pending[n];
+
+         int received = polled.at(n).revents ? receive(&conn) : 0;
+
+         if (received==0 && clock.nsecsElapsed() - conn.start > qint64(Timeout) * 1000000)
+         {
+            received = -1;
+         }
+
+         if (received==1)
+         {
+            latencies->append(clock.nsecsElapsed() - conn.start);
+
+            fds->append(conn.fd);
+         }
+         else
+         if (received<0)
+         {
+            ::close(conn.fd);
+
+            failed = true;
+         }
+
+         if (received!=0)
+         {
+            pending.remove(n);
+         }
+      }
+   }
+
+   for (int n=0; n<pending.size(); n++) // connections not completed on failure
+   {
+      ::close(pending.at(n).fd);
+   }
+
+   return !failed;
+}
+
+/**
+ * @brief BenchClients::churn connects, waits for the prompt and closes concurrency clients in loop
+ * @param concurrency
+ * @param seconds
+ * @return completed connect/prompt/close cycles
+ */
+qint64 BenchClients::churn(int concurrency, int seconds)
+{
+   QVector<Connection> conns(concurrency);
+
+   QVector<pollfd> polled(concurrency);
+
+   for (int n=0; n<concurrency; n++)
+   {
+      if (!open(&conns[n]))
+      {
+         conns[n].fd = -1;
+      }
+   }
+
+   qint64 cycles = 0;
+
+   qint64 end = clock.elapsed() + seconds * 1000;
+
+   while (clock.elapsed()<end)
+   {
+      for (int n=0; n<concurrency; n++)
+      {
+         polled[n].fd      = conns.at(n).fd;
+         polled[n].events  = POLLIN;
+         polled[n].revents = 0;
+      }
+
+      ::poll(polled.data(), polled.size(), 100);
+
+      for (int n=0; n<concurrency; n++)
+      {
+         Connection &conn = conns[n];
+
+         if (conn.fd>=0 && polled.at(n).revents==0)
+         {
+            continue;
+         }
+
+         int received = conn.fd>=0 ? receive(&conn) : -1;
+
+         if (received==0)
+         {
+            continue;
+         }
+
+         if (received==1)
+         {
+            cycles++;
+         }
+
+         if (conn.fd>=0)
+         {
+            ::close(conn.fd);
+         }
+
+         if (!open(&conn))
+         {
+            conn.fd = -1;
+         }
+      }
+   }
+
+   for (int n=0; n<concurrency; n++)
+   {
+      if (conns.at(n).fd>=0)
+      {
+         ::close(conns.at(n).fd);
+      }
+   }
+
+   return cycles;
+}
+
+/**
+ * @brief BenchClients::closeAll
+ * @param fds
+ */
+void BenchClients::closeAll(QVector<int> *fds)
+{
+   for (int n=0; n<fds->size(); n++)
+   {
+      ::close(fds->at(n));
+   }
+
+   fds->clear();
+}
+
+/**
+ * @brief BenchClients::rss resident set size of process
+ * @return bytes
+ */
+qint64 BenchClients::rss()
+{
+   long pages = 0;
+
+   FILE *statm = fopen("/proc/self/statm","r");
+
+   if (statm)
+   {
+      if (fscanf(statm,"%*s %ld",&pages)!=1)
+      {
+         pages = 0;
+      }
+
+      fclose(statm);
+   }
+
+   return qint64(pages) * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief BenchClients::percentile
+ * @param values
+ * @param percent
+ * @return
+ */
+qint64 BenchClients::percentile(QVector<qint64> values, int percent)
+{
+   if (values.isEmpty())
+   {
+      return 0;
+   }
+
+   std::sort(values.begin(), values.end());
+
+   return values.at(qMin(values.size()-1, values.size() * percent / 100));
+}
@@ -0,0 +1,79 @@
+#ifndef BENCHCLIENTS_H
+#define BENCHCLIENTS_H
+
+#include <QThread>
+#include <QVector>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+/**
+ * @brief The BenchClients class connection churn and per-connection memory benchmark of message center.
+ *        For each step (number of idle clients) it measures:
+ *
+ *           - the time to first prompt of each connection, while the step clients are connected
+ *           - the RSS of process per idle connection, once all clients have received their prompt
+ *           - the sustained connects per second of a pool of churning clients (connect, prompt, close), while the
+ *             idle clients stay connected
+ *
+ *        The clients are plain non blocking sockets polled by this thread, so their user space memory (a few bytes
+ *        each) does not bias the RSS measured for the server side of the connections.
+ */
+class BenchClients : public QThread
+{
+    Q_OBJECT
+
+    public:
+
+      explicit BenchClients(QObject *parent = 0, int port = 12347);
+
+      void setSteps(QVector<int> steps) {Steps = steps;}
+
+      void setBudget(qint64 bytes) {Budget = bytes;}
+
+      void setChurn(int concurrency, int seconds) {Concurrency = concurrency; Seconds = seconds;}
+
+      void run(); // thread execution
+
+      int result() {return Result;} // 0: all steps within budget
+
+    private:
+
+      struct Connection
+      {
+         int fd;
+         qint64 start;   // ns of clock at connect
+         char tail[2];   // last bytes received, to find the prompt across reads
+      };
+
+      static const int InFlight = 64;     // connections waiting for their prompt at the same time
+      static const int Timeout  = 30000;  // ms to receive a prompt
+
+      int port;
+
+      QVector<int> Steps;
+
+      qint64 Budget;  // max bytes of RSS per idle connection
+
+      int Concurrency;
+      int Seconds;
+
+      int Result;
+
+      QElapsedTimer clock;
+
+      bool open(Connection *conn);
+
+      int receive(Connection *conn);
+
+      bool connectAll(int count, QVector<int> *fds, QVector<qint64> *latencies);
+
+      qint64 churn(int concurrency, int seconds);
+
+      static void closeAll(QVector<int> *fds);
+
+      static qint64 rss();
+
+      static qint64 percentile(QVector<qint64> values, int percent);
+};
+
+#endif // BENCHCLIENTS_H
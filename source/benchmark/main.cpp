@@ -0,0 +1,109 @@
+/**
+
+  @author Ing. Salvatore Cerami dev.salvatore.cerami@gmail.com
+
+  @brief SCD Message Center Benchmark - https://github.com/sc-develop/SCD-MC
+
+         This program measures the cost of the client connections of SCD Message Center: sustained connects per second,
+         time to first prompt and RSS per idle connection, for a list of client counts. The exit code is 1 if the RSS
+         per idle connection exceeds the configured budget.
+
+*/
+
+#include <QCoreApplication>
+#include <QSettings>
+#include <QStringList>
+#include <msgserver.h>
+#include "benchclients.h"
+
+#include <sys/resource.h>
+
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   QSettings cfg("message-center-bench.cfg");
+
+   cfg.beginGroup("MessageCenter");
+
+   int mcport = cfg.value("port",12347).toInt();     // load message center server port value and set default if not exists
+
+   cfg.setValue("port",mcport);                      // save value
+
+   int mcthreads = cfg.value("ioThreads",0).toInt(); // load number of message center shared I/O threads (0: one thread for each connection)
+
+   cfg.setValue("ioThreads",mcthreads);              // save value
+
+   cfg.endGroup();
+
+   cfg.beginGroup("Benchmark");
+
+   QString steps = cfg.value("clients","100,1000,10000").toString(); // idle clients of each step
+
+   cfg.setValue("clients",steps);
+
+   qint64 budget = cfg.value("budget",65536).toLongLong();         // max RSS bytes per idle connection (0: no budget)
+
+   cfg.setValue("budget",budget);
+
+   int concurrency = cfg.value("churnClients",16).toInt();          // clients connecting and disconnecting in loop
+
+   cfg.setValue("churnClients",concurrency);
+
+   int seconds = cfg.value("churnSeconds",3).toInt();               // churn duration of each step
+
+   cfg.setValue("churnSeconds",seconds);
+
+   cfg.endGroup();
+
+   cfg.sync();
+
+   QVector<int> counts;
+
+   int maxCount = 0;
+
+   QStringList list = steps.split(',',QString::SkipEmptyParts);
+
+   for (int n=0; n<list.size(); n++)
+   {
+      counts.append(list.at(n).trimmed().toInt());
+
+      maxCount = qMax(maxCount,counts.last());
+   }
+
+   rlimit files;
+
+   if (getrlimit(RLIMIT_NOFILE,&files)==0) // both ends of each connection are descriptors of this process
+   {
+      files.rlim_cur = files.rlim_max;
+
+      setrlimit(RLIMIT_NOFILE,&files);
+
+      if (files.rlim_cur < rlim_t(2 * (maxCount + concurrency) + 64))
+      {
+         qDebug() << "Warning: open files limit" << qint64(files.rlim_cur) << "is too low for" << maxCount << "clients";
+      }
+   }
+
+   SCDMsgServer msgServer(mcport,false);  // declare message center server
+
+   msgServer.setIoThreads(mcthreads);     // host the client sessions on shared I/O threads
+
+   msgServer.start();                     // start message center server
+
+   BenchClients bench(Q_NULLPTR,mcport);
+
+   bench.setSteps(counts);
+   bench.setBudget(budget);
+   bench.setChurn(concurrency,seconds);
+
+   QObject::connect(&bench,SIGNAL(finished()),&a,SLOT(quit()));
+
+   bench.start();
+
+   a.exec();                              // start application main event loop, until benchmark end
+
+   bench.wait();
+
+   return bench.result();
+}
@@ -0,0 +1,47 @@
+QT -= gui
+QT += network
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which as been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH = ../../
+
+SOURCES += main.cpp \
+    ../../msgcenter.cpp \
+    ../../msgserver.cpp \
+    ../../msgserverthread.cpp \
+    ../../msgthreadhandler.cpp \
+    ../../msgiothread.cpp \
+    ../../msgstats.cpp \
+    ../../msgrules.cpp \
+    ../../msghandoff.cpp \
+    ../../msgcommands.cpp \
+    ../../msgexec.cpp \
+    ../../msgtail.cpp \
+    ../../msgsyslog.cpp \
+    ../../msgformat.cpp \
+    benchclients.cpp
+
+DESTDIR = ../../bin
+
+HEADERS += \
+    ../../msgcenter.h \
+    ../../msgserver.h \
+    ../../msgserverthread.h \
+    ../../msgthreadhandler.h \
+    ../../msgiothread.h \
+    ../../msgstats.h \
+    ../../msgrules.h \
+    ../../msghandoff.h \
+    ../../msgcommands.h \
+    ../../msgexec.h \
+    ../../msgtail.h \
+    ../../msgsyslog.h \
+    ../../msgformat.h \
+    benchclients.h
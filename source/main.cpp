@@ -11,6 +11,8 @@
 #include <QCoreApplication>
 #include <QSettings>
 #include <msgserver.h>
+#include <msgtail.h>
+#include <msgsyslog.h>
 #include <demoserver.h>
 
 int main(int argc, char *argv[])
@@ -29,12 +31,72 @@ int main(int argc, char *argv[])
 
    cfg.setValue("port",mcport);                  // save value
 
+   int mcthreads = cfg.value("ioThreads",0).toInt(); // load number of message center shared I/O threads (0: one thread for each connection)
+
+   cfg.setValue("ioThreads",mcthreads);             // save value
+
+   int mcrebalance = cfg.value("ioRebalance",1000).toInt(); // load ms between load checks of I/O threads (0: sessions never moved)
+
+   cfg.setValue("ioRebalance",mcrebalance);                // save value
+
+   QString mchandoff = cfg.value("handoff","").toString(); // load unix socket path of handoff to restarted process (empty: no handoff)
+
+   cfg.setValue("handoff",mchandoff);                     // save value
+
+   QString mcsyslog = cfg.value("syslog","").toString();   // load unix socket path receiving syslog messages (empty: no syslog)
+
+   cfg.setValue("syslog",mcsyslog);                       // save value
+
+   cfg.endGroup();
+
+   cfg.beginGroup("TailFiles");                 // log files posted by message center as senders: <sender id>=<file path>
+
+   QStringList tailSenders = cfg.childKeys();
+
+   QStringList tailPaths;
+
+   for (int n=0; n<tailSenders.size(); n++)
+   {
+      tailPaths.append(cfg.value(tailSenders.at(n)).toString());
+   }
+
+   cfg.endGroup();
+
    cfg.sync();
 
    SCDMsgServer msgServer(mcport,true);  // declare message center server
 
+   msgServer.setIoThreads(mcthreads);    // host the client sessions on shared I/O threads
+   msgServer.setIoRebalance(mcrebalance); // move heavy sessions from overloaded I/O threads
+
+   if (!mchandoff.isEmpty())
+   {
+      msgServer.takeOver(mchandoff);    // take over listening socket, clients and state from the outgoing process, if any
+   }
+
    msgServer.start();                 // start message center server: message center is self allocated by messgae server
 
+   if (!mchandoff.isEmpty())
+   {
+      msgServer.enableHandoff(mchandoff); // wait for the next restarted process
+
+      QObject::connect(&msgServer,SIGNAL(handedOff()),&a,SLOT(quit()));
+   }
+
+   SCDMsgFileTail tail(msgServer.messageCenter()); // follows the log files (like tail -F)
+
+   for (int n=0; n<tailSenders.size(); n++)
+   {
+      tail.add(tailSenders.at(n),tailPaths.at(n));
+   }
+
+   SCDMsgSyslog logSocket(msgServer.messageCenter()); // posts syslog messages by sender 'syslog.<app name>'
+
+   if (!mcsyslog.isEmpty())
+   {
+      logSocket.listen(mcsyslog);
+   }
+
    DemoServer server(Q_NULLPTR, port, msgServer.messageCenter()); // declare application server
 
    server.start();                       // start application server
@@ -22,6 +22,15 @@ SOURCES += main.cpp \
     ../msgserver.cpp \
     ../msgserverthread.cpp \
     ../msgthreadhandler.cpp \
+    ../msgiothread.cpp \
+    ../msgstats.cpp \
+    ../msgrules.cpp \
+    ../msghandoff.cpp \
+    ../msgcommands.cpp \
+    ../msgexec.cpp \
+    ../msgtail.cpp \
+    ../msgsyslog.cpp \
+    ../msgformat.cpp \
     demoserver.cpp \
     demoserverthread.cpp
 
@@ -32,5 +41,14 @@ HEADERS += \
     ../msgserver.h \
     ../msgserverthread.h \
     ../msgthreadhandler.h \
+    ../msgiothread.h \
+    ../msgstats.h \
+    ../msgrules.h \
+    ../msghandoff.h \
+    ../msgcommands.h \
+    ../msgexec.h \
+    ../msgtail.h \
+    ../msgsyslog.h \
+    ../msgformat.h \
     demoserver.h \
     demoserverthread.h
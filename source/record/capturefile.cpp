@@ -0,0 +1,331 @@
+/**
+ * @class  CaptureWriter, CaptureReader - https://github.com/sc-develop/SCD-MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ * @brief SCD Message Center Record/Replay: capture file of message traffic
+ *
+ *        This is a part of SCD Message Center Record and Replay Programs
+ *
+*/
+
+#include "capturefile.h"
+
+#include <QFile>
+#include <QDateTime>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char Magic[] = "SCDMCAP1";
+
+/**
+ * @brief CaptureWriter::open creates the capture file and writes its header
+ * @param path
+ * @return false if the file can not be created
+ */
+bool CaptureWriter::open(QString path)
+{
+   close();
+
+   Fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+   if (Fd<0)
+   {
+      return false;
+   }
+
+   Failed   = false;
+   Last     = 0;
+   Messages = 0;
+
+   Senders.clear();
+
+   Buffer.reserve(BufferSize + 65536);
+
+   Buffer.append(Magic,8);
+
+   varint(QDateTime::currentMSecsSinceEpoch());
+
+   return true;
+}
+
+/**
+ * @brief CaptureWriter::close flushes and closes the file
+ */
+void CaptureWriter::close()
+{
+   if (Fd<0)
+   {
+      return;
+   }
+
+   flush();
+
+   ::close(Fd);
+
+   Fd = -1;
+}
+
+/**
+ * @brief CaptureWriter::sender gets the id of a sender, writing its definition at first use
+ * @param name
+ * @return
+ */
+int CaptureWriter::sender(const QString &name)
+{
+   QHash<QString,int>::const_iterator found = Senders.constFind(name);
+
+   if (found!=Senders.constEnd())
+   {
+      return found.value();
+   }
+
+   int id = Senders.size();
+
+   QByteArray utf8 = name.toUtf8();
+
+   Buffer.append('S');
+
+   varint(id);
+   varint(utf8.size());
+
+   Buffer.append(utf8);
+
+   Senders.insert(name,id);
+
+   return id;
+}
+
+/**
+ * @brief CaptureWriter::write appends a message
+ * @param sender sender id (see sender())
+ * @param usecs time from start of capture
+ * @param text
+ * @param size
+ */
+void CaptureWriter::write(int sender, qint64 usecs, const char *text, int size)
+{
+   Buffer.append('M');
+
+   varint(qMax<qint64>(0, usecs - Last));
+   varint(sender);
+   varint(size);
+
+   Buffer.append(text,size);
+
+   Last = qMax(Last,usecs);
+
+   Messages++;
+
+   if (Buffer.size()>=BufferSize)
+   {
+      flush();
+   }
+}
+
+/**
+ * @brief CaptureWriter::flush writes the buffer
+ */
+void CaptureWriter::flush()
+{
+   const char *data = Buffer.constData();
+
+   int left = Buffer.size();
+
+   while (left>0 && !Failed && Fd>=0)
+   {
+      ssize_t size = ::write(Fd, data, left);
+
+      if (size<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (size<0)
+      {
+         Failed = true;
+         break;
+      }
+
+      data += size;
+      left -= size;
+   }
+
+   Buffer.resize(0);
+}
+
+/**
+ * @brief CaptureWriter::varint appends an unsigned LEB128 value
+ * @param value
+ */
+void CaptureWriter::varint(quint64 value)
+{
+   while (value>=0x80)
+   {
+      Buffer.append(char(value | 0x80));
+
+      value >>= 7;
+   }
+
+   Buffer.append(char(value));
+}
+
+/**
+ * @brief CaptureReader::open maps the capture file
+ * @param path
+ * @return false if the file can not be read or it is not a capture
+ */
+bool CaptureReader::open(QString path)
+{
+   close();
+
+   int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+
+   if (fd<0)
+   {
+      return false;
+   }
+
+   struct stat st;
+
+   if (::fstat(fd,&st)<0 || st.st_size<8)
+   {
+      ::close(fd);
+      return false;
+   }
+
+   void *data = ::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+   ::close(fd);
+
+   if (data==MAP_FAILED)
+   {
+      return false;
+   }
+
+   ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+   Data = (const char*)data;
+   Size = st.st_size;
+   Pos  = 8;
+
+   quint64 start;
+
+   if (memcmp(Data,Magic,8)!=0 || !varint(&start))
+   {
+      close();
+      return false;
+   }
+
+   Start = start;
+   Body  = Pos;
+
+   rewind();
+
+   return true;
+}
+
+/**
+ * @brief CaptureReader::close unmaps the file
+ */
+void CaptureReader::close()
+{
+   if (Data)
+   {
+      ::munmap((void*)Data, Size);
+   }
+
+   Data = 0;
+   Size = 0;
+}
+
+/**
+ * @brief CaptureReader::rewind restarts from the first record
+ */
+void CaptureReader::rewind()
+{
+   Pos  = Body;
+   Time = 0;
+}
+
+/**
+ * @brief CaptureReader::next reads the next message; the sender definitions are collected into senders()
+ * @param record
+ * @return false at end of capture
+ */
+bool CaptureReader::next(Record *record)
+{
+   while (Pos<Size)
+   {
+      char type = Data[Pos++];
+
+      quint64 id, size;
+
+      if (type=='S')
+      {
+         if (!varint(&id) || !varint(&size) || size>quint64(Size - Pos))
+         {
+            return false;
+         }
+
+         if (id==quint64(Senders.size())) // defined again after rewind: already known
+         {
+            Senders.append(QString::fromUtf8(Data + Pos, size));
+         }
+
+         Pos += size;
+
+         continue;
+      }
+
+      quint64 delta;
+
+      if (type!='M' || !varint(&delta) || !varint(&id) || !varint(&size) || size>quint64(Size - Pos) || id>=quint64(Senders.size()))
+      {
+         return false;
+      }
+
+      Time += delta;
+
+      record->sender = id;
+      record->usecs  = Time;
+      record->text   = Data + Pos;
+      record->size   = size;
+
+      Pos += size;
+
+      return true;
+   }
+
+   return false;
+}
+
+/**
+ * @brief CaptureReader::varint reads an unsigned LEB128 value
+ * @param value
+ * @return false if truncated
+ */
+bool CaptureReader::varint(quint64 *value)
+{
+   *value = 0;
+
+   for (int shift=0; Pos<Size && shift<64; shift+=7)
+   {
+      unsigned char byte = Data[Pos++];
+
+      *value |= quint64(byte & 0x7F) << shift;
+
+      if (!(byte & 0x80))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
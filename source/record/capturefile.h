@@ -0,0 +1,108 @@
+#ifndef CAPTUREFILE_H
+#define CAPTUREFILE_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+
+/**
+ * @brief Capture file of message traffic, written by mc-record and read by mc-replay.
+ *
+ *        header:  "SCDMCAP1" <start time: varint, msecs since epoch>
+ *        records: 'S' <sender id: varint> <name size: varint> <name>                   sender definition
+ *                 'M' <delta time: varint, usecs> <sender id: varint> <size: varint> <text>   message
+ *
+ *        The varints are unsigned LEB128; the delta time is from the previous message. The messages of a batch
+ *        (received together) have delta time 0, and they are replayed as a batch.
+ */
+class CaptureWriter
+{
+    public:
+
+      CaptureWriter() : Fd(-1), Failed(false), Last(0), Messages(0) {}
+
+      ~CaptureWriter() {close();}
+
+      bool open(QString path);
+
+      void close();
+
+      int sender(const QString &name); // id of sender, defined at first use
+
+      void write(int sender, qint64 usecs, const char *text, int size);
+
+      void flush();
+
+      bool failed() const {return Failed;}
+
+      quint64 messages() const {return Messages;}
+
+    private:
+
+      static const int BufferSize = 1048576;
+
+      int Fd;
+
+      bool Failed;
+
+      QByteArray Buffer;
+
+      QHash<QString,int> Senders;
+
+      qint64 Last;       // time of last message (usecs from start)
+
+      quint64 Messages;
+
+      void varint(quint64 value);
+};
+
+class CaptureReader
+{
+    public:
+
+      /**
+       * @brief The Record struct a message, pointing into the mapped file
+       */
+      struct Record
+      {
+         int sender;       // index into senders()
+         qint64 usecs;     // time from start of capture
+         const char *text;
+         int size;
+      };
+
+      CaptureReader() : Data(0), Size(0), Pos(0), Body(0), Time(0), Start(0) {}
+
+      ~CaptureReader() {close();}
+
+      bool open(QString path);
+
+      void close();
+
+      bool next(Record *record); // false at end of capture (or on a truncated record)
+
+      void rewind();
+
+      const QStringList &senders() const {return Senders;}
+
+      qint64 start() const {return Start;}
+
+    private:
+
+      const char *Data;  // mapped file
+
+      qint64 Size;
+      qint64 Pos;        // next record
+      qint64 Body;       // first record
+
+      qint64 Time;       // time of last message read
+
+      qint64 Start;      // start time (msecs since epoch)
+
+      QStringList Senders;
+
+      bool varint(quint64 *value);
+};
+
+#endif // CAPTUREFILE_H
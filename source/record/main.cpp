@@ -0,0 +1,148 @@
+/**
+
+  @author Ing. Salvatore Cerami dev.salvatore.cerami@gmail.com
+
+  @brief SCD Message Center Record - https://github.com/sc-develop/SCD-MC
+
+         This program spies a set of senders of a message center server and writes their messages to a compact binary
+         capture file (see capturefile.h), with the time of arrival of each batch. The capture is fed back by
+         mc-replay. The recording stops on SIGINT/SIGTERM, after -d seconds or after -c messages.
+
+         Usage: mc-record [-H <host>] [-p <port>] [-d <seconds>] [-c <messages>] -o <file> <sender id> [<sender id> ...]
+
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+#include <msgclient.h>
+#include "capturefile.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+static int SignalPipe[2];
+
+/**
+ * @brief stopSignal writes to the signal pipe: the event loop is stopped by its notifier
+ */
+static void stopSignal(int)
+{
+   char c = 1;
+
+   if (::write(SignalPipe[1],&c,1)<0)
+   {
+      return;
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   QCommandLineParser parser;
+
+   parser.setApplicationDescription("Records the messages of message center senders into a capture file");
+   parser.addHelpOption();
+   parser.addOption(QCommandLineOption(QStringList() << "H" << "host","message center host (default 127.0.0.1)","host","127.0.0.1"));
+   parser.addOption(QCommandLineOption(QStringList() << "p" << "port","message center port (default 12346)","port","12346"));
+   parser.addOption(QCommandLineOption(QStringList() << "o" << "output","capture file","file"));
+   parser.addOption(QCommandLineOption(QStringList() << "d" << "duration","stop after seconds (default: until SIGINT)","seconds","0"));
+   parser.addOption(QCommandLineOption(QStringList() << "c" << "count","stop after messages (default: until SIGINT)","messages","0"));
+   parser.addPositionalArgument("senders","sender ids to record","<sender id> [<sender id> ...]");
+
+   parser.process(a);
+
+   QStringList senders = parser.positionalArguments();
+
+   QTextStream err(stderr);
+
+   if (senders.isEmpty() || !parser.isSet("output"))
+   {
+      parser.showHelp(1);
+   }
+
+   CaptureWriter capture;
+
+   if (!capture.open(parser.value("output")))
+   {
+      err << "Unable to create " << parser.value("output") << endl;
+      return 1;
+   }
+
+   if (::pipe(SignalPipe)<0)
+   {
+      return 1;
+   }
+
+   QSocketNotifier stop(SignalPipe[0],QSocketNotifier::Read);
+
+   QObject::connect(&stop,SIGNAL(activated(int)),&a,SLOT(quit()));
+
+   ::signal(SIGINT,stopSignal);
+   ::signal(SIGTERM,stopSignal);
+
+   int seconds = parser.value("duration").toInt();
+
+   if (seconds>0)
+   {
+      QTimer::singleShot(seconds*1000,&a,SLOT(quit()));
+   }
+
+   quint64 count = parser.value("count").toULongLong();
+
+   QTimer flush; // bounds the data lost by a crash
+
+   QObject::connect(&flush,&QTimer::timeout,[&capture]() {capture.flush();});
+
+   flush.start(1000);
+
+   QElapsedTimer clock;
+
+   clock.start();
+
+   QString host = parser.value("host");
+
+   quint16 port = parser.value("port").toInt();
+
+   for (int n=0; n<senders.size(); n++)
+   {
+      SCDMsgClient *client = new SCDMsgClient(&a);
+
+      int id = capture.sender(senders.at(n));
+
+      client->setHandler([&capture, &clock, &a, id, count](const QVector<SCDMsgClient::Message> &batch)
+      {
+         qint64 usecs = clock.nsecsElapsed()/1000; // time of arrival of batch
+
+         for (int i=0; i<batch.size(); i++)
+         {
+            if (!batch.at(i).data)
+            {
+               capture.write(id,usecs,batch.at(i).text,batch.at(i).size);
+            }
+         }
+
+         if (capture.failed() || (count>0 && capture.messages()>=count))
+         {
+            a.quit();
+         }
+      });
+
+      QObject::connect(client,&SCDMsgClient::error,[&err](QString error) {err << error << endl;});
+
+      client->connectToServer(host,port,senders.at(n));
+   }
+
+   int result = a.exec();
+
+   capture.close();
+
+   err << capture.messages() << " messages recorded in " << clock.elapsed()/1000.0 << " s" << endl;
+
+   return capture.failed() ? 2 : result;
+}
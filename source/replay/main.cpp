@@ -0,0 +1,80 @@
+/**
+
+  @author Ing. Salvatore Cerami dev.salvatore.cerami@gmail.com
+
+  @brief SCD Message Center Replay - https://github.com/sc-develop/SCD-MC
+
+         This program feeds a capture file recorded by mc-record to an in-process message center, with the real
+         message sizes and interleavings of the capture, at the original pacing, at a multiple of it (-s N) or as fast
+         as possible (-s 0). The clients connected to the message center server (port 12348) spy the replayed senders,
+         so a production performance problem can be reproduced.
+
+         Usage: mc-replay [-p <port>] [-t <I/O threads>] [-s <speed>] [-l <loops>] [-w <seconds>] <capture file>
+
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QTimer>
+#include <msgserver.h>
+#include "capturefile.h"
+#include "replaythread.h"
+
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   QCommandLineParser parser;
+
+   parser.setApplicationDescription("Replays a capture file into an in-process message center");
+   parser.addHelpOption();
+   parser.addOption(QCommandLineOption(QStringList() << "p" << "port","message center port (default 12348)","port","12348"));
+   parser.addOption(QCommandLineOption(QStringList() << "t" << "io-threads","shared I/O threads (default 0: one thread for each connection)","threads","0"));
+   parser.addOption(QCommandLineOption(QStringList() << "s" << "speed","multiple of capture pacing (default 1, 0: as fast as possible)","speed","1"));
+   parser.addOption(QCommandLineOption(QStringList() << "l" << "loops","times the capture is replayed (default 1)","loops","1"));
+   parser.addOption(QCommandLineOption(QStringList() << "w" << "wait","seconds waited for the clients before replay (default 0)","seconds","0"));
+   parser.addPositionalArgument("capture","capture file recorded by mc-record","<capture file>");
+
+   parser.process(a);
+
+   QTextStream err(stderr);
+
+   if (parser.positionalArguments().size()!=1)
+   {
+      parser.showHelp(1);
+   }
+
+   CaptureReader capture;
+
+   if (!capture.open(parser.positionalArguments().at(0)))
+   {
+      err << "Unable to read capture " << parser.positionalArguments().at(0) << endl;
+      return 1;
+   }
+
+   SCDMsgServer msgServer(parser.value("port").toInt(),false); // declare message center server
+
+   msgServer.setIoThreads(parser.value("io-threads").toInt());
+
+   msgServer.start();                                          // start message center server
+
+   ReplayThread replay(Q_NULLPTR,&capture,msgServer.messageCenter());
+
+   replay.setSpeed(qMax(0.0,parser.value("speed").toDouble()));
+   replay.setLoops(qMax(1,parser.value("loops").toInt()));
+
+   QObject::connect(&replay,&QThread::finished,[&]()
+   {
+      double seconds = replay.elapsed()/1e6;
+
+      err << replay.messages() << " messages, " << replay.bytes() << " bytes in " << seconds << " s ("
+          << (seconds>0 ? replay.messages()/seconds : 0) << " msgs/s), max lag " << replay.maxLag()/1000.0 << " ms" << endl;
+
+      QTimer::singleShot(500,&a,SLOT(quit())); // the clients receive the queued messages
+   });
+
+   QTimer::singleShot(qMax(0,parser.value("wait").toInt())*1000,[&replay]() {replay.start();});
+
+   return a.exec();
+}
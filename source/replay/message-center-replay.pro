@@ -0,0 +1,51 @@
+QT -= gui
+QT += network
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which as been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH = ../../ ../record/
+
+TARGET = mc-replay
+
+SOURCES += main.cpp \
+    ../../msgcenter.cpp \
+    ../../msgserver.cpp \
+    ../../msgserverthread.cpp \
+    ../../msgthreadhandler.cpp \
+    ../../msgiothread.cpp \
+    ../../msgstats.cpp \
+    ../../msgrules.cpp \
+    ../../msghandoff.cpp \
+    ../../msgcommands.cpp \
+    ../../msgexec.cpp \
+    ../../msgtail.cpp \
+    ../../msgsyslog.cpp \
+    ../../msgformat.cpp \
+    ../record/capturefile.cpp \
+    replaythread.cpp
+
+DESTDIR = ../../bin
+
+HEADERS += \
+    ../../msgcenter.h \
+    ../../msgserver.h \
+    ../../msgserverthread.h \
+    ../../msgthreadhandler.h \
+    ../../msgiothread.h \
+    ../../msgstats.h \
+    ../../msgrules.h \
+    ../../msghandoff.h \
+    ../../msgcommands.h \
+    ../../msgexec.h \
+    ../../msgtail.h \
+    ../../msgsyslog.h \
+    ../../msgformat.h \
+    ../record/capturefile.h \
+    replaythread.h
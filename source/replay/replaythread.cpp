@@ -0,0 +1,109 @@
+/**
+ * @class  ReplayThread - https://github.com/sc-develop/SCD-MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ * @brief SCD Message Center Replay: posting thread of captured traffic
+ *
+ *        This is a part of SCD Message Center Replay Program
+ *
+*/
+
+#include "replaythread.h"
+
+#include <QElapsedTimer>
+
+/**
+ * @brief ReplayThread::ReplayThread
+ * @param parent
+ * @param capture
+ * @param mc
+ */
+ReplayThread::ReplayThread(QObject *parent, CaptureReader *capture, SCDMsgCenter *mc) : QThread(parent), capture(capture), mc(mc),
+    Speed(1), Loops(1), Messages(0), Bytes(0), Elapsed(0), MaxLag(0)
+{
+}
+
+/**
+ * @brief ReplayThread::run posts the capture Loops times
+ */
+void ReplayThread::run()
+{
+   QElapsedTimer clock;
+
+   clock.start();
+
+   qint64 offset = 0; // capture time at start of current loop
+
+   QStringList batch;
+
+   int batchSender = -1;
+
+   qint64 batchTime = 0;
+
+   int registered = 0;
+
+   for (int loop=0; loop<Loops; loop++)
+   {
+      capture->rewind();
+
+      CaptureReader::Record record;
+
+      qint64 last = 0;
+
+      for (;;)
+      {
+         bool more = capture->next(&record);
+
+         const QStringList &senders = capture->senders();
+
+         while (registered<senders.size())
+         {
+            mc->addSender(senders.at(registered++));
+         }
+
+         if (!batch.isEmpty() && (!more || record.sender!=batchSender || record.usecs!=batchTime)) // batch complete
+         {
+            mc->postMessages(senders.at(batchSender),batch);
+
+            batch.clear();
+         }
+
+         if (!more)
+         {
+            break;
+         }
+
+         if (batch.isEmpty() && Speed>0) // pacing
+         {
+            qint64 due = qint64((offset + record.usecs)/Speed);
+
+            qint64 now = clock.nsecsElapsed()/1000;
+
+            if (due>now)
+            {
+               QThread::usleep(due - now);
+            }
+            else
+            {
+               MaxLag = qMax(MaxLag, now - due);
+            }
+         }
+
+         batch.append(QString::fromUtf8(record.text,record.size));
+
+         batchSender = record.sender;
+         batchTime   = record.usecs;
+
+         last = record.usecs;
+
+         Messages++;
+
+         Bytes += record.size;
+      }
+
+      offset += last;
+   }
+
+   Elapsed = clock.nsecsElapsed()/1000;
+}
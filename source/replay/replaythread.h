@@ -0,0 +1,53 @@
+#ifndef REPLAYTHREAD_H
+#define REPLAYTHREAD_H
+
+#include <QThread>
+#include <QStringList>
+#include <msgcenter.h>
+#include "capturefile.h"
+
+/**
+ * @brief The ReplayThread class posts the messages of a capture file to message center, with the senders, sizes and
+ *        interleaving of the capture. The messages received as a batch are posted as a batch. The pacing follows
+ *        the capture times divided by speed (0: as fast as possible).
+ */
+class ReplayThread : public QThread
+{
+    Q_OBJECT
+
+    public:
+
+      explicit ReplayThread(QObject *parent = 0, CaptureReader *capture = 0, SCDMsgCenter *mc = 0);
+
+      void setSpeed(double speed) {Speed = speed;}
+
+      void setLoops(int loops) {Loops = loops;}
+
+      void run(); // thread execution
+
+      quint64 messages() const {return Messages;}
+
+      quint64 bytes() const {return Bytes;}
+
+      qint64 elapsed() const {return Elapsed;} // usecs
+
+      qint64 maxLag() const {return MaxLag;}   // usecs behind the capture pacing
+
+    private:
+
+      CaptureReader *capture;
+
+      SCDMsgCenter *mc;
+
+      double Speed;
+
+      int Loops;
+
+      quint64 Messages;
+      quint64 Bytes;
+
+      qint64 Elapsed;
+      qint64 MaxLag;
+};
+
+#endif // REPLAYTHREAD_H
@@ -0,0 +1,111 @@
+/**
+
+  @author Ing. Salvatore Cerami dev.salvatore.cerami@gmail.com
+
+  @brief SCD Message Center Simulator - https://github.com/sc-develop/SCD-MC
+
+         This program simulates a production workload on the SCD Message Center: N streaming threads post messages at
+         configurable rates and size distributions, and monitoring clients are opened and closed over time.
+
+*/
+
+#include <QCoreApplication>
+#include <QSettings>
+#include <msgserver.h>
+#include "simulatorthread.h"
+#include "simulatorclients.h"
+
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   QSettings cfg("message-center-simulator.cfg");
+
+   cfg.beginGroup("MessageCenter");
+
+   int mcport = cfg.value("port",12346).toInt();     // load message center server port value and set default if not exists
+
+   cfg.setValue("port",mcport);                      // save value
+
+   int mcthreads = cfg.value("ioThreads",0).toInt(); // load number of message center shared I/O threads (0: one thread for each connection)
+
+   cfg.setValue("ioThreads",mcthreads);              // save value
+
+   cfg.endGroup();
+
+   cfg.beginGroup("Simulator");
+
+   int threads = cfg.value("threads",4).toInt();     // number of streaming threads
+
+   cfg.setValue("threads",threads);
+
+   SimulatorLoad load;
+
+   load.rate = cfg.value("rate",100).toDouble();     // messages per second of each thread
+
+   cfg.setValue("rate",load.rate);
+
+   QString distribution = cfg.value("distribution","exp").toString(); // message size distribution: fixed, uniform, exp, pareto
+
+   if (!SimulatorLoad::parseDistribution(distribution,&load.distribution))
+   {
+      load.distribution = SimulatorLoad::Exponential;
+   }
+
+   cfg.setValue("distribution",SimulatorLoad::distributionName(load.distribution));
+
+   load.size = qMax(1,cfg.value("size",120).toInt());          // mean message size (bytes)
+
+   cfg.setValue("size",load.size);
+
+   load.maxSize = qMax(1,cfg.value("maxSize",16384).toInt());  // max message size (bytes)
+
+   cfg.setValue("maxSize",load.maxSize);
+
+   load.warnings = cfg.value("warnings",10).toInt();           // per mille of messages with level Warning
+
+   cfg.setValue("warnings",load.warnings);
+
+   int clients = cfg.value("clients",8).toInt();               // monitoring clients connected at the same time
+
+   cfg.setValue("clients",clients);
+
+   int lifetime = cfg.value("clientLifetime",5000).toInt();    // mean connection lifetime of a client (ms)
+
+   cfg.setValue("clientLifetime",lifetime);
+
+   int slowReaders = cfg.value("slowReaders",10).toInt();      // per cent of clients which read once a second
+
+   cfg.setValue("slowReaders",slowReaders);
+
+   cfg.endGroup();
+
+   cfg.sync();
+
+   SCDMsgServer msgServer(mcport,true);  // declare message center server
+
+   msgServer.setIoThreads(mcthreads);    // host the client sessions on shared I/O threads
+
+   msgServer.start();                    // start message center server
+
+   QStringList senders;
+
+   for (int n=0; n<threads; n++)
+   {
+      QString sender = "sim." + QString::number(n);
+
+      SimulatorThread *thread = new SimulatorThread(&a,sender,load,msgServer.messageCenter());
+
+      QObject::connect(&a,SIGNAL(aboutToQuit()),thread,SLOT(quit()));
+
+      thread->start();
+
+      senders.append(sender);
+   }
+
+   SimulatorClients churn(Q_NULLPTR,mcport,senders);
+
+   churn.start(clients,lifetime,slowReaders);  // open and close monitoring clients over time
+
+   return a.exec();                            // start application main event loop
+}
@@ -0,0 +1,177 @@
+/**
+ * @class  SimulatorClients - https://github.com/sc-develop/SCD-MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ * @brief SCD Message Center Simulator: monitoring clients churn
+ *
+ *        This is a part of SCD Message Center Simulator Program
+ *
+*/
+
+#include <QHostAddress>
+#include <QDebug>
+#include "simulatorclients.h"
+
+/**
+ * @brief SimulatorClients::SimulatorClients
+ * @param parent
+ * @param port message center port
+ * @param senders senders spied by clients
+ */
+SimulatorClients::SimulatorClients(QObject *parent, int port, QStringList senders) :
+    QObject(parent),
+    port(port),
+    senders(senders),
+    Clients(0),
+    Lifetime(0),
+    SlowReaders(0),
+    lastRead(0),
+    opened(0),
+    closed(0),
+    received(0)
+{
+   connect(&timer,SIGNAL(timeout()),this,SLOT(churn()));
+}
+
+/**
+ * @brief SimulatorClients::start starts the clients churn
+ * @param clients number of connected clients (0: no clients)
+ * @param lifetime mean connection lifetime (ms)
+ * @param slowReaders per cent of slow reader clients
+ */
+void SimulatorClients::start(int clients, int lifetime, int slowReaders)
+{
+   Clients     = clients;
+   Lifetime    = qMax(1,lifetime);
+   SlowReaders = slowReaders;
+
+   if (Clients>0 && !senders.isEmpty())
+   {
+      clock.start();
+
+      timer.start(100);
+   }
+}
+
+/**
+ * @brief SimulatorClients::churn closes the expired clients, opens the missing ones and reads the slow readers
+ */
+void SimulatorClients::churn()
+{
+   qint64 now = clock.elapsed();
+
+   for (int n=0; n<clients.size(); n++)
+   {
+      if (now>=clients.at(n).closeAt && clients.at(n).socket->state()==QAbstractSocket::ConnectedState)
+      {
+         clients.at(n).socket->disconnectFromHost(); // removed on disconnected()
+      }
+   }
+
+   while (clients.size()<Clients)
+   {
+      open();
+   }
+
+   if (now - lastRead >= 1000)
+   {
+      for (int n=0; n<clients.size(); n++)
+      {
+         if (clients.at(n).slow)
+         {
+            received += clients.at(n).socket->readAll().size();
+         }
+      }
+
+      qDebug() << "Clients: opened" << opened << "closed" << closed << "received" << received << "bytes";
+
+      lastRead = now;
+   }
+}
+
+/**
+ * @brief SimulatorClients::open connects a new client which spies a random sender
+ */
+void SimulatorClients::open()
+{
+   std::uniform_int_distribution<int> sender(0,senders.size()-1);
+   std::uniform_int_distribution<int> percent(0,99);
+   std::exponential_distribution<double> lifetime(1.0/Lifetime);
+
+   Client client;
+
+   client.socket  = new QTcpSocket(this);
+   client.closeAt = clock.elapsed() + qint64(lifetime(random));
+   client.slow    = percent(random)<SlowReaders;
+
+   if (client.slow)
+   {
+      client.socket->setReadBufferSize(64*1024); // the kernel buffers fill up: message center queues for the client
+   }
+   else
+   {
+      connect(client.socket,SIGNAL(readyRead()),this,SLOT(readyRead()));
+   }
+
+   connect(client.socket,SIGNAL(disconnected()),this,SLOT(disconnected()));
+   connect(client.socket,SIGNAL(error(QAbstractSocket::SocketError)),this,SLOT(disconnected()));
+
+   client.socket->connectToHost(QHostAddress::LocalHost,port);
+   client.socket->write("spy " + senders.at(sender(random)).toUtf8() + "\n");
+
+   clients.append(client);
+
+   opened++;
+}
+
+/**
+ * @brief SimulatorClients::readyRead fast readers discard the received messages
+ */
+void SimulatorClients::readyRead()
+{
+   QTcpSocket *socket = qobject_cast<QTcpSocket*>(QObject::sender());
+
+   if (socket)
+   {
+      received += socket->readAll().size();
+   }
+}
+
+/**
+ * @brief SimulatorClients::disconnected removes the client, a new one is opened on next churn
+ */
+void SimulatorClients::disconnected()
+{
+   int n = find(QObject::sender());
+
+   if (n>=0)
+   {
+      QTcpSocket *socket = clients.at(n).socket;
+
+      clients.removeAt(n);
+
+      socket->disconnect(this);
+      socket->deleteLater();
+
+      closed++;
+   }
+}
+
+/**
+ * @brief SimulatorClients::find
+ * @param socket
+ * @return index of client with socket, -1 if not found
+ */
+int SimulatorClients::find(QObject *socket)
+{
+   for (int n=0; n<clients.size(); n++)
+   {
+      if (clients.at(n).socket==socket)
+      {
+         return n;
+      }
+   }
+
+   return -1;
+}
@@ -0,0 +1,69 @@
+#ifndef SIMULATORCLIENTS_H
+#define SIMULATORCLIENTS_H
+
+#include <QObject>
+#include <QTimer>
+#include <QTcpSocket>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include <random>
+
+/**
+ * @brief The SimulatorClients class opens and closes monitoring connections to message center over time: each client
+ *        spies a random sender for a random lifetime, then it disconnects and a new client is opened.
+ *        A share of the clients are slow readers, that read their socket only once a second.
+ */
+class SimulatorClients : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+      explicit SimulatorClients(QObject *parent = 0, int port = 12346, QStringList senders = QStringList());
+
+      void start(int clients, int lifetime, int slowReaders);
+
+    public slots:
+
+      void churn();
+      void readyRead();
+      void disconnected();
+
+    private:
+
+      struct Client
+      {
+         QTcpSocket *socket;
+         qint64 closeAt;      // ms of clock
+         bool slow;           // slow reader
+      };
+
+      int port;
+
+      QStringList senders;    // senders spied by clients
+
+      int Clients;            // number of connected clients
+      int Lifetime;           // mean connection lifetime (ms)
+      int SlowReaders;        // per cent of slow readers
+
+      QList<Client> clients;
+
+      QTimer timer;
+
+      QElapsedTimer clock;
+
+      qint64 lastRead;        // ms of last read of slow readers
+
+      qint64 opened;
+      qint64 closed;
+      qint64 received;        // bytes
+
+      std::mt19937 random;
+
+      void open();
+
+      int find(QObject *socket);
+};
+
+#endif // SIMULATORCLIENTS_H
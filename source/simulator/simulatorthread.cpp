@@ -0,0 +1,352 @@
+/**
+ * @class  SimulatorThread - https://github.com/sc-develop/SCD-MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ * @brief SCD Message Center Simulator: streaming thread
+ *
+ *        This is a part of SCD Message Center Simulator Program
+ *
+ *        Each thread is a message center sender which posts messages at a given rate, with sizes drawn from a
+ *        distribution. The workload is changed at runtime by the monitoring clients: '@sim.0 rate 5000'
+ *
+*/
+
+#include <QStringList>
+#include <qmath.h>
+#include "simulatorthread.h"
+
+/**
+ * @brief SimulatorLoad::parseDistribution
+ * @param name fixed, uniform, exp, pareto
+ * @param distribution
+ * @return false if name is unknown
+ */
+bool SimulatorLoad::parseDistribution(QString name, Distribution *distribution)
+{
+   static const char *names[] = {"fixed", "uniform", "exp", "pareto"};
+
+   for (int n=0; n<4; n++)
+   {
+      if (name==names[n])
+      {
+         *distribution = Distribution(n);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/**
+ * @brief SimulatorLoad::distributionName
+ * @param distribution
+ * @return
+ */
+QString SimulatorLoad::distributionName(Distribution distribution)
+{
+   static const char *names[] = {"fixed", "uniform", "exp", "pareto"};
+
+   return names[distribution];
+}
+
+/**
+ * @brief SimulatorThread::SimulatorThread constructor
+ * @param parent
+ * @param sender sender id of thread
+ * @param load workload
+ * @param mc message center
+ */
+SimulatorThread::SimulatorThread(QObject *parent, QString sender, SimulatorLoad load, SCDMsgCenter *mc) :
+    QThread(parent),
+    sender(sender),
+    load(load),
+    mc(mc)
+{
+
+}
+
+/**
+ * @brief SimulatorThread::run => thread main function
+ */
+void SimulatorThread::run()
+{
+   mc->addSender(sender); // register the thread sender to message center
+
+   SimulatorGenerator generator(sender,load,mc); // lives into the thread space
+
+   generator.start();
+
+   exec(); // starts event loop and waits until event loop exits
+
+   mc->removeSender(sender);
+}
+
+/**
+ * @brief SimulatorGenerator::SimulatorGenerator
+ * @param sender
+ * @param load
+ * @param mc
+ */
+SimulatorGenerator::SimulatorGenerator(QString sender, SimulatorLoad load, SCDMsgCenter *mc) :
+    sender(sender),
+    load(load),
+    mc(mc),
+    lastTick(0),
+    due(0),
+    posted(0),
+    bytes(0),
+    paused(false),
+    random(qHash(sender))
+{
+   filler.fill('x',qMax(1,load.maxSize));
+
+   connect(&timer,SIGNAL(timeout()),this,SLOT(tick()));
+   connect(mc,SIGNAL(commandToSender_signal(QString,QString)),this,SLOT(onClientCommand(QString,QString)));
+}
+
+/**
+ * @brief SimulatorGenerator::start starts posting
+ */
+void SimulatorGenerator::start()
+{
+   mc->addSenderCommand(sender,"rate","<msg/s>","set the posting rate (messages per second)");
+   mc->addSenderCommand(sender,"size","<fixed|uniform|exp|pareto> <mean:int> [<max:int>]","set the message size distribution");
+   mc->addSenderCommand(sender,"warnings","<per mille:int>","set the share of messages posted with level Warning");
+   mc->addSenderCommand(sender,"burst","<count:int>","post count messages at once");
+   mc->addSenderCommand(sender,"pause","","stop posting");
+   mc->addSenderCommand(sender,"resume","","restart posting");
+   mc->addSenderCommand(sender,"status","","show workload and counters");
+
+   clock.start();
+
+   timer.start(Tick);
+
+   mc->postMessage("Started: " + status(),sender);
+}
+
+/**
+ * @brief SimulatorGenerator::tick posts the messages due since last tick
+ */
+void SimulatorGenerator::tick()
+{
+   qint64 now = clock.elapsed();
+
+   if (!paused)
+   {
+      due += load.rate * (now - lastTick) / 1000;
+
+      due = qMin(due, qMax(1.0,load.rate)); // a stalled thread does not catch up more than one second of messages
+
+      int count = int(due);
+
+      due -= count;
+
+      post(count);
+   }
+
+   lastTick = now;
+}
+
+/**
+ * @brief SimulatorGenerator::post posts count messages with sizes drawn from the distribution
+ * @param count
+ */
+void SimulatorGenerator::post(int count)
+{
+   std::uniform_int_distribution<int> permille(0,999);
+   std::uniform_int_distribution<int> latency(1,250);
+
+   for (int n=0; n<count; n++)
+   {
+      int size = drawSize();
+
+      QString msg = "request " + QString::number(posted) + " served in " + QString::number(latency(random)) + "ms ";
+
+      if (msg.size()<size)
+      {
+         msg += QString::fromLatin1(filler.constData(), size - msg.size());
+      }
+
+      int level = permille(random)<load.warnings ? SCDMsgCenter::Warning : SCDMsgCenter::Info;
+
+      mc->postMessage(msg,sender,level);
+
+      posted++;
+      bytes += msg.size();
+   }
+}
+
+/**
+ * @brief SimulatorGenerator::drawSize draws a message size from the distribution
+ * @return size in [1, maxSize]
+ */
+int SimulatorGenerator::drawSize()
+{
+   double size = load.size;
+
+   switch (load.distribution)
+   {
+      case SimulatorLoad::Fixed:
+      break;
+
+      case SimulatorLoad::Uniform:
+      {
+         std::uniform_real_distribution<double> uniform(1, 2.0 * load.size);
+
+         size = uniform(random);
+      }
+      break;
+
+      case SimulatorLoad::Exponential:
+      {
+         std::exponential_distribution<double> exponential(1.0 / qMax(1,load.size));
+
+         size = exponential(random);
+      }
+      break;
+
+      case SimulatorLoad::Pareto: // shape 1.5: mean = 3 x scale, heavy tail of large messages
+      {
+         std::uniform_real_distribution<double> uniform(0, 1);
+
+         size = (load.size / 3.0) / qPow(1.0 - uniform(random), 1.0 / 1.5);
+      }
+      break;
+   }
+
+   return int(qBound(1.0, size, double(qMax(1,load.maxSize))));
+}
+
+/**
+ * @brief SimulatorGenerator::status
+ * @return current workload and counters
+ */
+QString SimulatorGenerator::status()
+{
+   return QString::number(load.rate) + " msg/s, size " + SimulatorLoad::distributionName(load.distribution)
+          + " " + QString::number(load.size) + " max " + QString::number(load.maxSize)
+          + ", posted " + QString::number(posted) + " messages " + QString::number(bytes) + " bytes"
+          + (paused ? ", paused" : "");
+}
+
+/**
+ * @brief SimulatorGenerator::onClientCommand process client command signals:
+ *
+ *        rate <msg/s>
+ *        size fixed|uniform|exp|pareto <mean> [<max>]
+ *        warnings <per mille>
+ *        burst <count>
+ *        pause
+ *        resume
+ *        status
+ *
+ * @param cmd
+ * @param sender
+ */
+void SimulatorGenerator::onClientCommand(QString cmd, QString sender)
+{
+   if (sender!=this->sender)
+   {
+      return;
+   }
+
+   QStringList args = cmd.split(' ',QString::SkipEmptyParts);
+
+   QString command = args.isEmpty() ? "" : args.takeFirst();
+
+   bool ok = true;
+
+   if (command=="rate" && args.size()==1)
+   {
+      double rate = args.at(0).toDouble(&ok);
+
+      if (ok && rate>=0)
+      {
+         load.rate = rate;
+      }
+      else
+      {
+         ok = false;
+      }
+   }
+   else
+   if (command=="size" && (args.size()==2 || args.size()==3))
+   {
+      SimulatorLoad::Distribution distribution;
+
+      int size    = args.at(1).toInt(&ok);
+      int maxSize = args.size()==3 ? args.at(2).toInt(&ok) : load.maxSize;
+
+      if (ok && size>0 && maxSize>0 && SimulatorLoad::parseDistribution(args.at(0),&distribution))
+      {
+         load.distribution = distribution;
+         load.size         = size;
+         load.maxSize      = maxSize;
+
+         if (filler.size()<maxSize)
+         {
+            filler.fill('x',maxSize);
+         }
+      }
+      else
+      {
+         ok = false;
+      }
+   }
+   else
+   if (command=="warnings" && args.size()==1)
+   {
+      int warnings = args.at(0).toInt(&ok);
+
+      if (ok && warnings>=0 && warnings<=1000)
+      {
+         load.warnings = warnings;
+      }
+      else
+      {
+         ok = false;
+      }
+   }
+   else
+   if (command=="burst" && args.size()==1)
+   {
+      int count = args.at(0).toInt(&ok);
+
+      if (ok && count>0)
+      {
+         post(count);
+      }
+      else
+      {
+         ok = false;
+      }
+   }
+   else
+   if (command=="pause" && args.isEmpty())
+   {
+      paused = true;
+   }
+   else
+   if (command=="resume" && args.isEmpty())
+   {
+      paused   = false;
+      due      = 0;
+      lastTick = clock.elapsed();
+   }
+   else
+   if (command!="status" || !args.isEmpty())
+   {
+      ok = false;
+   }
+
+   if (ok)
+   {
+      mc->postMessage(status(),this->sender);
+   }
+   else
+   {
+      mc->postMessage("Unknown command: " + cmd + " (rate <msg/s>, size fixed|uniform|exp|pareto <mean> [<max>], "
+                      "warnings <per mille>, burst <count>, pause, resume, status)",this->sender);
+   }
+}
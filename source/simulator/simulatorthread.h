@@ -0,0 +1,99 @@
+#ifndef SIMULATORTHREAD_H
+#define SIMULATORTHREAD_H
+
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <msgcenter.h>
+
+#include <random>
+
+/**
+ * @brief The SimulatorLoad struct workload of a streaming thread: message rate and size distribution
+ */
+struct SimulatorLoad
+{
+   enum Distribution {Fixed, Uniform, Exponential, Pareto};
+
+   double rate;               // messages per second
+   Distribution distribution; // message size distribution
+   int size;                  // mean message size (bytes)
+   int maxSize;               // max message size (bytes)
+   int warnings;              // per mille of messages posted with level Warning
+
+   static bool parseDistribution(QString name, Distribution *distribution);
+
+   static QString distributionName(Distribution distribution);
+};
+
+class SimulatorThread : public QThread
+{
+    Q_OBJECT
+
+    public:
+
+      explicit SimulatorThread(QObject *parent = 0, QString sender = "", SimulatorLoad load = SimulatorLoad(), SCDMsgCenter *mc = 0);
+
+      void run(); // thread execution
+
+      QString getSender() {return sender;}
+
+    private:
+
+      QString sender; // sender id of thread
+
+      SimulatorLoad load;
+
+      SCDMsgCenter *mc;
+};
+
+class SimulatorGenerator : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+      explicit SimulatorGenerator(QString sender, SimulatorLoad load, SCDMsgCenter *mc);
+
+      void start();
+
+    public slots:
+
+      void tick();
+      void onClientCommand(QString cmd, QString sender);
+
+    private:
+
+      static const int Tick = 10; // ms between two posting rounds
+
+      QString sender;
+
+      SimulatorLoad load;
+
+      SCDMsgCenter *mc;
+
+      QTimer timer;
+
+      QElapsedTimer clock;
+
+      qint64 lastTick;
+
+      double due;     // messages due and not yet posted (fraction of message carried to next tick)
+
+      qint64 posted;  // posted messages
+      qint64 bytes;   // posted bytes
+
+      bool paused;
+
+      QByteArray filler; // message payload, cut to the drawn size
+
+      std::mt19937 random;
+
+      int drawSize();
+
+      void post(int count);
+
+      QString status();
+};
+
+#endif // SIMULATORTHREAD_H
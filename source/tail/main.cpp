@@ -0,0 +1,89 @@
+/**
+
+  @author Ing. Salvatore Cerami dev.salvatore.cerami@gmail.com
+
+  @brief SCD Message Center Tail - https://github.com/sc-develop/SCD-MC
+
+         This program spies one or more senders of a message center server and writes their messages to stdout or to
+         a file, one line for each message. It is built on SCDMsgClient: the connection is resumed after a network
+         failure or a server restart without losing messages (as far as the server history covers the outage).
+
+         Usage: mc-tail [-H <host>] [-p <port>] [-o <file> [-a]] [-n] [-r] <sender id> [<sender id> ...]
+
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QVector>
+#include <msgclient.h>
+#include "tailoutput.h"
+
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   QCommandLineParser parser;
+
+   parser.setApplicationDescription("Writes the messages of message center senders to stdout or to a file");
+   parser.addHelpOption();
+   parser.addOption(QCommandLineOption(QStringList() << "H" << "host","message center host (default 127.0.0.1)","host","127.0.0.1"));
+   parser.addOption(QCommandLineOption(QStringList() << "p" << "port","message center port (default 12346)","port","12346"));
+   parser.addOption(QCommandLineOption(QStringList() << "o" << "output","write to file instead of stdout","file"));
+   parser.addOption(QCommandLineOption(QStringList() << "a" << "append","append to output file"));
+   parser.addOption(QCommandLineOption(QStringList() << "n" << "no-sender","do not write the sender id before each message"));
+   parser.addOption(QCommandLineOption(QStringList() << "r" << "no-resume","do not resume the session after a reconnection"));
+   parser.addPositionalArgument("senders","sender ids to spy","<sender id> [<sender id> ...]");
+
+   parser.process(a);
+
+   QStringList senders = parser.positionalArguments();
+
+   QTextStream err(stderr);
+
+   if (senders.isEmpty())
+   {
+      parser.showHelp(1);
+   }
+
+   TailOutput output;
+
+   if (parser.isSet("output") && !output.open(parser.value("output"),parser.isSet("append")))
+   {
+      err << "Unable to open " << parser.value("output") << endl;
+      return 1;
+   }
+
+   QString host = parser.value("host");
+
+   quint16 port = parser.value("port").toInt();
+
+   QVector<SCDMsgClient*> clients;
+
+   for (int n=0; n<senders.size(); n++)
+   {
+      SCDMsgClient *client = new SCDMsgClient(&a);
+
+      QByteArray prefix = parser.isSet("no-sender") ? QByteArray() : senders.at(n).toUtf8() + ": ";
+
+      client->setResumable(!parser.isSet("no-resume"));
+
+      client->setHandler([&output, &a, prefix](const QVector<SCDMsgClient::Message> &batch)
+      {
+         output.write(prefix,batch);
+
+         if (output.failed()) // reader gone or disk full
+         {
+            a.exit(2);
+         }
+      });
+
+      QObject::connect(client,&SCDMsgClient::error,[&err](QString error) {err << error << endl;});
+
+      client->connectToServer(host,port,senders.at(n));
+
+      clients.append(client);
+   }
+
+   return a.exec();
+}
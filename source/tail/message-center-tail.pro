@@ -0,0 +1,25 @@
+QT -= gui
+QT += network
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which as been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH = ../../
+
+TARGET = mc-tail
+
+SOURCES += main.cpp \
+    ../../msgclient.cpp \
+    tailoutput.cpp
+
+DESTDIR = ../../bin
+
+HEADERS += \
+    ../../msgclient.h \
+    tailoutput.h
@@ -0,0 +1,99 @@
+/**
+ * @class  TailOutput - https://github.com/sc-develop/SCD-MC
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+ * @brief SCD Message Center Tail: buffered output of received messages
+ *
+ *        This is a part of SCD Message Center Tail Program
+ *
+*/
+
+#include "tailoutput.h"
+
+#include <QFile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief TailOutput::open writes to a file instead of stdout
+ * @param path
+ * @param append
+ * @return false if the file can not be opened
+ */
+bool TailOutput::open(QString path, bool append)
+{
+   int fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+
+   if (fd<0)
+   {
+      return false;
+   }
+
+   Fd = fd;
+
+   return true;
+}
+
+/**
+ * @brief TailOutput::write appends a batch of messages as lines '<prefix><message>'. Binary payload chunks are not
+ *                          written.
+ * @param prefix
+ * @param batch
+ */
+void TailOutput::write(const QByteArray &prefix, const QVector<SCDMsgClient::Message> &batch)
+{
+   for (int n=0; n<batch.size(); n++)
+   {
+      const SCDMsgClient::Message &message = batch.at(n);
+
+      if (message.data)
+      {
+         continue;
+      }
+
+      Buffer.append(prefix);
+      Buffer.append(message.text,message.size);
+      Buffer.append('\n');
+
+      if (Buffer.size()>=BufferSize)
+      {
+         flush();
+      }
+   }
+
+   flush();
+}
+
+/**
+ * @brief TailOutput::flush writes the buffer
+ */
+void TailOutput::flush()
+{
+   const char *data = Buffer.constData();
+
+   int left = Buffer.size();
+
+   while (left>0 && !Failed)
+   {
+      ssize_t size = ::write(Fd, data, left);
+
+      if (size<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (size<0)
+      {
+         Failed = true;
+         break;
+      }
+
+      data += size;
+      left -= size;
+   }
+
+   Buffer.resize(0);
+}
@@ -0,0 +1,38 @@
+#ifndef TAILOUTPUT_H
+#define TAILOUTPUT_H
+
+#include <QByteArray>
+#include <QVector>
+#include <msgclient.h>
+
+/**
+ * @brief The TailOutput class writes the messages received by the clients to stdout or to a file. The lines are
+ *        copied into a single buffer, written by one write(2) for each decoded batch (or when the buffer is full),
+ *        so the output costs a memcpy for each message.
+ */
+class TailOutput
+{
+    public:
+
+      explicit TailOutput(int fd = 1) : Fd(fd), Failed(false) {Buffer.reserve(BufferSize + 65536);}
+
+      bool open(QString path, bool append);
+
+      void write(const QByteArray &prefix, const QVector<SCDMsgClient::Message> &batch);
+
+      void flush();
+
+      bool failed() const {return Failed;} // write error (e.g. closed pipe, full disk)
+
+    private:
+
+      static const int BufferSize = 1048576;
+
+      int Fd;
+
+      bool Failed;
+
+      QByteArray Buffer;
+};
+
+#endif // TAILOUTPUT_H